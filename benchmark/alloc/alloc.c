@@ -1,115 +1,301 @@
 /**
  * \file alloc.c
- * \brief Comparaison entre l'allocation d'un tableau
- * sur le heap et sur la stack
+ * \brief Comparaison entre les façons d'obtenir un tableau de travail
+ *
+ * Pour chaque taille de 64 bytes à 1 MiB, on obtient puis on rend un
+ * tableau
+ * * `heap` : avec `malloc` et `free`;
+ * * `stack` : tableau local de taille fixe;
+ * * `alloca` : `alloca` dans une fonction;
+ * * `vla` : tableau local de taille variable;
+ * * `tls` : buffer statique propre au thread (`__thread`), rien à allouer;
+ * * `arena` : `arena_push` puis `arena_reset` (`lib/arena.c`).
+ *
+ * `<variante>-alloc.csv` contient le temps pour obtenir le tableau, y
+ * écrire un byte et le rendre, `<variante>-touch.csv` le temps pour
+ * l'obtenir, l'écrire entièrement et le rendre, suivis des fautes de page
+ * et de la variation de RSS par appel (`write_record_mem`). Chaque
+ * fonction est `noinline` et `BM_DO_NOT_OPTIMIZE` (`benchmark.h`) oblige
+ * le compilateur à garder le tableau et les écritures : sans ça, un
+ * tableau local dont on ne lit rien peut disparaître complètement.
+ *
+ * Un tableau local de 1 MiB ne tient pas dans la pile d'un thread
+ * quelconque (souvent 8 MiB pour le thread principal, parfois beaucoup
+ * moins) : les mesures tournent dans un thread avec une pile de
+ * `STACK_SIZE` bytes.
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <alloca.h>
+#include <pthread.h>
 
 #include "benchmark.h"
+#include "arena.h"
 
-#define N 100
-#define SIZE_1 0x1000   //  4 KiB
-#define SIZE_2 0x10000  // 64 KiB
-#define SIZE_3 0x100000 //  1 MiB
+#define MAX_SIZE 0x100000 //  1 MiB
+#define STACK_SIZE (64 * 1024 * 1024)
+#define WORK (1L << 26) //!< Bytes écrits au minimum par mesure de `touch`
+#define BATCH 1024 //!< Objets alloués avant de tous les libérer
+#define ROUNDS 1000
+#define MIN_OBJ 16
+#define MAX_OBJ 4096
 
 /**
- * \brief allocation d'un tableau de taille `SIZE_1` sur la stack
+ * \brief Utilise le tableau `s` de `size` bytes
+ *
+ * Avec `touch`, on écrit tout le tableau, sinon un seul byte.
  */
-char stack_1 () {
-  char s[SIZE_1];
-  s[SIZE_1 / 2] = 0;
-  return s[0];
+static inline void use (char *s, size_t size, int touch) {
+  if (touch) {
+    memset(s, 1, size);
+  } else {
+    s[size / 2] = 1;
+  }
+  BM_DO_NOT_OPTIMIZE(s);
 }
 
-/**
- * \brief allocation d'un tableau de taille `SIZE_2` sur la stack
- */
-char stack_2 () {
-  char s[SIZE_2];
-  s[SIZE_2 / 2] = 0;
-  return s[0];
+__attribute__((noinline)) void get_heap (size_t size, int touch) {
+  char *s = (char *) malloc(size);
+  if (s == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  use(s, size, touch);
+  free(s);
 }
 
-/**
- * \brief allocation d'un tableau de taille `SIZE_3` sur la stack
- */
-char stack_3 () {
-  char s[SIZE_3];
-  s[SIZE_3 / 2] = 0;
-  return s[0];
+__attribute__((noinline)) void get_alloca (size_t size, int touch) {
+  char *s = (char *) alloca(size);
+  use(s, size, touch);
 }
 
-/**
- * \brief allocation d'un tableau de taille `SIZE_1` sur le heap
- *
- * Le `free` a été commenté pour voir l'effet du remplissage du
- * `heap`. Décommentez le pour voir ce que ça change.
- */
-char heap_1 () {
-  char *s = (char *) malloc(sizeof(char) * SIZE_1);
-  s[SIZE_1 / 2] = 0;
-  return s[0];
-  //free(s);
+__attribute__((noinline)) void get_vla (size_t size, int touch) {
+  char s[size];
+  use(s, size, touch);
+}
+
+static __thread char tls_buffer[MAX_SIZE];
+
+__attribute__((noinline)) void get_tls (size_t size, int touch) {
+  use(tls_buffer, size, touch);
+}
+
+arena *scratch;
+
+__attribute__((noinline)) void get_arena (size_t size, int touch) {
+  char *s = (char *) arena_push(scratch, size);
+  use(s, size, touch);
+  arena_reset(scratch);
 }
 
+/*
+ * Un tableau local de taille fixe demande une fonction par taille
+ */
+#define STACK(size) \
+  __attribute__((noinline)) void stack_##size (size_t n, int touch) { \
+    char s[size]; \
+    use(s, size, touch); \
+  }
+STACK(64)
+STACK(512)
+STACK(4096)
+STACK(32768)
+STACK(262144)
+STACK(1048576)
+
 /**
- * \brief allocation d'un tableau de taille `SIZE_1` sur le heap
+ * \brief Tailles mesurées, et la fonction `stack` correspondante
  */
-char heap_2 () {
-  char *s = (char *) malloc(sizeof(char) * SIZE_2);
-  s[SIZE_2 / 2] = 0;
-  return s[0];
-  //free(s);
-}
+static const struct {
+  size_t size;
+  void (*stack) (size_t size, int touch);
+} sizes[] = {
+  {64, stack_64},
+  {512, stack_512},
+  {4096, stack_4096},
+  {32768, stack_32768},
+  {262144, stack_262144},
+  {1048576, stack_1048576},
+};
+
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+typedef struct variant {
+  const char *name;
+  void (*get) (size_t size, int touch); //!< `NULL` pour `stack`
+} variant;
+
+static const variant variants[] = {
+  {"heap", get_heap},
+  {"stack", NULL},
+  {"alloca", get_alloca},
+  {"vla", get_vla},
+  {"tls", get_tls},
+  {"arena", get_arena},
+};
+
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
 
 /**
- * \brief allocation d'un tableau de taille `SIZE_1` sur le heap
+ * \brief Mesure toutes les variantes, dans le thread à grande pile
  */
-char heap_3 () {
-  char *s = (char *) malloc(sizeof(char) * SIZE_3);
-  s[SIZE_3 / 2] = 0;
-  return s[0];
-  //free(s);
+void *scratch_buffers (void *param) {
+  timer *t = (timer *) param;
+  unsigned int v, i;
+  for (v = 0; v < NVARIANTS; v++) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s-alloc.csv", variants[v].name);
+    recorder *alloc_rec = recorder_alloc(name);
+    snprintf(name, sizeof(name), "%s-touch.csv", variants[v].name);
+    recorder *touch_rec = recorder_alloc(name);
+    for (i = 0; i < NSIZES; i++) {
+      size_t size = sizes[i].size;
+      void (*get) (size_t, int) = variants[v].get != NULL ?
+        variants[v].get : sizes[i].stack;
+      long n = WORK / size < 100 ? 100 : WORK / size;
+      int touch;
+      for (touch = 0; touch <= 1; touch++) {
+        long j;
+        memstat mem;
+        memstat_reset(&mem);
+        // une première fois pour que les pages soient en mémoire
+        get(size, touch);
+        memstat_start(&mem);
+        start_timer(t);
+        for (j = 0; j < n; j++) {
+          get(size, touch);
+        }
+        long time = stop_timer(t);
+        memstat_stop(&mem);
+        write_record_mem(touch ? touch_rec : alloc_rec, size, time, n, &mem);
+      }
+    }
+    recorder_free(alloc_rec);
+    recorder_free(touch_rec);
+  }
+  return NULL;
 }
 
-/**
- * \brief Mesure `N` appels de `fun`
+/*
+ * Allocateurs de `lib/arena.c` contre `malloc`
  *
- * \param t `timer` utilisé pour la mesure du temps
- * \param fun fonction dont on mesure les performances
- * \param rec `recorder` dans lequel on enregistre le temps
- * \param x abscisse à laquel on enregistre le temps
+ * `ROUNDS` fois, on alloue `BATCH` objets de la même taille puis on les
+ * libère tous, comme la mémoire de travail d'une itération. On enregistre
+ * le temps par objet (allocation et libération).
+ */
+
+/**
+ * \brief Le résultat des écritures, pour que le compilateur les garde
  */
-void benchmark_fun (timer *t, char (*fun) (), recorder *rec, int x) {
-  int i;
+volatile char sink;
+
+void batch_malloc (timer *t, recorder *rec, size_t size) {
+  char *objs[BATCH];
+  int r, i;
   start_timer(t);
-  for (i = 0; i < N; i++) {
-    char c = fun();
+  for (r = 0; r < ROUNDS; r++) {
+    for (i = 0; i < BATCH; i++) {
+      objs[i] = (char *) malloc(size);
+      objs[i][0] = (char) i;
+    }
+    for (i = 0; i < BATCH; i++) {
+      sink += objs[i][0];
+      free(objs[i]);
+    }
   }
-  write_record_n(rec, x, stop_timer(t), N);
+  write_record_n(rec, size, stop_timer(t), (long) ROUNDS * BATCH);
 }
 
-int main (int argc, char *argv[]) {
-  timer *t = timer_alloc();
+void batch_arena (timer *t, recorder *rec, size_t size) {
+  arena *a = arena_alloc(size * BATCH);
+  char *objs[BATCH];
+  int r, i;
+  start_timer(t);
+  for (r = 0; r < ROUNDS; r++) {
+    for (i = 0; i < BATCH; i++) {
+      objs[i] = (char *) arena_push(a, size);
+      objs[i][0] = (char) i;
+    }
+    for (i = 0; i < BATCH; i++) {
+      sink += objs[i][0];
+    }
+    arena_reset(a);
+  }
+  write_record_n(rec, size, stop_timer(t), (long) ROUNDS * BATCH);
+  arena_free(a);
+}
 
-  // brk/sbrk
-  recorder *stack_rec = recorder_alloc("stack.csv");
-  recorder *heap_rec = recorder_alloc("heap.csv");
+void batch_pool (timer *t, recorder *rec, size_t size) {
+  pool *p = pool_alloc(size, BATCH);
+  char *objs[BATCH];
+  int r, i;
+  start_timer(t);
+  for (r = 0; r < ROUNDS; r++) {
+    for (i = 0; i < BATCH; i++) {
+      objs[i] = (char *) pool_get(p);
+      objs[i][0] = (char) i;
+    }
+    for (i = 0; i < BATCH; i++) {
+      sink += objs[i][0];
+      pool_put(p, objs[i]);
+    }
+  }
+  write_record_n(rec, size, stop_timer(t), (long) ROUNDS * BATCH);
+  pool_free(p);
+}
 
-  benchmark_fun(t, heap_1, heap_rec, SIZE_1);
-  benchmark_fun(t, heap_2, heap_rec, SIZE_2);
-  benchmark_fun(t, heap_3, heap_rec, SIZE_3);
+void batch_slab (timer *t, recorder *rec, size_t size) {
+  slab *s = slab_alloc(size);
+  char *objs[BATCH];
+  int r, i;
+  start_timer(t);
+  for (r = 0; r < ROUNDS; r++) {
+    for (i = 0; i < BATCH; i++) {
+      objs[i] = (char *) slab_get(s);
+      objs[i][0] = (char) i;
+    }
+    for (i = 0; i < BATCH; i++) {
+      sink += objs[i][0];
+      slab_put(s, objs[i]);
+    }
+  }
+  write_record_n(rec, size, stop_timer(t), (long) ROUNDS * BATCH);
+  slab_free(s);
+}
 
-  benchmark_fun(t, stack_1, stack_rec, SIZE_1);
-  benchmark_fun(t, stack_2, stack_rec, SIZE_2);
-  benchmark_fun(t, stack_3, stack_rec, SIZE_3);
+int main (int argc, char *argv[]) {
+  timer *t = timer_alloc();
 
-  printf("%p\n", sbrk(0));
+  scratch = arena_alloc(MAX_SIZE);
+  pthread_attr_t attr;
+  pthread_t thread;
+  pthread_attr_init(&attr);
+  if (pthread_attr_setstacksize(&attr, STACK_SIZE) != 0 ||
+      pthread_create(&thread, &attr, scratch_buffers, t) != 0) {
+    perror("pthread_create");
+    exit(EXIT_FAILURE);
+  }
+  pthread_join(thread, NULL);
+  pthread_attr_destroy(&attr);
+  arena_free(scratch);
 
-  recorder_free(stack_rec);
-  recorder_free(heap_rec);
+  recorder *malloc_rec = recorder_alloc("batch-malloc.csv");
+  recorder *arena_rec = recorder_alloc("batch-arena.csv");
+  recorder *pool_rec = recorder_alloc("batch-pool.csv");
+  recorder *slab_rec = recorder_alloc("batch-slab.csv");
+  size_t size;
+  for (size = MIN_OBJ; size <= MAX_OBJ; size *= 2) {
+    batch_malloc(t, malloc_rec, size);
+    batch_arena(t, arena_rec, size);
+    batch_pool(t, pool_rec, size);
+    batch_slab(t, slab_rec, size);
+  }
+  recorder_free(malloc_rec);
+  recorder_free(arena_rec);
+  recorder_free(pool_rec);
+  recorder_free(slab_rec);
 
   timer_free(t);
   return EXIT_SUCCESS;
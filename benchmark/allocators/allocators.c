@@ -0,0 +1,359 @@
+/**
+ * \file allocators.c
+ * \brief Comparaison d'allocateurs mémoire sur des charges réalistes
+ *
+ * `alloc` et `calloc` mesurent un appel isolé de `malloc`. Ici, on mesure
+ * trois charges qui ressemblent à celles d'un vrai programme :
+ * * `sizes` : un thread garde `LIVE` objets vivants et remplace sans cesse
+ *   un objet pris au hasard par un nouveau, dont la taille suit une
+ *   distribution réaliste (surtout de petits objets, quelques gros);
+ * * `xthread` : des paires producteur/consommateur, le producteur alloue
+ *   et le consommateur libère : chaque `free` se fait sur un autre thread
+ *   que le `malloc`;
+ * * `frag` : on alloue beaucoup de petits objets, on en libère 90% au
+ *   hasard puis on alloue de plus gros objets, qui ne rentrent pas dans
+ *   les trous laissés par les petits.
+ *
+ * Chaque charge tourne dans un processus fils, pour mesurer sa propre
+ * mémoire. Pour chaque allocateur, on ajoute une ligne à
+ * * `ops.csv` : le débit en allocations par ms;
+ * * `rss.csv` : le maximum de mémoire résidente en KiB;
+ * * `frag.csv` : la mémoire résidente gagnée pendant la charge, en
+ *   pourcentage des bytes demandés encore vivants à la fin (100 si
+ *   l'allocateur ne perd rien). Le programme, la libc et les tableaux de
+ *   la charge sont déjà en mémoire quand on lit la mémoire résidente de
+ *   départ, ils ne comptent pas.
+ *
+ * Sans argument, le programme écrit l'en-tête des fichiers, mesure
+ * l'allocateur avec lequel il tourne (la glibc, ou la librairie de
+ * `LD_PRELOAD`), puis lance `allocators-jemalloc`, `allocators-tcmalloc`
+ * et `allocators-mimalloc` s'ils ont été compilés (le `configure` les
+ * compile quand il trouve la librairie). Avec `--child`, il ajoute
+ * seulement sa ligne.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "benchmark.h"
+
+#define LIVE 8192 //!< Objets vivants pour `sizes`
+#define OPS 4000000L //!< Allocations pour `sizes`
+#define XOPS 1000000L //!< Allocations par producteur pour `xthread`
+#define RING 1024 //!< Objets en transit entre un producteur et son consommateur
+#define SMALL 1000000L //!< Petits objets pour `frag`
+#define MAX_PAIRS 64
+
+static const char *others[] = {"jemalloc", "tcmalloc", "mimalloc"};
+
+#define NOTHERS (sizeof(others) / sizeof(others[0]))
+
+/**
+ * \brief Générateur pseudo-aléatoire xorshift, un par thread
+ */
+static inline uint64_t next (uint64_t *s) {
+  *s ^= *s << 13;
+  *s ^= *s >> 7;
+  *s ^= *s << 17;
+  return *s;
+}
+
+/**
+ * \brief Distribution des tailles : `percent`% des objets font au plus
+ *        `size` bytes (et plus que la classe précédente)
+ */
+static const struct {
+  int percent;
+  size_t size;
+} classes[] = {
+  {30, 16}, {20, 32}, {15, 64}, {10, 128}, {8, 256}, {6, 512}, {5, 1024},
+  {4, 4096}, {1, 16384}, {1, 65536},
+};
+
+#define NCLASSES (sizeof(classes) / sizeof(classes[0]))
+
+size_t random_size (uint64_t *s) {
+  uint64_t r = next(s);
+  int p = r % 100;
+  size_t low = 1;
+  unsigned int c;
+  for (c = 0; c < NCLASSES - 1 && p >= classes[c].percent; c++) {
+    p -= classes[c].percent;
+    low = classes[c].size + 1;
+  }
+  return low + (r >> 32) % (classes[c].size - low + 1);
+}
+
+/**
+ * \brief Les résultats d'une charge, écrits par le fils dans une zone
+ *        partagée avec le père
+ */
+typedef struct result {
+  long ops; //!< allocations par ms
+  long rss; //!< maximum de mémoire résidente en KiB
+  long frag; //!< mémoire résidente gagnée / bytes vivants, en %
+} result;
+
+/**
+ * \brief Mémoire résidente actuelle du processus en bytes
+ */
+long current_rss (void) {
+  long pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f == NULL || fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+    perror("/proc/self/statm");
+    exit(EXIT_FAILURE);
+  }
+  fclose(f);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * \brief Remplit `res` à la fin d'une charge
+ *
+ * \param rss_start la mémoire résidente avant la première allocation de la
+ * charge, quand ses propres tableaux sont déjà en mémoire
+ */
+void finish (result *res, long ops, long time, long live, long rss_start) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  res->ops = time > 0 ? ops * 1000000 / time : 0;
+  res->rss = usage.ru_maxrss;
+  res->frag = live > 0 ? (current_rss() - rss_start) * 100 / live : 0;
+}
+
+void *alloc (size_t size) {
+  char *p = (char *) malloc(size);
+  if (p == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  // on écrit dans l'objet comme le ferait le programme
+  p[0] = 1;
+  p[size - 1] = 1;
+  return p;
+}
+
+void run_sizes (timer *t, result *res) {
+  char **slots = (char **) calloc(LIVE, sizeof(char *));
+  size_t *sizes = (size_t *) calloc(LIVE, sizeof(size_t));
+  // les pages de `calloc` ne sont en mémoire qu'à la première écriture
+  memset(slots, 0, LIVE * sizeof(char *));
+  memset(sizes, 0, LIVE * sizeof(size_t));
+  long rss_start = current_rss();
+  uint64_t s = 42;
+  long live = 0;
+  long i;
+  start_timer(t);
+  for (i = 0; i < OPS; i++) {
+    int slot = next(&s) % LIVE;
+    if (slots[slot] != NULL) {
+      free(slots[slot]);
+      live -= sizes[slot];
+    }
+    sizes[slot] = random_size(&s);
+    slots[slot] = alloc(sizes[slot]);
+    live += sizes[slot];
+  }
+  long time = stop_timer(t);
+  finish(res, OPS, time, live, rss_start);
+}
+
+/**
+ * \brief File circulaire entre un producteur et un consommateur
+ */
+typedef struct ring {
+  _Alignas(64) _Atomic long head; //!< écrit par le producteur
+  _Alignas(64) _Atomic long tail; //!< écrit par le consommateur
+  char *slots[RING];
+} ring;
+
+void *producer (void *param) {
+  ring *r = (ring *) param;
+  uint64_t s = (uintptr_t) r | 1;
+  long i;
+  for (i = 0; i < XOPS; i++) {
+    char *p = alloc(random_size(&s));
+    while (i - r->tail >= RING) {
+      // l'autre thread peut être sur le même CPU
+      sched_yield();
+    }
+    r->slots[i % RING] = p;
+    r->head = i + 1;
+  }
+  return NULL;
+}
+
+void *consumer (void *param) {
+  ring *r = (ring *) param;
+  long i;
+  for (i = 0; i < XOPS; i++) {
+    while (r->head <= i) {
+      // l'autre thread peut être sur le même CPU
+      sched_yield();
+    }
+    free(r->slots[i % RING]);
+    r->tail = i + 1;
+  }
+  return NULL;
+}
+
+void run_xthread (timer *t, result *res, int pairs) {
+  ring *rings = (ring *) aligned_alloc(64, sizeof(ring) * pairs);
+  pthread_t threads[2 * MAX_PAIRS];
+  int i;
+  memset(rings, 0, sizeof(ring) * pairs);
+  start_timer(t);
+  for (i = 0; i < pairs; i++) {
+    if (pthread_create(&threads[2 * i], NULL, producer, &rings[i]) != 0 ||
+        pthread_create(&threads[2 * i + 1], NULL, consumer, &rings[i]) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (i = 0; i < 2 * pairs; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  long time = stop_timer(t);
+  // plus aucun objet vivant : `frag` vaut 0, seul `rss` compte
+  finish(res, XOPS * pairs, time, 0, 0);
+}
+
+void run_frag (timer *t, result *res) {
+  char **small = (char **) malloc(sizeof(char *) * SMALL);
+  short *sizes = (short *) malloc(sizeof(short) * SMALL);
+  memset(small, 0, sizeof(char *) * SMALL);
+  memset(sizes, 0, sizeof(short) * SMALL);
+  long rss_start = current_rss();
+  uint64_t s = 7;
+  long live = 0, ops = 0;
+  long i;
+  start_timer(t);
+  for (i = 0; i < SMALL; i++) {
+    size_t size = 16 + next(&s) % 241;
+    sizes[i] = size;
+    small[i] = alloc(size);
+    live += size;
+    ops++;
+  }
+  long peak = live;
+  for (i = 0; i < SMALL; i++) {
+    if (next(&s) % 10 != 0) {
+      free(small[i]);
+      live -= sizes[i];
+    }
+  }
+  // les gros objets ne rentrent pas dans les trous
+  while (live < peak) {
+    size_t size = 1024 + next(&s) % 3073;
+    alloc(size);
+    live += size;
+    ops++;
+  }
+  long time = stop_timer(t);
+  finish(res, ops, time, live, rss_start);
+}
+
+/**
+ * \brief Lance la charge `w` dans un processus fils
+ */
+void measure (int w, result *res, int pairs) {
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    timer *t = timer_alloc();
+    switch (w) {
+    case 0:
+      run_sizes(t, res);
+      break;
+    case 1:
+      run_xthread(t, res, pairs);
+      break;
+    default:
+      run_frag(t, res);
+    }
+    timer_free(t);
+    exit(EXIT_SUCCESS);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    fprintf(stderr, "la charge %d a échoué\n", w);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * \brief Nom de l'allocateur : le suffixe du programme, la librairie de
+ *        `LD_PRELOAD` ou `glibc`
+ */
+const char *allocator_name (const char *prog) {
+  const char *preload = getenv("LD_PRELOAD");
+  if (preload != NULL && preload[0] != '\0') {
+    const char *slash = strrchr(preload, '/');
+    return slash != NULL ? slash + 1 : preload;
+  }
+  const char *dash = strrchr(prog, '-');
+  return dash != NULL && strstr(prog, "allocators-") != NULL ? dash + 1
+      : "glibc";
+}
+
+int main (int argc, char *argv[]) {
+  int child = is_sibling_child(argc, argv);
+  int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  int pairs = ncpu / 2 < 1 ? 1 : ncpu / 2 > MAX_PAIRS ? MAX_PAIRS : ncpu / 2;
+
+  const char *files[] = {"ops.csv", "rss.csv", "frag.csv"};
+  FILE *out[3];
+  int f;
+  for (f = 0; f < 3; f++) {
+    out[f] = open_csv(files[f], child);
+    if (!child) {
+      fprintf(out[f], "# allocateur, sizes, xthread (%d paires), frag\n",
+          pairs);
+    }
+  }
+
+  result *res = (result *) mmap(NULL, sizeof(result) * 3,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (res == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  int w;
+  for (w = 0; w < 3; w++) {
+    measure(w, &res[w], pairs);
+  }
+  const char *name = allocator_name(argv[0]);
+  fprintf(out[0], "%s, %ld, %ld, %ld\n", name, res[0].ops, res[1].ops,
+      res[2].ops);
+  fprintf(out[1], "%s, %ld, %ld, %ld\n", name, res[0].rss, res[1].rss,
+      res[2].rss);
+  fprintf(out[2], "%s, %ld, %ld, %ld\n", name, res[0].frag, res[1].frag,
+      res[2].frag);
+  printf("%s\n", name);
+  for (f = 0; f < 3; f++) {
+    fclose(out[f]);
+  }
+  munmap(res, sizeof(result) * 3);
+
+  if (child) {
+    return EXIT_SUCCESS;
+  }
+  // les autres allocateurs, compilés à côté de ce programme
+  run_siblings(argv[0], "allocators", others, NOTHERS);
+  return EXIT_SUCCESS;
+}
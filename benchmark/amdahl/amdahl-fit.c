@@ -0,0 +1,192 @@
+/*************************************************************
+ * amdahl-fit.c
+ *
+ * Analyse des temps mesurés par amdahl : ajuste la loi d'Amdahl et la
+ * loi de scalabilité universelle (USL), calcule la métrique de Karp-Flatt
+ * et l'accélération de Gustafson.
+ *************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <err.h>
+
+#define NTHREAD 32 //!< Nombre max de threads mesurés par amdahl
+#define PREDICT 4 //!< On prédit jusqu'à `PREDICT * NTHREAD` threads
+
+/**
+ * \brief Lit un `.csv` écrit par un `recorder`
+ *
+ * \param filename Le fichier à lire
+ * \param time `time[p]` reçoit le temps mesuré avec `p` threads
+ *
+ * \return Le plus grand nombre de threads lu
+ */
+int read_csv(char* filename, double* time) {
+	FILE* f = fopen(filename, "r");
+	if (f == NULL) err(1, "%s", filename);
+	int p, max = 0;
+	long t;
+	while (fscanf(f, "%d, %ld", &p, &t) == 2) {
+		if (p >= 1 && p <= NTHREAD) {
+			time[p] = (double) t;
+			if (p > max) max = p;
+		}
+	}
+	fclose(f);
+	if (max == 0 || time[1] <= 0) errx(1, "%s: pas de mesure avec 1 thread", filename);
+	return max;
+}
+
+/*
+ * Loi d'Amdahl : T(p)/T(1) = s + (1-s)/p
+ *
+ * En posant x = 1 - 1/p et y = T(p)/T(1) - 1/p, on a y = s x et la
+ * fraction séquentielle `s` est obtenue par moindres carrés.
+ */
+
+double fit_amdahl(double* speedup, int n) {
+	double sxy = 0, sxx = 0;
+	int p;
+	for (p = 2; p <= n; p++) {
+		double x = 1 - 1.0/p;
+		double y = 1/speedup[p] - 1.0/p;
+		sxy += x*y;
+		sxx += x*x;
+	}
+	return sxx > 0 ? sxy/sxx : 0;
+}
+
+double amdahl(double s, int p) {
+	return 1/(s + (1-s)/p);
+}
+
+/*
+ * Loi de scalabilité universelle (Gunther) :
+ * C(p) = p / (1 + sigma (p-1) + kappa p (p-1))
+ *
+ * `sigma` est la contention (la partie séquentielle) et `kappa` le coût de
+ * la cohérence entre threads. En posant z = p/C(p) - 1, a = p-1 et
+ * b = p(p-1), on a z = sigma a + kappa b, un problème linéaire à deux
+ * inconnues résolu par les équations normales.
+ */
+
+void fit_usl(double* speedup, int n, double* sigma, double* kappa) {
+	double saa = 0, sab = 0, sbb = 0, saz = 0, sbz = 0;
+	int p;
+	for (p = 2; p <= n; p++) {
+		double a = p-1, b = (double) p*(p-1), z = p/speedup[p] - 1;
+		saa += a*a;
+		sab += a*b;
+		sbb += b*b;
+		saz += a*z;
+		sbz += b*z;
+	}
+	double det = saa*sbb - sab*sab;
+	*sigma = 0;
+	*kappa = 0;
+	if (det != 0) {
+		*sigma = (saz*sbb - sbz*sab)/det;
+		*kappa = (saa*sbz - sab*saz)/det;
+	}
+	// les deux coefficients sont positifs par définition
+	if (*kappa < 0) {
+		*kappa = 0;
+		*sigma = saa > 0 ? saz/saa : 0;
+	}
+	if (*sigma < 0) {
+		*sigma = 0;
+		*kappa = sbb > 0 ? sbz/sbb : 0;
+	}
+}
+
+double usl(double sigma, double kappa, int p) {
+	return p/(1 + sigma*(p-1) + kappa*p*(p-1));
+}
+
+/*
+ *  __  __       _
+ * |  \/  |     (_)
+ * | \  / | __ _ _ _ __
+ * | |\/| |/ _` | | '_ \
+ * | |  | | (_| | | | | |
+ * |_|  |_|\__,_|_|_| |_|
+ */
+
+/**
+ * \brief Lit `thread.csv` et `weak.csv` et écrit les résultats de l'analyse
+ *
+ * * `karpflatt.csv` : la fraction séquentielle expérimentale de Karp-Flatt
+ *   e(p) = (1/S(p) - 1/p) / (1 - 1/p) pour chaque nombre de threads;
+ * * `model.csv` : l'accélération mesurée, celle prédite par Amdahl et celle
+ *   prédite par l'USL jusqu'à `PREDICT * NTHREAD` threads;
+ * * `gustafson.csv` : l'accélération à l'échelle p T_w(1) / T_w(p) de la
+ *   mise à l'échelle faible et la loi de Gustafson p - s (p-1) ajustée;
+ * * `fit.txt` : les coefficients ajustés et quelques prédictions.
+ */
+int main (int argc, char* argv[]) {
+	double time[NTHREAD+1], weak[NTHREAD+1], speedup[NTHREAD+1], scaled[NTHREAD+1];
+	int n = read_csv("thread.csv", time);
+	int nw = read_csv("weak.csv", weak);
+	int p;
+
+	for (p = 1; p <= n; p++) {
+		speedup[p] = time[1]/time[p];
+	}
+	for (p = 1; p <= nw; p++) {
+		scaled[p] = p*weak[1]/weak[p];
+	}
+
+	double s = fit_amdahl(speedup, n);
+	double sigma, kappa;
+	fit_usl(speedup, n, &sigma, &kappa);
+
+	// Gustafson : S = p - alpha (p-1), alpha par moindres carrés
+	double sxy = 0, sxx = 0;
+	for (p = 2; p <= nw; p++) {
+		sxy += (p-1)*(p-scaled[p]);
+		sxx += (double) (p-1)*(p-1);
+	}
+	double alpha = sxx > 0 ? sxy/sxx : 0;
+
+	FILE* kf = fopen("karpflatt.csv", "w");
+	if (kf == NULL) err(1, "karpflatt.csv");
+	for (p = 2; p <= n; p++) {
+		fprintf(kf, "%d, %f\n", p, (1/speedup[p] - 1.0/p)/(1 - 1.0/p));
+	}
+	fclose(kf);
+
+	FILE* model = fopen("model.csv", "w");
+	if (model == NULL) err(1, "model.csv");
+	for (p = 1; p <= PREDICT*NTHREAD; p++) {
+		if (p <= n)
+			fprintf(model, "%d, %f, %f, %f\n", p, amdahl(s, p), usl(sigma, kappa, p), speedup[p]);
+		else
+			fprintf(model, "%d, %f, %f\n", p, amdahl(s, p), usl(sigma, kappa, p));
+	}
+	fclose(model);
+
+	FILE* gus = fopen("gustafson.csv", "w");
+	if (gus == NULL) err(1, "gustafson.csv");
+	for (p = 1; p <= nw; p++) {
+		fprintf(gus, "%d, %f, %f\n", p, scaled[p], p - alpha*(p-1));
+	}
+	fclose(gus);
+
+	FILE* fit = fopen("fit.txt", "w");
+	if (fit == NULL) err(1, "fit.txt");
+	fprintf(fit, "Amdahl : fraction séquentielle s = %f (accélération max %.1f)\n",
+		s, s > 0 ? 1/s : INFINITY);
+	fprintf(fit, "USL : contention sigma = %f, cohérence kappa = %f", sigma, kappa);
+	if (kappa > 0 && sigma < 1)
+		fprintf(fit, " (accélération max avec %.0f threads)", sqrt((1-sigma)/kappa));
+	fprintf(fit, "\n");
+	fprintf(fit, "Gustafson : fraction séquentielle alpha = %f\n", alpha);
+	for (p = 2*NTHREAD; p <= PREDICT*NTHREAD; p *= 2) {
+		fprintf(fit, "%d threads : Amdahl %.2f, USL %.2f, Gustafson %.2f\n",
+			p, amdahl(s, p), usl(sigma, kappa, p), p - alpha*(p-1));
+	}
+	fclose(fit);
+
+	return 0;
+}
@@ -6,15 +6,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <err.h>
 #include <unistd.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <sys/wait.h>
 
 #include "benchmark.h"
+#include "deque.h"
+#include "prime.h"
+#include "arena.h"
 
 #define NTHREAD 32 //!< Nombre max de threads/processus à utiliser
 #define NLENGTH 64000 //!< Taille du tableau à tester
+#define CHUNK 64 //!< Taille des morceaux pour le vol de tâches
+#define MIN_GUIDED 16 //!< Taille minimale d'un morceau en self-scheduling guidé
 
 /*
  *   _____ _                   _
@@ -37,6 +45,7 @@ typedef struct scanargs {
 	int start;
 	int stop;
 	int* array;
+	struct result* res; //!< Où écrire le résultat du thread
 } scanargs;
 
 /**
@@ -65,28 +74,23 @@ typedef struct result {
 /**
  * \brief Calcul les facteurs premiers de `n`
  *
- * \param n Le nombre duquel on veut trouver les facteurs premiers
- *
- * \return Le nombre de facteurs premiers trouvé
+ * Pointe vers un des noyaux de `lib/prime.c`, choisi avec l'option `-k`.
+ * Par défaut c'est la méthode de brute force, dont le coût varie beaucoup
+ * d'un nombre à l'autre.
+ */
+
+prime_kernel primeFactors = prime_factors_naive;
+
+/**
+ * \brief Mémoire de travail
  *
- * Calcul les facteurs premiers de `n` par la methode de brute force
+ * `scratch` contient les tableaux d'un appel de `run_static` ou de
+ * `run_dynamic`, remis à zéro à la fin de l'appel, par le thread principal
+ * uniquement, y compris le tableau des `result` : chaque thread reçoit sa
+ * case et n'alloue rien pendant la mesure.
  */
 
-int primeFactors(int n) {
-	int i,count=0;
-	for(i=2;i<=n;i++)
-	{
-		if(n%i==0)
-		{
-			count++;
-			n=n/i;
-			i--;
-			if(n==1)
-				break;
-		} 
-	} 
-	return count;
-}
+arena* scratch;
 
 /*
  *   _____
@@ -113,20 +117,247 @@ int primeFactors(int n) {
 
 void* scan(void* param) {
 	scanargs* args = (scanargs*)param;
-	result *res = (result*)malloc(sizeof(result));
-	res->count = 0;
-	res->index = 0;
+	// dans un registre : la case de `args->res` partage sa ligne de cache
+	// avec celles des autres threads
+	result res = {0, 0};
 	
 	int i,p;
 	for (i = args->start; i<=args->stop; i++) {
 		p = primeFactors(args->array[i]);
 		//printf("number: %d ; primes: %d ; index: %d\n", args->array[i],p,i);
+		if (p>res.count) {
+			res.count = p;
+			res.index = i;
+		}
+	}
+	*args->res = res;
+	pthread_exit((void*)args->res);
+}
+
+/*
+ * Ordonnancement dynamique
+ *
+ * Le coût de `primeFactors` varie énormément d'une valeur à l'autre, donc
+ * avec un découpage statique le thread le plus lent fixe le temps total.
+ * Les deux modes suivants répartissent le travail pendant le calcul.
+ */
+
+/**
+ * \brief Un morceau `[start, stop]` du tableau
+ */
+typedef struct chunk {
+	int start;
+	int stop;
+} chunk;
+
+/**
+ * \brief Arguments partagés par les threads en mode dynamique
+ *
+ * `deques` et `chunks` servent au vol de tâches, `next` au self-scheduling
+ * guidé.
+ */
+typedef struct dynargs {
+	int nthreads;
+	int* array;
+	deque** deques;
+	chunk* chunks;
+	atomic_int remaining; //!< Nombre de morceaux pas encore traités
+	atomic_int next; //!< Premier index pas encore distribué
+} dynargs;
+
+/**
+ * \brief Arguments propres à un thread en mode dynamique
+ */
+typedef struct dynthread {
+	dynargs* shared;
+	int id;
+	result* res; //!< Où écrire le résultat du thread
+} dynthread;
+
+/**
+ * \brief Met à jour `res` avec les éléments `[start, stop]` de `array`
+ */
+void scan_chunk(int* array, int start, int stop, result* res) {
+	int i,p;
+	for (i = start; i<=stop; i++) {
+		p = primeFactors(array[i]);
 		if (p>res->count) {
 			res->count = p;
 			res->index = i;
 		}
 	}
-	pthread_exit((void*)res);
+}
+
+/**
+ * \brief Thread avec vol de tâches
+ *
+ * Le thread met d'abord les morceaux de sa part statique du tableau dans
+ * son `deque` (de Chase-Lev, voir `lib/deque.c`), puis les traite. Quand
+ * son `deque` est vide, il vole des morceaux dans celui d'un autre thread
+ * choisi au hasard jusqu'à ce qu'il n'en reste plus nulle part.
+ */
+void* steal(void* param) {
+	dynthread* self = (dynthread*)param;
+	dynargs* args = self->shared;
+	result res = {0, 0};
+
+	int nchunks = (NLENGTH + CHUNK - 1) / CHUNK;
+	int first = self->id*nchunks/args->nthreads;
+	int last = (self->id+1)*nchunks/args->nthreads;
+	int j;
+	// on empile à l'envers pour que le propriétaire commence par le début
+	for (j = last-1; j>=first; j--) {
+		if (deque_push(args->deques[self->id], &args->chunks[j]) == -1) err(1,"deque plein");
+	}
+
+	unsigned int seed = self->id;
+	while (atomic_load(&args->remaining) > 0) {
+		chunk* c = (chunk*)deque_pop(args->deques[self->id]);
+		if (c == NULL && args->nthreads > 1) {
+			int victim = rand_r(&seed) % args->nthreads;
+			if (victim != self->id) c = (chunk*)deque_steal(args->deques[victim]);
+		}
+		if (c == NULL) {
+			sched_yield();
+			continue;
+		}
+		scan_chunk(args->array, c->start, c->stop, &res);
+		atomic_fetch_sub(&args->remaining, 1);
+	}
+	*self->res = res;
+	pthread_exit((void*)self->res);
+}
+
+/**
+ * \brief Thread en self-scheduling guidé
+ *
+ * Chaque thread prend le prochain morceau du tableau à l'aide d'un
+ * compteur partagé. La taille du morceau est le nombre d'éléments restants
+ * divisé par le nombre de threads : gros au début pour limiter la
+ * contention, petits à la fin pour équilibrer (au moins `MIN_GUIDED`).
+ */
+void* guided(void* param) {
+	dynthread* self = (dynthread*)param;
+	dynargs* args = self->shared;
+	result res = {0, 0};
+
+	int start = atomic_load(&args->next);
+	while (start < NLENGTH) {
+		int size = (NLENGTH - start) / args->nthreads;
+		if (size < MIN_GUIDED) size = MIN_GUIDED;
+		int stop = start + size;
+		if (stop > NLENGTH) stop = NLENGTH;
+		// si un autre thread a pris ce morceau, `start` est mis à jour
+		if (atomic_compare_exchange_weak(&args->next, &start, stop)) {
+			scan_chunk(args->array, start, stop-1, &res);
+			start = atomic_load(&args->next);
+		}
+	}
+	*self->res = res;
+	pthread_exit((void*)self->res);
+}
+
+/**
+ * \brief Lance `nthreads` threads exécutant `fun` et retourne l'index du
+ * nombre avec le plus de facteurs premiers
+ */
+int run_dynamic(int nthreads, int* array, void* (*fun)(void*)) {
+	pthread_t threads[nthreads];
+	dynthread self[nthreads];
+	deque* deques[nthreads];
+	dynargs args;
+	int j, error;
+
+	int nchunks = (NLENGTH + CHUNK - 1) / CHUNK;
+	chunk* chunks = (chunk*)arena_push(scratch, sizeof(chunk)*nchunks);
+	result* results = (result*)arena_push(scratch, sizeof(result)*nthreads);
+	for (j=0; j<nchunks; j++) {
+		chunks[j].start = j*CHUNK;
+		chunks[j].stop = (j+1)*CHUNK-1;
+	}
+	chunks[nchunks-1].stop = NLENGTH-1;
+	for (j=0; j<nthreads; j++) {
+		deques[j] = deque_alloc(nchunks);
+	}
+	args.nthreads = nthreads;
+	args.array = array;
+	args.deques = deques;
+	args.chunks = chunks;
+	atomic_init(&args.remaining, nchunks);
+	atomic_init(&args.next, 0);
+
+	for (j=0; j<nthreads; j++) {
+		self[j].shared = &args;
+		self[j].id = j;
+		self[j].res = &results[j];
+		error = pthread_create(&threads[j],NULL,fun,(void*)&self[j]);
+		if(error!=0) err(error,"erreur create");
+	}
+
+	int index = -1, max = 0;
+	for (j=0; j<nthreads; j++) {
+		result* res;
+		error=pthread_join(threads[j],(void**)&res);
+		if(error!=0) err(error,"erreur join");
+		if (max<res->count) {
+			max = res->count;
+			index = res->index;
+		}
+		deque_free(deques[j]);
+	}
+	arena_reset(scratch);
+	return index;
+}
+
+/**
+ * \brief Découpe les `length` premiers éléments de `array` en `nthreads`
+ * segments égaux scannés chacun par un thread et retourne l'index du nombre
+ * avec le plus de facteurs premiers
+ */
+int run_static(int nthreads, int* array, int length) {
+	int error = 0;
+	
+	pthread_t* threads = (pthread_t*)arena_push(scratch, sizeof(pthread_t)*nthreads);
+	scanargs** args = (scanargs**)arena_push(scratch, sizeof(scanargs*)*nthreads);
+	result* results = (result*)arena_push(scratch, sizeof(result)*nthreads);
+	result* res[nthreads];
+	// init des tableaux d'arguments, de threads, et de resultats
+	
+	int j;
+	for (j=0; j<nthreads; j++) {
+		args[j] = (scanargs*)arena_push(scratch, sizeof(scanargs));
+		args[j]->start = j*(length/nthreads);
+		args[j]->stop = (j+1)*(length/nthreads)-1;
+		// le dernier thread prend aussi le reste de la division
+		if (j == nthreads-1) args[j]->stop = length-1;
+		args[j]->array = array;
+		args[j]->res = &results[j];
+		// remplissage de la structure argument avec le segment à scanner par le thread
+		error = pthread_create(&threads[j],NULL,&scan,(void*)args[j]);
+		if(error!=0) err(error,"erreur create");
+		// lancement du thread
+	}
+	
+	for (j=0; j<nthreads; j++) {
+		error=pthread_join(threads[j],(void**)&res[j]);
+		if(error!=0) err(error,"erreur create");
+		// join du thread et réception de la structure resultat
+	}
+	
+	/*
+	 * Analyse des resultats de tous les threads
+	 */
+	int index = -1;
+	int max = 0;
+	for (j=0; j<nthreads; j++) {
+		if (max<res[j]->count) {
+			max = res[j]->count;
+			index = res[j]->index;
+		}
+	}
+	
+	arena_reset(scratch);
+	return index;
 }
 
 /*
@@ -154,11 +385,22 @@ void* scan(void* param) {
 
 int main (int argc, char* argv[]) {
 	
+	// `-k <noyau>` choisit la décomposition utilisée par tous les tests
+	if (argc > 2 && strcmp(argv[1], "-k") == 0) {
+		primeFactors = prime_kernel_find(argv[2]);
+		if (primeFactors == NULL) errx(1, "noyau inconnu: %s", argv[2]);
+	}
+
 	timer *t = timer_alloc();
 	recorder *thread_rec = recorder_alloc("thread.csv");
 	recorder *proc_rec = recorder_alloc("proc.csv");
+	recorder *steal_rec = recorder_alloc("steal.csv");
+	recorder *guided_rec = recorder_alloc("guided.csv");
+	recorder *weak_rec = recorder_alloc("weak.csv");
 	// on init tous les `recorders` et le timer
 	
+	scratch = arena_alloc(4096);
+
 	srand (1337);
 	int* array = (int*)malloc(sizeof(int)*NLENGTH);
 	if (array == NULL) err(1,"erreur malloc");
@@ -167,6 +409,11 @@ int main (int argc, char* argv[]) {
 		array[i] = rand() % NLENGTH;
 	}
 	// on génère le tableau de int aléatoires
+
+	// la table du crible couvre toutes les valeurs des tableaux
+	start_timer(t);
+	prime_sieve_init(NLENGTH);
+	long sieve_time = stop_timer(t);
 	
 	
 	/*
@@ -181,56 +428,47 @@ int main (int argc, char* argv[]) {
 	for (i = 1; i<=NTHREAD; i=i+1) {
 		start_timer(t);
 		// on lance le chronomètre
-		int error = 0;
-		
-		pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t)*i);
-		if (threads == NULL) err(1,"erreur malloc");
-		scanargs** args = (scanargs**)malloc(sizeof(scanargs*)*i);
-		if (args == NULL) err(1,"erreur malloc");
-		result* res[i];
-		// init des tableaux d'arguments, de threads, et de resultats
-		
-		int j;
-		for (j=0; j<i; j++) {
-			args[j] = (scanargs*)malloc(sizeof(scanargs));
-			if (args[j] == NULL) err(1,"erreur malloc");
-			args[j]->start = j*(NLENGTH/i);
-			args[j]->stop = (j+1)*(NLENGTH/i)-1;
-			args[j]->array = array;
-			// remplissage de la structure argument avec le segment à scanner par le thread
-			error = pthread_create(&threads[j],NULL,&scan,(void*)args[j]);
-			if(error!=0) err(error,"erreur create");
-			// lancement du thread
-		}
-		
-		for (j=0; j<i; j++) {
-			error=pthread_join(threads[j],(void**)&res[j]);
-			if(error!=0) err(error,"erreur create");
-			// join du thread et réception de la structure resultat
-		}
-		
-		/*
-		 * Analyse des resultats de tous les threads
-		 */
-		int index = -1;
-		int max = 0;
-		for (j=0; j<i; j++) {
-			if (max<res[j]->count) {
-				max = res[j]->count;
-				index = res[j]->index;
-				free(res[j]);
-				free(args[j]);
-			}
-		}
-		
-		printf("%d\n",index);
+		printf("%d\n",run_static(i,array,NLENGTH));
 		write_record_n(thread_rec,i,stop_timer(t),NTHREAD);
 		//sauvegarde du temps
-		
-		free(threads);
-		free(args);
 	}
 	
+	/*
+	 * Même chose avec un ordonnancement dynamique
+	 */
+
+	puts("steal");
+	for (i = 1; i<=NTHREAD; i=i+1) {
+		start_timer(t);
+		printf("%d\n",run_dynamic(i,array,&steal));
+		write_record_n(steal_rec,i,stop_timer(t),NTHREAD);
+	}
+
+	puts("guided");
+	for (i = 1; i<=NTHREAD; i=i+1) {
+		start_timer(t);
+		printf("%d\n",run_dynamic(i,array,&guided));
+		write_record_n(guided_rec,i,stop_timer(t),NTHREAD);
+	}
+
+	/*
+	 * Mise à l'échelle faible (Gustafson) : chaque thread garde `NLENGTH`
+	 * éléments, le tableau grandit donc avec le nombre de threads.
+	 */
+
+	puts("weak");
+	int* big = (int*)malloc(sizeof(int)*NLENGTH*NTHREAD);
+	if (big == NULL) err(1,"erreur malloc");
+	for (i=0; i<NLENGTH*NTHREAD; i++) {
+		big[i] = rand() % NLENGTH;
+	}
+	for (i = 1; i<=NTHREAD; i=i+1) {
+		start_timer(t);
+		printf("%d\n",run_static(i,big,NLENGTH*i));
+		write_record_n(weak_rec,i,stop_timer(t),NTHREAD);
+	}
+	free(big);
+
 	puts("proc");
 	
 	/*
@@ -256,6 +494,7 @@ int main (int argc, char* argv[]) {
 		for (j=0; j<i; j++) {
 			int start = j*(NLENGTH/i);
 			int stop = (j+1)*(NLENGTH/i)-1;
+			if (j == i-1) stop = NLENGTH-1;
 			// on définit le segment à scanner
 			pipe(fd[j]);
 			// on init le pipe entre le père et fils. Il sert à ce que le fils renvoie sa réponse au père
@@ -285,7 +524,8 @@ int main (int argc, char* argv[]) {
 				// envoie de la réponse par pipe
 				close(fd[j][1]);
 				
-				exit(0);
+				// `_exit` pour ne pas vider une seconde fois les buffers des `recorders` hérités du père
+				_exit(0);
 			} else if (pid[j] < 0) {
 				err(-1,"erreur de fork");
 			}
@@ -318,9 +558,46 @@ int main (int argc, char* argv[]) {
 		// ecriture du temps
 	}
 	
+	/*
+	 * Comparaison des noyaux : le gain algorithmique (par rapport à la
+	 * brute force avec 1 thread) à côté du gain de la parallélisation
+	 * (1 thread contre un thread par coeur) pour chaque noyau.
+	 */
+
+	puts("kernels");
+	int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 1) ncpu = 1;
+	if (ncpu > NTHREAD) ncpu = NTHREAD;
+	FILE* kernels = fopen("kernels.csv", "w");
+	if (kernels == NULL) err(1, "kernels.csv");
+	fprintf(kernels, "# kernel, setup, time 1 thread, time %d threads, "
+		"algorithmic speedup, parallel speedup\n", ncpu);
+	long naive_time = 0;
+	int k;
+	for (k = 0; k < PRIME_NKERNELS; k++) {
+		primeFactors = prime_kernels[k].fun;
+		start_timer(t);
+		run_static(1,array,NLENGTH);
+		long seq = stop_timer(t);
+		start_timer(t);
+		run_static(ncpu,array,NLENGTH);
+		long par = stop_timer(t);
+		long setup = primeFactors == prime_factors_sieve ? sieve_time : 0;
+		if (k == 0) naive_time = seq;
+		fprintf(kernels, "%s, %ld, %ld, %ld, %f, %f\n", prime_kernels[k].name,
+			setup, seq, par, (double) naive_time/(seq+setup),
+			(double) seq/(par > 0 ? par : 1));
+	}
+	fclose(kernels);
+
 	recorder_free(thread_rec);
 	recorder_free(proc_rec);
+	recorder_free(steal_rec);
+	recorder_free(guided_rec);
+	recorder_free(weak_rec);
 	timer_free(t);
 	free(array);
+	prime_sieve_free();
+	arena_free(scratch);
 	// free de nos structures
 }
\ No newline at end of file
@@ -1,183 +1,256 @@
 /**
 	\file argfct.c
-	\brief Ce programme compare le temps nécessaire pour passer un argument de N byte à une fonction et celui nécessaire pour passer le pointeur vers cet argument
+	\brief Ce programme compare le passage d'un argument par valeur et par pointeur, et le retour d'une structure par valeur et par un paramètre de sortie
 
-	Compare donc les performances en passant des arguments de plus en plus gros sur le stack contre un pointeur de taille fixe
-	
-	Note : Pour ne pas polluer les tests, il a été décidé de ne pas utiliser de pointeurs de fonction.
+	Pour des structures de 1 byte à `MAX_SIZE` bytes, générées par la macro `ARG`, on mesure
+		* `val` : la structure passée par valeur;
+		* `pt` : un pointeur vers la structure;
+		* `ret` : une structure remplie par la fonction et retournée par valeur;
+		* `ret-copy` : pareil, mais la fonction remplit une variable locale avec `memset` avant de la retourner;
+		* `out` : la même structure remplie à travers un pointeur (paramètre de sortie).
+
+	En x86-64 (ABI System V), une structure de 16 bytes au plus passe dans des registres, au-delà elle est copiée sur la pile à chaque appel. Pour le retour d'une structure de plus de 16 bytes, l'appelant passe l'adresse de la destination (pointeur caché), comme pour `out`. `ret` retourne une expression (un littéral composé) que GCC construit directement dans cette destination (return value optimization) : il coûte autant que `out`. `ret-copy` prend l'adresse de sa variable locale `r` (`memset`), GCC ne peut plus la confondre avec la destination (pas de named return value optimization) : il remplit `r` sur sa pile puis la copie, deux écritures de la structure au lieu d'une. `ret` et `out` remplissent la structure avec la même expression, `FILL`.
+
+	La seconde partie passe des structures de 8 à 32 bytes dont les champs mélangent entiers, `float`, `double` et `long double`. Chaque mot de 8 bytes est classé `INTEGER` (registre général), `SSE` (registre `xmm`) ou la structure entière `MEMORY` (sur la pile) ou `X87`. Les résultats sont dans `argfct-layouts.csv`, une ligne par structure.
+
+	Les fonctions mesurées lisent vraiment l'argument et sont déclarées `NOIPA` : sans ça, le compilateur les supprime, les intègre à l'appelant ou (`-O2`, IPA-SRA) ne passe plus que les champs utilisés.
+
+	Les temps sont en ns pour 1000 appels.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
-#include <fcntl.h>
 #include <string.h>
 
 #include "benchmark.h"
 
-#define MAX_SIZE 3
-#define TURN 100000000
-
-//#define BM_USE_TIMES
-
-/** Structure dont la taille fait 1byte */
-struct arg1   { char s[1];   };
-/** Structure dont la taille fait 2byte */
-struct arg2   { char s[2];   };
-/** Structure dont la taille fait 4byte */
-struct arg4   { char s[4];   };
-/** Structure dont la taille fait 8byte */
-struct arg8   { char s[8];   };
-/** Structure dont la taille fait 16byte */
-struct arg16  { char s[16];  };
-/** Structure dont la taille fait 32byte */
-struct arg32  { char s[32];  };
-/** Structure dont la taille fait 64byte */
-struct arg64  { char s[64];  };
-/** Structure dont la taille fait 128byte */
-struct arg128 { char s[128]; };
-
-void fctpt(void* arg) {}
-
-void fctval1  (struct arg1 arg)   {}
-void fctval2  (struct arg2 arg)   {}
-void fctval4  (struct arg4 arg)   {}
-void fctval8  (struct arg8 arg)   {}
-void fctval16 (struct arg16 arg)  {}
-void fctval32 (struct arg32 arg)  {}
-void fctval64 (struct arg64 arg)  {}
-void fctval128(struct arg128 arg) {}
+#define MAX_SIZE 4096
+#define WORK (1L << 30)	// bytes copiés au maximum par mesure
+#define LAYOUT_CALLS 10000000
+
+#if defined(__clang__)
+#define NOIPA __attribute__((noinline))
+#else
+#define NOIPA __attribute__((noipa))
+#endif
+
+/**
+	\brief Le résultat des appels, pour que le compilateur les garde
+*/
+volatile long sink;
+
+/**
+	\brief Nombre d'appels pour une structure de `size` bytes
+*/
+static long calls(long size) {
+	return WORK / (size + 64);
+}
+
+/*
+	Pour chaque taille `n`, une structure `arg<n>`, les quatre fonctions mesurées et les boucles qui les appellent. Les fonctions ne lisent que le premier et le dernier byte : le coût qui reste est celui du passage. L'argument ne change pas d'un appel à l'autre : modifier un byte juste avant de passer la structure dans un registre ferait mesurer l'échec du store forwarding (une écriture étroite suivie d'une lecture plus large) plutôt que le passage.
+*/
+#define FILL(n, x) ((arg##n) {.s = {[0 ... n - 1] = (x)}})
+
+#define ARG(n) \
+	typedef struct arg##n { unsigned char s[n]; } arg##n; \
+	NOIPA long val##n(arg##n a) { return a.s[0] + a.s[n - 1]; } \
+	NOIPA long pt##n(const arg##n *a) { return a->s[0] + a->s[n - 1]; } \
+	NOIPA arg##n ret##n(int x) { return FILL(n, x); } \
+	NOIPA arg##n ret_copy##n(int x) { arg##n r; memset(r.s, x, n); return r; } \
+	NOIPA void out##n(arg##n *r, int x) { *r = FILL(n, x); } \
+	long loop_val##n(long calls) { \
+		arg##n a; long j, sum = 0; \
+		memset(a.s, 1, n); \
+		for (j = 0; j < calls; j++) sum += val##n(a); \
+		return sum; \
+	} \
+	long loop_pt##n(long calls) { \
+		arg##n a; long j, sum = 0; \
+		memset(a.s, 1, n); \
+		for (j = 0; j < calls; j++) sum += pt##n(&a); \
+		return sum; \
+	} \
+	long loop_ret##n(long calls) { \
+		arg##n a; long j, sum = 0; \
+		for (j = 0; j < calls; j++) { a = ret##n((int) j); sum += a.s[n - 1]; } \
+		return sum; \
+	} \
+	long loop_ret_copy##n(long calls) { \
+		arg##n a; long j, sum = 0; \
+		for (j = 0; j < calls; j++) { a = ret_copy##n((int) j); sum += a.s[n - 1]; } \
+		return sum; \
+	} \
+	long loop_out##n(long calls) { \
+		arg##n a; long j, sum = 0; \
+		for (j = 0; j < calls; j++) { out##n(&a, (int) j); sum += a.s[n - 1]; } \
+		return sum; \
+	}
+
+#define SIZES(X) X(1) X(2) X(4) X(8) X(16) X(32) X(64) X(128) X(256) X(512) X(1024) X(2048) X(4096)
+
+SIZES(ARG)
 
+/**
+	\brief Les boucles d'une taille
+*/
+typedef struct size {
+	long size;
+	long (*val)(long calls);
+	long (*pt)(long calls);
+	long (*ret)(long calls);
+	long (*ret_copy)(long calls);
+	long (*out)(long calls);
+} size;
+
+#define SIZE_ENTRY(n) {n, loop_val##n, loop_pt##n, loop_ret##n, loop_ret_copy##n, loop_out##n},
+
+static const size sizes[] = {
+	SIZES(SIZE_ENTRY)
+};
+
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+/*
+	Structures dont les champs tombent dans différentes classes de l'ABI System V. `<nom>_READ` lit tous les champs, `<nom>_FILL` les remplit.
+*/
+typedef struct ii { int a, b; } ii;	// 8 bytes, INTEGER
+#define ii_READ(x) ((x).a + (x).b)
+#define ii_FILL(x, v) ((x).a = (v), (x).b = (v))
+typedef struct ff { float a, b; } ff;	// 8 bytes, SSE
+#define ff_READ(x) ((x).a + (x).b)
+#define ff_FILL(x, v) ((x).a = (v), (x).b = (v))
+typedef struct fi { float a; int b; } fi;	// 8 bytes mélangés : INTEGER
+#define fi_READ(x) ((x).a + (x).b)
+#define fi_FILL(x, v) ((x).a = (v), (x).b = (v))
+typedef struct ll { long a, b; } ll;	// 16 bytes, INTEGER INTEGER
+#define ll_READ(x) ((x).a + (x).b)
+#define ll_FILL(x, v) ((x).a = (v), (x).b = (v))
+typedef struct dd { double a, b; } dd;	// 16 bytes, SSE SSE
+#define dd_READ(x) ((x).a + (x).b)
+#define dd_FILL(x, v) ((x).a = (v), (x).b = (v))
+typedef struct ld { long a; double b; } ld;	// 16 bytes, INTEGER SSE
+#define ld_READ(x) ((x).a + (x).b)
+#define ld_FILL(x, v) ((x).a = (v), (x).b = (v))
+typedef struct fff { float a, b, c; } fff;	// 12 bytes, SSE SSE
+#define fff_READ(x) ((x).a + (x).b + (x).c)
+#define fff_FILL(x, v) ((x).a = (v), (x).b = (v), (x).c = (v))
+typedef struct lll { long a, b, c; } lll;	// 24 bytes, MEMORY
+#define lll_READ(x) ((x).a + (x).b + (x).c)
+#define lll_FILL(x, v) ((x).a = (v), (x).b = (v), (x).c = (v))
+typedef struct ddd { double a, b, c; } ddd;	// 24 bytes, MEMORY
+#define ddd_READ(x) ((x).a + (x).b + (x).c)
+#define ddd_FILL(x, v) ((x).a = (v), (x).b = (v), (x).c = (v))
+typedef struct dddd { double a, b, c, d; } dddd;	// 32 bytes, MEMORY
+#define dddd_READ(x) ((x).a + (x).b + (x).c + (x).d)
+#define dddd_FILL(x, v) ((x).a = (v), (x).b = (v), (x).c = (v), (x).d = (v))
+typedef struct x87 { long double a; } x87;	// 16 bytes, X87 (pile en argument, st0 en retour)
+#define x87_READ(x) ((x).a)
+#define x87_FILL(x, v) ((x).a = (v))
+
+#define LAYOUT(t, classes) \
+	NOIPA double val_##t(t a) { return t##_READ(a); } \
+	NOIPA double pt_##t(const t *a) { return t##_READ(*a); } \
+	NOIPA t ret_##t(int x) { t r; t##_FILL(r, x); return r; } \
+	NOIPA void out_##t(t *r, int x) { t##_FILL(*r, x); } \
+	long loop_val_##t(long calls) { \
+		t a; long j; double sum = 0; \
+		t##_FILL(a, 1); \
+		for (j = 0; j < calls; j++) sum += val_##t(a); \
+		return (long) sum; \
+	} \
+	long loop_pt_##t(long calls) { \
+		t a; long j; double sum = 0; \
+		t##_FILL(a, 1); \
+		for (j = 0; j < calls; j++) sum += pt_##t(&a); \
+		return (long) sum; \
+	} \
+	long loop_ret_##t(long calls) { \
+		t a; long j; double sum = 0; \
+		for (j = 0; j < calls; j++) { a = ret_##t((int) j); sum += t##_READ(a); } \
+		return (long) sum; \
+	} \
+	long loop_out_##t(long calls) { \
+		t a; long j; double sum = 0; \
+		for (j = 0; j < calls; j++) { out_##t(&a, (int) j); sum += t##_READ(a); } \
+		return (long) sum; \
+	}
+
+#define LAYOUTS(X) \
+	X(ii, "INTEGER") X(ff, "SSE") X(fi, "INTEGER") X(ll, "INTEGER/INTEGER") \
+	X(dd, "SSE/SSE") X(ld, "INTEGER/SSE") X(fff, "SSE/SSE") X(lll, "MEMORY") \
+	X(ddd, "MEMORY") X(dddd, "MEMORY") X(x87, "X87")
+
+LAYOUTS(LAYOUT)
+
+/**
+	\brief Les boucles d'une structure de la seconde partie
+*/
+typedef struct layout {
+	const char *name;
+	long size;
+	const char *classes;
+	long (*loops[4])(long calls);	// val, pt, ret, out
+} layout;
+
+#define LAYOUT_ENTRY(t, classes) \
+	{#t, sizeof(t), classes, {loop_val_##t, loop_pt_##t, loop_ret_##t, loop_out_##t}},
+
+static const layout layouts[] = {
+	LAYOUTS(LAYOUT_ENTRY)
+};
+
+#define NLAYOUTS (sizeof(layouts) / sizeof(layouts[0]))
+
+/**
+	\brief Temps de `calls` appels avec la boucle `loop`, après un premier passage non mesuré
+*/
+long mesure(timer *t, long (*loop)(long calls), long calls) {
+	sink += loop(calls / 10 + 1);
+	start_timer(t);
+	sink += loop(calls);
+	return stop_timer(t);
+}
 
 int main (int argc, char *argv[])  {
 	timer *t = timer_alloc();
 	recorder *val_rec = recorder_alloc("argfct-val.csv");
- 	recorder *pt_rec = recorder_alloc("argfct-pt.csv");
-
-	struct arg1 a1;
-	struct arg2 a2;
-	struct arg4 a4;
-	struct arg8 a8;
-	struct arg16 a16;
-	struct arg32 a32;
-	struct arg64 a64;
-	struct arg128 a128;
-
-	int corres[] = { sizeof(struct arg1), 
-				sizeof(struct arg1), 
-				sizeof(struct arg2), 
-				sizeof(struct arg4), 
-				sizeof(struct arg8), 
-				sizeof(struct arg16), 
-				sizeof(struct arg32), 
-				sizeof(struct arg128)};
-
-	long long int * timeval = calloc(8, sizeof(double));
-	long long int * timept = calloc(8, sizeof(double));
-	int i,j;
-
-	//for(i=0; i<MAX_SIZE; i++) {
-
-		//Preparation
-		for(j=0; j<TURN; j++)
-			fctpt((void*)&a1);
-		for(j=0; j<TURN; j++)
-			fctval1(a1);
-		for(j=0; j<TURN; j++)
-			fctpt((void*)&a4);
-
-
-		// struct arg1
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctpt((void*)&a1);
-		timept[0] += (stop_timer(t)*1000/TURN);
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctval1(a1);
-		timeval[0] += (stop_timer(t)*1000/TURN);
-
-		// struct arg2
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctpt((void*)&a2);
-		timept[1] += (stop_timer(t)*1000/TURN);
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctval2(a2);
-		timeval[1] += (stop_timer(t)*1000/TURN);
-
-		// struct arg4
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctpt((void*)&a4);
-		timept[2] += (stop_timer(t)*1000/TURN);
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctval4(a4);
-		timeval[2] += (stop_timer(t)*1000/TURN);
-	
-		// struct arg8
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctpt((void*)&a8);
-		timept[3] += (stop_timer(t)*1000/TURN);
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctval8(a8);
-		timeval[3] += (stop_timer(t)*1000/TURN);
-
-		// struct arg16
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctpt((void*)&a16);
-		timept[4] += (stop_timer(t)*1000/TURN);
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctval16(a16);
-		timeval[4] += (stop_timer(t)*1000/TURN);
-
-		// struct arg32
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctpt((void*)&a32);
-		timept[5] += (stop_timer(t)*1000/TURN);
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctval32(a32);
-		timeval[5] += (stop_timer(t)*1000/TURN);
-	
-		// struct arg64
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctpt((void*)&a64);
-		timept[6] += (stop_timer(t)*1000/TURN);
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctval64(a64);
-		timeval[6] += (stop_timer(t)*1000/TURN);
-
-		// struct arg128
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctpt((void*)&a128);
-		timept[7] += (stop_timer(t)*1000/TURN);
-		start_timer(t);
-		for(j=0; j<TURN; j++)
-			fctval128(a128);
-		timeval[7] += (stop_timer(t)*1000/TURN);
-	//}
-
-	for(i=0; i<8; i++) {
-		write_record(pt_rec, corres[i], (long int) (timept[i]));//(MAX_SIZE)));
-		write_record(val_rec, corres[i], (long int) (timeval[i]));//(MAX_SIZE)));
+	recorder *pt_rec = recorder_alloc("argfct-pt.csv");
+	recorder *ret_rec = recorder_alloc("argfct-ret.csv");
+	recorder *ret_copy_rec = recorder_alloc("argfct-ret-copy.csv");
+	recorder *out_rec = recorder_alloc("argfct-out.csv");
+
+	unsigned int i;
+	for (i = 0; i < NSIZES; i++) {
+		long n = calls(sizes[i].size);
+		write_record_n(val_rec, sizes[i].size, mesure(t, sizes[i].val, n), n / 1000);
+		write_record_n(pt_rec, sizes[i].size, mesure(t, sizes[i].pt, n), n / 1000);
+		write_record_n(ret_rec, sizes[i].size, mesure(t, sizes[i].ret, n), n / 1000);
+		write_record_n(ret_copy_rec, sizes[i].size, mesure(t, sizes[i].ret_copy, n), n / 1000);
+		write_record_n(out_rec, sizes[i].size, mesure(t, sizes[i].out, n), n / 1000);
 	}
 
 	recorder_free(val_rec);
-  	recorder_free(pt_rec);
-	timer_free(t);
-
-  return EXIT_SUCCESS;
-}
+	recorder_free(pt_rec);
+	recorder_free(ret_rec);
+	recorder_free(ret_copy_rec);
+	recorder_free(out_rec);
 
+	FILE *f = fopen("argfct-layouts.csv", "w");
+	if (f == NULL) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	long overhead = get_overhead();
+	fprintf(f, "# struct, size, classes, val, pt, ret, out (ns pour 1000 appels)\n");
+	for (i = 0; i < NLAYOUTS; i++) {
+		fprintf(f, "%s, %ld, %s", layouts[i].name, layouts[i].size, layouts[i].classes);
+		int k;
+		for (k = 0; k < 4; k++)
+			fprintf(f, ", %ld", (mesure(t, layouts[i].loops[k], LAYOUT_CALLS) - overhead) / (LAYOUT_CALLS / 1000));
+		fprintf(f, "\n");
+	}
+	fclose(f);
 
+	timer_free(t);
+	return EXIT_SUCCESS;
+}
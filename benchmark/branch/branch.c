@@ -0,0 +1,334 @@
+/**
+ * \file branch.c
+ * \brief Coût des branchements qui dépendent des données
+ *
+ * Trois noyaux parcourent un tableau de `N` entiers entre 0 et 999 et
+ * comparent chaque élément à un seuil :
+ * * `filter` : copie les éléments sous le seuil dans un autre tableau;
+ * * `partition` : sépare les éléments sous le seuil et les autres dans
+ *   deux tableaux;
+ * * `reduce` : additionne les éléments sous le seuil.
+ *
+ * Chaque noyau est écrit de trois façons :
+ * * `branchy` : un `if`, compilé en saut conditionnel (la conversion en
+ *   `cmov` et la vectorisation sont désactivées pour cette fonction);
+ * * `branchless` : la comparaison donne 0 ou 1 et sert dans un calcul
+ *   (index d'écriture, masque), sans saut qui dépend des données;
+ * * `simd` : 8 éléments à la fois avec AVX2, la comparaison donne un
+ *   masque. `reduce` utilise les vecteurs de GCC (`vector_size`),
+ *   `filter` et `partition` tassent les éléments choisis avec
+ *   `vpermd` et une table des 256 masques possibles.
+ *
+ * Le seuil est choisi pour qu'une part de 0% à 100% des éléments soit
+ * dessous (la sélectivité). Sur le tableau trié (`sorted`), le résultat
+ * de la comparaison ne change qu'une fois et le saut est toujours bien
+ * prédit. Sur le tableau dans un ordre aléatoire (`random`), il est
+ * imprévisible, surtout autour de 50%.
+ *
+ * On enregistre dans `<noyau>-<version>-<ordre>.csv` le temps pour 1000
+ * éléments en ns et dans `<noyau>-<version>-<ordre>-miss.csv` les
+ * branchements mal prédits pour 1000 éléments (si les compteurs matériels
+ * sont disponibles), en fonction de la sélectivité en %. Sans AVX2, les
+ * fichiers `simd` restent vides. Ailleurs que sur x86, `reduce-simd` est
+ * compilé pour les vecteurs de la machine et les fichiers `filter-simd` et
+ * `partition-simd` restent vides.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "benchmark.h"
+#include "counter.h"
+
+#define N (1L << 18) //!< 1 MiB d'entiers, dans le L2 ou le LLC
+#define MAX_VALUE 1000
+#define ELEMS (1L << 24) //!< Éléments parcourus au minimum par mesure
+#define STEP 10 //!< Pas de la sélectivité en %
+
+/*
+ * Un saut conditionnel reste un saut : GCC convertirait sinon les `if`
+ * simples en `cmov` ou les vectoriserait
+ */
+#define BRANCHY __attribute__((noinline, optimize("no-if-conversion", \
+    "no-if-conversion2", "no-tree-loop-if-convert", "no-tree-vectorize")))
+#define SCALAR __attribute__((noinline, optimize("no-tree-vectorize")))
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD __attribute__((noinline, target("avx2,popcnt")))
+#else
+#define SIMD __attribute__((noinline))
+#endif
+
+/**
+ * \brief Arguments et résultats d'un noyau
+ */
+typedef struct work {
+  const int *a;
+  int *lo; //!< éléments sous le seuil, `N + 8` places
+  int *hi; //!< les autres, `N + 8` places
+  int t; //!< le seuil
+} work;
+
+BRANCHY long filter_branchy (work *w) {
+  long i, k = 0;
+  for (i = 0; i < N; i++) {
+    if (w->a[i] < w->t) {
+      w->lo[k++] = w->a[i];
+    }
+  }
+  return k;
+}
+
+SCALAR long filter_branchless (work *w) {
+  long i, k = 0;
+  for (i = 0; i < N; i++) {
+    int x = w->a[i];
+    w->lo[k] = x;
+    k += x < w->t;
+  }
+  return k;
+}
+
+BRANCHY long partition_branchy (work *w) {
+  long i, nl = 0, nh = 0;
+  for (i = 0; i < N; i++) {
+    if (w->a[i] < w->t) {
+      w->lo[nl++] = w->a[i];
+    } else {
+      w->hi[nh++] = w->a[i];
+    }
+  }
+  return nl;
+}
+
+SCALAR long partition_branchless (work *w) {
+  long i, nl = 0, nh = 0;
+  for (i = 0; i < N; i++) {
+    int x = w->a[i];
+    long c = x < w->t;
+    w->lo[nl] = x;
+    w->hi[nh] = x;
+    nl += c;
+    nh += 1 - c;
+  }
+  return nl;
+}
+
+BRANCHY long reduce_branchy (work *w) {
+  long i, sum = 0;
+  for (i = 0; i < N; i++) {
+    if (w->a[i] < w->t) {
+      sum += w->a[i];
+    }
+  }
+  return sum;
+}
+
+SCALAR long reduce_branchless (work *w) {
+  long i, sum = 0;
+  for (i = 0; i < N; i++) {
+    int x = w->a[i];
+    sum += x & -(x < w->t);
+  }
+  return sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * \brief `compress[m]` place au début les éléments dont le bit est dans `m`
+ */
+static int compress[256][8] __attribute__((aligned(32)));
+
+void compress_init (void) {
+  int m, b;
+  for (m = 0; m < 256; m++) {
+    int k = 0;
+    for (b = 0; b < 8; b++) {
+      if (m & (1 << b)) {
+        compress[m][k++] = b;
+      }
+    }
+    while (k < 8) {
+      compress[m][k++] = 0;
+    }
+  }
+}
+
+/**
+ * \brief Écrit dans `out` les éléments de `v` choisis par `bits`
+ *
+ * \return le nombre d'éléments écrits
+ */
+static inline __attribute__((target("avx2,popcnt")))
+long compress_store (int *out, __m256i v, int bits) {
+  __m256i perm = _mm256_load_si256((const __m256i *) compress[bits]);
+  _mm256_storeu_si256((__m256i *) out, _mm256_permutevar8x32_epi32(v, perm));
+  return __builtin_popcount(bits);
+}
+
+SIMD long filter_simd (work *w) {
+  __m256i t = _mm256_set1_epi32(w->t);
+  long i, k = 0;
+  for (i = 0; i < N; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (w->a + i));
+    int bits = _mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_cmpgt_epi32(t, v)));
+    k += compress_store(w->lo + k, v, bits);
+  }
+  return k;
+}
+
+SIMD long partition_simd (work *w) {
+  __m256i t = _mm256_set1_epi32(w->t);
+  long i, nl = 0, nh = 0;
+  for (i = 0; i < N; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (w->a + i));
+    int bits = _mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_cmpgt_epi32(t, v)));
+    nl += compress_store(w->lo + nl, v, bits);
+    nh += compress_store(w->hi + nh, v, ~bits & 0xff);
+  }
+  return nl;
+}
+#else
+#define filter_simd NULL
+#define partition_simd NULL
+#endif
+
+typedef int v8si __attribute__((vector_size(32)));
+
+SIMD long reduce_simd (work *w) {
+  v8si sum = {0, 0, 0, 0, 0, 0, 0, 0};
+  v8si t = sum + w->t;
+  long i;
+  for (i = 0; i < N; i += 8) {
+    v8si v;
+    memcpy(&v, w->a + i, sizeof(v));
+    sum += v & (v < t);
+  }
+  long total = 0;
+  for (i = 0; i < 8; i++) {
+    total += sum[i];
+  }
+  return total;
+}
+
+typedef struct kernel {
+  const char *name;
+  long (*run) (work *w);
+  int simd;
+} kernel;
+
+static const kernel kernels[] = {
+  {"filter-branchy", filter_branchy, 0},
+  {"filter-branchless", filter_branchless, 0},
+  {"filter-simd", filter_simd, 1},
+  {"partition-branchy", partition_branchy, 0},
+  {"partition-branchless", partition_branchless, 0},
+  {"partition-simd", partition_simd, 1},
+  {"reduce-branchy", reduce_branchy, 0},
+  {"reduce-branchless", reduce_branchless, 0},
+  {"reduce-simd", reduce_simd, 1},
+};
+
+#define NKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+/**
+ * \brief Le résultat des noyaux, pour que le compilateur les garde
+ */
+volatile long sink;
+
+int compare_int (const void *x, const void *y) {
+  return *(const int *) x - *(const int *) y;
+}
+
+int *alloc_ints (long n) {
+  int *p = (int *) aligned_alloc(64, n * sizeof(int));
+  if (p == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+int main (int argc, char *argv[]) {
+  int simd = 1;
+#if defined(__x86_64__) || defined(__i386__)
+  simd = __builtin_cpu_supports("avx2");
+  if (!simd) {
+    fprintf(stderr, "pas d'AVX2, les noyaux simd sont ignorés\n");
+  }
+  compress_init();
+#endif
+
+  int *orders[2];
+  const char *order_names[2] = {"sorted", "random"};
+  orders[1] = alloc_ints(N);
+  uint64_t x = 88172645463325252ULL;
+  long i;
+  for (i = 0; i < N; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    orders[1][i] = (int) (x % MAX_VALUE);
+  }
+  orders[0] = alloc_ints(N);
+  memcpy(orders[0], orders[1], N * sizeof(int));
+  qsort(orders[0], N, sizeof(int), compare_int);
+
+  work w;
+  w.lo = alloc_ints(N + 8);
+  w.hi = alloc_ints(N + 8);
+  timer *t = timer_alloc();
+  counter *ctr = counter_alloc(PERF_TYPE_HARDWARE,
+      PERF_COUNT_HW_BRANCH_MISSES);
+  long passes = ELEMS / N;
+
+  int o;
+  for (o = 0; o < 2; o++) {
+    w.a = orders[o];
+    unsigned int k;
+    for (k = 0; k < NKERNELS; k++) {
+      char name[64];
+      snprintf(name, sizeof(name), "%s-%s.csv", kernels[k].name,
+          order_names[o]);
+      recorder *time_rec = recorder_alloc(name);
+      snprintf(name, sizeof(name), "%s-%s-miss.csv", kernels[k].name,
+          order_names[o]);
+      recorder *miss_rec = recorder_alloc(name);
+      int pct;
+      int skip = kernels[k].run == NULL || (kernels[k].simd && !simd);
+      for (pct = 0; pct <= 100 && !skip; pct += STEP) {
+        w.t = pct * MAX_VALUE / 100;
+        sink += kernels[k].run(&w);
+        long p;
+        counter_start(ctr);
+        start_timer(t);
+        for (p = 0; p < passes; p++) {
+          sink += kernels[k].run(&w);
+        }
+        long time = stop_timer(t);
+        long misses = counter_stop(ctr);
+        write_record_n(time_rec, pct, time, N * passes / 1000);
+        if (misses >= 0) {
+          write_value(miss_rec, pct, misses * 1000 / (N * passes));
+        }
+      }
+      recorder_free(time_rec);
+      recorder_free(miss_rec);
+    }
+    printf("%s\n", order_names[o]);
+  }
+
+  counter_free(ctr);
+  timer_free(t);
+  free(orders[0]);
+  free(orders[1]);
+  free(w.lo);
+  free(w.hi);
+  return EXIT_SUCCESS;
+}
@@ -1,48 +1,186 @@
 /**
 	\file calloc.c
-	\brief Ce programme compare l'utilisation de calloc ou de malloc pour allouer de l'espace mémoire
+	\brief Ce programme compare le coût de l'allocation et celui du premier accès à la mémoire allouée
 
-	Ce programme va donc allouer de l'espace avec calloc d'une part et malloc d'autre part, en comparant les temps nécessaires à chacun.	
+	Au-delà de `M_MMAP_THRESHOLD` (128 KiB par défaut), `malloc` et `calloc` demandent de nouvelles pages au système avec `mmap`. Ces pages ne sont pas encore en mémoire : l'appel est rapide, et c'est la première écriture dans chaque page qui coûte un défaut de page et la mise à zéro de la page par le noyau. `calloc` n'a alors pas besoin d'effacer la mémoire. En dessous du seuil, la mémoire vient du tas, souvent déjà en mémoire : `calloc` doit l'effacer lui-même.
 
+	Pour chaque taille, de 4 KiB à 64 MiB, et pour chaque variante, on mesure séparément
+		* l'allocation (`<variante>-alloc.csv`);
+		* la première écriture complète (`<variante>-touch1.csv`);
+		* la seconde écriture complète (`<variante>-touch2.csv`), le coût d'une écriture sans défaut de page.
+
+	Les variantes sont
+		* `malloc` et `calloc` avec `M_MMAP_THRESHOLD` fixé à sa valeur par défaut : sinon la glibc l'augmente dès qu'un bloc alloué par `mmap` est libéré, et les mesures dépendraient de l'ordre des tailles;
+		* `malloc-tuned` et `calloc-tuned` avec `M_MMAP_THRESHOLD` au maximum (32 MiB) et `M_TRIM_THRESHOLD` à 1 GiB : la mémoire libérée reste dans le tas et est réutilisée;
+		* `mmap` : `mmap` anonyme, sans intermédiaire;
+		* `populate` : `mmap` avec `MAP_POPULATE`, toutes les pages sont allouées et effacées pendant l'appel.
+
+	Chaque variante tourne dans un processus fils, pour que les réglages de `mallopt` et l'état du tas ne se mélangent pas.
+
+	Les temps sont en ns par appel, moyennés sur `REPEAT_BYTES / taille` allocations (entre `MIN_REPEAT` et `MAX_REPEAT`), chacune libérée avant la suivante. Chaque appel est mesuré seul : le programme utilise `libbenchmark_rt`, dont le `timer` est `clock_gettime` (à la ns près, `gettimeofday` ne donne que des µs), et l'`overhead` du timer est retiré de chaque mesure. Les colonnes suivantes (`write_record_mem`) donnent les fautes de page et la variation de RSS par appel, puis RSS, PSS et transparent hugepages à la fin de la dernière mesure, et enfin les variations de PSS et de THP par appel.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
 #include <sys/mman.h>
-#include <fcntl.h>
+#include <sys/wait.h>
 
 #include "benchmark.h"
 
-//Time by default (4)
+#define MIN_SIZE (4L << 10)
+#define MAX_SIZE (64L << 20)
+#define REPEAT_BYTES (256L << 20)
+#define MIN_REPEAT 4
+#define MAX_REPEAT 1000
+#define DEFAULT_MMAP_THRESHOLD (128 * 1024)
+#define TUNED_MMAP_THRESHOLD (32 * 1024 * 1024)	// le maximum accepté par la glibc en 64 bits
+#define TUNED_TRIM_THRESHOLD (1024 * 1024 * 1024)
 
+/**
+	\brief Une façon d'obtenir `size` bytes et de les rendre
+*/
+typedef struct variant {
+	const char *name;
+	void *(*get)(size_t size);
+	void (*put)(void *p, size_t size);
+	int tuned;	// réglages de `mallopt`
+} variant;
 
-#define MULTIPLICATEUR 10000
-#define MAX 800000
+void *get_malloc(size_t size) {
+	return malloc(size);
+}
 
+void *get_calloc(size_t size) {
+	return calloc(size, 1);
+}
 
-int main (int argc, char *argv[])  {
-	// Déclare un timer, ainsi que deux recorder qui vont contenir les résultats de l'exécution du programme
-	timer * t = timer_alloc();
-	recorder * mal_rec = recorder_alloc("malloc.csv");
- 	recorder * cal_rec = recorder_alloc("calloc.csv");
-
-	void* res;
-	int i;
-	for(i=MULTIPLICATEUR; i< MAX; i+=MULTIPLICATEUR) {
-		start_timer(t);
-		res = malloc(i);
-		write_record(mal_rec, i+MULTIPLICATEUR, stop_timer(t));
-		free(res);
-
-		start_timer(t);
-		res = calloc(i,1);
-		write_record(cal_rec, i+MULTIPLICATEUR, stop_timer(t));
-		free(res);
+void put_free(void *p, size_t size) {
+	free(p);
+}
+
+void *get_mmap(size_t size) {
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+void *get_populate(size_t size) {
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+void put_munmap(void *p, size_t size) {
+	munmap(p, size);
+}
+
+static const variant variants[] = {
+	{"malloc", get_malloc, put_free, 0},
+	{"calloc", get_calloc, put_free, 0},
+	{"malloc-tuned", get_malloc, put_free, 1},
+	{"calloc-tuned", get_calloc, put_free, 1},
+	{"mmap", get_mmap, put_munmap, 0},
+	{"populate", get_populate, put_munmap, 0},
+};
+
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+/**
+	\brief Mesure toutes les tailles pour la variante `v`, dans le processus courant
+*/
+void measure(const variant *v) {
+	if (v->tuned) {
+		if (mallopt(M_MMAP_THRESHOLD, TUNED_MMAP_THRESHOLD) == 0 || mallopt(M_TRIM_THRESHOLD, TUNED_TRIM_THRESHOLD) == 0) {
+			fprintf(stderr, "mallopt a échoué\n");
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		// fixer le seuil désactive son ajustement dynamique
+		mallopt(M_MMAP_THRESHOLD, DEFAULT_MMAP_THRESHOLD);
 	}
 
-	recorder_free(mal_rec);
-  	recorder_free(cal_rec);
+	timer *t = timer_alloc();
+	long overhead = get_overhead();
+	char name[64];
+	snprintf(name, sizeof(name), "%s-alloc.csv", v->name);
+	recorder *alloc_rec = recorder_alloc(name);
+	snprintf(name, sizeof(name), "%s-touch1.csv", v->name);
+	recorder *touch1_rec = recorder_alloc(name);
+	snprintf(name, sizeof(name), "%s-touch2.csv", v->name);
+	recorder *touch2_rec = recorder_alloc(name);
+
+	long size;
+	for (size = MIN_SIZE; size <= MAX_SIZE; size *= 2) {
+		long repeat = REPEAT_BYTES / size;
+		if (repeat < MIN_REPEAT) repeat = MIN_REPEAT;
+		if (repeat > MAX_REPEAT) repeat = MAX_REPEAT;
+		long alloc_time = 0, touch1_time = 0, touch2_time = 0;
+		memstat alloc_mem, touch1_mem, touch2_mem;
+		memstat_reset(&alloc_mem);
+		memstat_reset(&touch1_mem);
+		memstat_reset(&touch2_mem);
+		long r;
+		for (r = 0; r < repeat; r++) {
+			memstat_start(&alloc_mem);
+			start_timer(t);
+			char *p = v->get(size);
+			alloc_time += stop_timer(t) - overhead;
+			memstat_stop(&alloc_mem);
+			if (p == NULL) {
+				perror(v->name);
+				exit(EXIT_FAILURE);
+			}
+
+			memstat_start(&touch1_mem);
+			start_timer(t);
+			memset(p, 1, size);
+			BM_DO_NOT_OPTIMIZE(p);
+			touch1_time += stop_timer(t) - overhead;
+			memstat_stop(&touch1_mem);
+
+			memstat_start(&touch2_mem);
+			start_timer(t);
+			memset(p, 2, size);
+			BM_DO_NOT_OPTIMIZE(p);
+			touch2_time += stop_timer(t) - overhead;
+			memstat_stop(&touch2_mem);
+
+			v->put(p, size);
+		}
+		// `write_record_mem` retire l'`overhead` une fois, il l'a déjà été à chaque appel
+		write_record_mem(alloc_rec, size, alloc_time + overhead, repeat, &alloc_mem);
+		write_record_mem(touch1_rec, size, touch1_time + overhead, repeat, &touch1_mem);
+		write_record_mem(touch2_rec, size, touch2_time + overhead, repeat, &touch2_mem);
+	}
+
+	recorder_free(alloc_rec);
+	recorder_free(touch1_rec);
+	recorder_free(touch2_rec);
 	timer_free(t);
+}
+
+int main (int argc, char *argv[])  {
+	unsigned int v;
+	for (v = 0; v < NVARIANTS; v++) {
+		fflush(NULL);
+		pid_t pid = fork();
+		if (pid == -1) {
+			perror("fork");
+			exit(EXIT_FAILURE);
+		}
+		if (pid == 0) {
+			measure(&variants[v]);
+			exit(EXIT_SUCCESS);
+		}
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+			fprintf(stderr, "%s a échoué\n", variants[v].name);
+			exit(EXIT_FAILURE);
+		}
+		printf("%s\n", variants[v].name);
+	}
 
-  return EXIT_SUCCESS;
+	return EXIT_SUCCESS;
 }
@@ -0,0 +1,423 @@
+/**
+ * \file contention.c
+ * \brief Compteur partagé sous contention : atomiques, spinlocks, verrous
+ *        à file d'attente et verrous de la librairie `pthread`
+ *
+ * `N` threads incrémentent le même compteur pendant `DURATION` ms.
+ * Pour les verrous, la section critique incrémente le compteur et met à
+ * jour un petit tableau partagé (deux lignes de cache en tout). On compare
+ * * `atomic` : `atomic_fetch_add`, sans verrou;
+ * * `cas` : une boucle de `compare-and-swap`, sans verrou;
+ * * `ttas` : un spinlock test-and-test-and-set;
+ * * `ticket` : un ticket lock (FIFO);
+ * * `mcs` et `clh` : des verrous à file d'attente où chaque thread attend
+ *   sur sa propre ligne de cache;
+ * * `spin` : `pthread_spinlock_t`;
+ * * `mutex` et `adaptive` : `pthread_mutex_t` normal et
+ *   `PTHREAD_MUTEX_ADAPTIVE_NP` (qui tourne un peu avant de dormir);
+ * * `rwlock` : `pthread_rwlock_t`, pris en écriture.
+ *
+ * Pour chaque nombre de threads, de 1 à deux fois le nombre de CPUs, on
+ * enregistre
+ * * dans `<variante>.csv` le débit en opérations par ms;
+ * * dans `<variante>-fairness.csv` l'indice d'équité de Jain
+ *   (somme des x)^2 / (n * somme des x^2) sur le nombre d'opérations de
+ *   chaque thread, multiplié par 1000 : 1000 si tous les threads ont fait
+ *   autant d'opérations, 1000/n si un seul thread a tout fait.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "benchmark.h"
+
+#define DURATION 100        //!< Durée d'une mesure en ms
+#define MAX_THREADS 256
+#define CS_WORDS 8          //!< Taille du tableau modifié en section critique
+
+/**
+ * \brief Indique au processeur qu'on est dans une boucle d'attente active
+ */
+static inline void cpu_relax () {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#else
+  atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+/**
+ * \brief Noeud d'un verrou MCS, un par thread
+ */
+typedef struct mcs_node {
+  _Alignas(64) _Atomic(struct mcs_node *) next;
+  atomic_int locked;
+} mcs_node;
+
+/**
+ * \brief Noeud d'un verrou CLH, qui passe d'un thread à l'autre
+ */
+typedef struct clh_node {
+  _Alignas(64) atomic_int locked;
+} clh_node;
+
+/**
+ * \brief Contexte d'un thread, sur sa propre ligne de cache
+ */
+typedef struct worker {
+  _Alignas(64) long ops;
+  mcs_node mcs;
+  clh_node *clh;      //!< Le noeud avec lequel on prend le verrou CLH
+  clh_node *clh_pred; //!< Le noeud du prédécesseur, réutilisé ensuite
+  pthread_t thread;
+} worker;
+
+/*
+ * Données partagées. Le compteur et le tableau de la section critique sont
+ * sur une ligne de cache séparée de celle des verrous.
+ */
+
+static _Alignas(64) atomic_long counter;
+static _Alignas(64) long cs_data[CS_WORDS];
+static _Alignas(64) atomic_int stop;
+
+static _Alignas(64) atomic_int ttas_lock;
+static _Alignas(64) atomic_long ticket_next;
+static _Alignas(64) atomic_long ticket_owner;
+static _Alignas(64) _Atomic(mcs_node *) mcs_tail;
+static _Alignas(64) _Atomic(clh_node *) clh_tail;
+static clh_node *clh_nodes;
+static pthread_spinlock_t spin;
+static pthread_mutex_t mutex;
+static pthread_rwlock_t rwlock;
+
+/**
+ * \brief La section critique protégée par les verrous
+ *
+ * Le compteur est atomique mais n'est modifié que par le détenteur du
+ * verrou : un accès `relaxed` suffit et coûte autant qu'un `long`.
+ */
+static inline void critical_section () {
+  long c = atomic_load_explicit(&counter, memory_order_relaxed);
+  atomic_store_explicit(&counter, c + 1, memory_order_relaxed);
+  cs_data[c % CS_WORDS] += c;
+}
+
+/*
+ * Sans verrou
+ */
+
+void atomic_op (worker *w) {
+  atomic_fetch_add(&counter, 1);
+}
+
+void cas_op (worker *w) {
+  long c = atomic_load_explicit(&counter, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak(&counter, &c, c + 1)) {
+    cpu_relax();
+  }
+}
+
+/*
+ * Test-and-test-and-set : on n'essaie de prendre le verrou avec un
+ * `exchange` que quand une lecture le voit libre, pour ne pas invalider
+ * la ligne de cache des autres pendant l'attente.
+ */
+
+void ttas_op (worker *w) {
+  for (;;) {
+    while (atomic_load_explicit(&ttas_lock, memory_order_relaxed)) {
+      cpu_relax();
+    }
+    if (!atomic_exchange_explicit(&ttas_lock, 1, memory_order_acquire)) {
+      break;
+    }
+  }
+  critical_section();
+  atomic_store_explicit(&ttas_lock, 0, memory_order_release);
+}
+
+/*
+ * Ticket lock : chaque thread prend un numéro et attend son tour, les
+ * threads passent donc dans l'ordre d'arrivée.
+ */
+
+void ticket_op (worker *w) {
+  long my = atomic_fetch_add_explicit(&ticket_next, 1, memory_order_relaxed);
+  while (atomic_load_explicit(&ticket_owner, memory_order_acquire) != my) {
+    cpu_relax();
+  }
+  critical_section();
+  atomic_store_explicit(&ticket_owner, my + 1, memory_order_release);
+}
+
+/*
+ * MCS (Mellor-Crummey et Scott) : les threads en attente forment une liste
+ * chaînée et chacun attend sur le champ `locked` de son propre noeud.
+ * Celui qui libère le verrou réveille son successeur.
+ */
+
+void mcs_op (worker *w) {
+  mcs_node *n = &w->mcs;
+  atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
+  atomic_store_explicit(&n->locked, 1, memory_order_relaxed);
+  mcs_node *pred = atomic_exchange_explicit(&mcs_tail, n, memory_order_acq_rel);
+  if (pred != NULL) {
+    atomic_store_explicit(&pred->next, n, memory_order_release);
+    while (atomic_load_explicit(&n->locked, memory_order_acquire)) {
+      cpu_relax();
+    }
+  }
+
+  critical_section();
+
+  mcs_node *next = atomic_load_explicit(&n->next, memory_order_acquire);
+  if (next == NULL) {
+    mcs_node *expected = n;
+    if (atomic_compare_exchange_strong_explicit(&mcs_tail, &expected, NULL,
+          memory_order_release, memory_order_relaxed)) {
+      return;
+    }
+    // un successeur est en train de s'ajouter
+    while ((next = atomic_load_explicit(&n->next, memory_order_acquire)) == NULL) {
+      cpu_relax();
+    }
+  }
+  atomic_store_explicit(&next->locked, 0, memory_order_release);
+}
+
+/*
+ * CLH (Craig, Landin et Hagersten) : chaque thread attend sur le noeud de
+ * son prédécesseur. En sortant, il garde ce noeud pour la fois suivante
+ * puisque le sien peut encore être lu par son successeur.
+ */
+
+void clh_op (worker *w) {
+  atomic_store_explicit(&w->clh->locked, 1, memory_order_relaxed);
+  clh_node *pred = atomic_exchange_explicit(&clh_tail, w->clh, memory_order_acq_rel);
+  while (atomic_load_explicit(&pred->locked, memory_order_acquire)) {
+    cpu_relax();
+  }
+  w->clh_pred = pred;
+
+  critical_section();
+
+  atomic_store_explicit(&w->clh->locked, 0, memory_order_release);
+  w->clh = w->clh_pred;
+}
+
+/*
+ * Verrous de la librairie pthread
+ */
+
+void spin_op (worker *w) {
+  pthread_spin_lock(&spin);
+  critical_section();
+  pthread_spin_unlock(&spin);
+}
+
+void mutex_op (worker *w) {
+  pthread_mutex_lock(&mutex);
+  critical_section();
+  pthread_mutex_unlock(&mutex);
+}
+
+void rwlock_op (worker *w) {
+  pthread_rwlock_wrlock(&rwlock);
+  critical_section();
+  pthread_rwlock_unlock(&rwlock);
+}
+
+/**
+ * \brief Initialise tous les verrous pour `nthreads` threads
+ *
+ * \param kind le type de `mutex` : `PTHREAD_MUTEX_NORMAL` ou
+ *             `PTHREAD_MUTEX_ADAPTIVE_NP`
+ */
+void locks_init (worker *workers, int nthreads, int kind) {
+  int i;
+  atomic_store(&counter, 0);
+  atomic_store(&ttas_lock, 0);
+  atomic_store(&ticket_next, 0);
+  atomic_store(&ticket_owner, 0);
+  atomic_store(&mcs_tail, NULL);
+
+  // un noeud par thread plus un noeud libre de départ pour la queue
+  clh_nodes = (clh_node *) aligned_alloc(64, sizeof(clh_node) * (nthreads + 1));
+  if (clh_nodes == NULL) {
+    perror("aligned_alloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i <= nthreads; i++) {
+    atomic_init(&clh_nodes[i].locked, 0);
+  }
+  for (i = 0; i < nthreads; i++) {
+    workers[i].clh = &clh_nodes[i];
+  }
+  atomic_store(&clh_tail, &clh_nodes[nthreads]);
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, kind);
+  // les fonctions pthread retournent l'erreur, `errno` n'est pas modifié
+  int ret;
+  if ((ret = pthread_mutex_init(&mutex, &attr)) != 0
+      || (ret = pthread_spin_init(&spin, PTHREAD_PROCESS_PRIVATE)) != 0
+      || (ret = pthread_rwlock_init(&rwlock, NULL)) != 0) {
+    fprintf(stderr, "pthread_*_init : %s\n", strerror(ret));
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutexattr_destroy(&attr);
+}
+
+void locks_destroy () {
+  pthread_mutex_destroy(&mutex);
+  pthread_spin_destroy(&spin);
+  pthread_rwlock_destroy(&rwlock);
+  free(clh_nodes);
+}
+
+/**
+ * \brief Une variante du benchmark : une opération sur le compteur
+ */
+typedef struct variant {
+  const char *name;
+  void (*op) (worker *w);
+  int mutex_kind; //!< Pour `mutex_op` seulement
+} variant;
+
+static const variant variants[] = {
+  {"atomic", atomic_op, PTHREAD_MUTEX_NORMAL},
+  {"cas", cas_op, PTHREAD_MUTEX_NORMAL},
+  {"ttas", ttas_op, PTHREAD_MUTEX_NORMAL},
+  {"ticket", ticket_op, PTHREAD_MUTEX_NORMAL},
+  {"mcs", mcs_op, PTHREAD_MUTEX_NORMAL},
+  {"clh", clh_op, PTHREAD_MUTEX_NORMAL},
+  {"spin", spin_op, PTHREAD_MUTEX_NORMAL},
+  {"mutex", mutex_op, PTHREAD_MUTEX_NORMAL},
+  {"adaptive", mutex_op, PTHREAD_MUTEX_ADAPTIVE_NP},
+  {"rwlock", rwlock_op, PTHREAD_MUTEX_NORMAL},
+};
+
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+typedef struct args {
+  worker *w;
+  const variant *v;
+  pthread_barrier_t *barrier;
+} args;
+
+void *hammer (void *param) {
+  args *a = (args *) param;
+  worker *w = a->w;
+  void (*op) (worker *) = a->v->op;
+  long ops = 0;
+
+  pthread_barrier_wait(a->barrier);
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    op(w);
+    ops++;
+  }
+  w->ops = ops;
+  return NULL;
+}
+
+/**
+ * \brief Lance `nthreads` threads sur la variante `v` pendant `DURATION` ms
+ *
+ * \return le débit en opérations par ms, l'équité est mise dans `fairness`
+ */
+long run (timer *t, const variant *v, int nthreads, long *fairness) {
+  worker *workers = (worker *) aligned_alloc(64, sizeof(worker) * nthreads);
+  args *a = (args *) malloc(sizeof(args) * nthreads);
+  if (workers == NULL || a == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  memset(workers, 0, sizeof(worker) * nthreads);
+  locks_init(workers, nthreads, v->mutex_kind);
+  atomic_store(&stop, 0);
+
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, nthreads + 1);
+  int i;
+  for (i = 0; i < nthreads; i++) {
+    a[i].w = &workers[i];
+    a[i].v = v;
+    a[i].barrier = &barrier;
+    int ret = pthread_create(&workers[i].thread, NULL, hammer, &a[i]);
+    if (ret != 0) {
+      fprintf(stderr, "pthread_create : %s\n", strerror(ret));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  struct timespec duration = {DURATION / 1000, (DURATION % 1000) * 1000000L};
+  pthread_barrier_wait(&barrier);
+  start_timer(t);
+  nanosleep(&duration, NULL);
+  atomic_store(&stop, 1);
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  long time = stop_timer(t);
+
+  double sum = 0, sum2 = 0;
+  for (i = 0; i < nthreads; i++) {
+    sum += workers[i].ops;
+    sum2 += (double) workers[i].ops * workers[i].ops;
+  }
+  *fairness = sum2 > 0 ? (long) (1000 * sum * sum / (nthreads * sum2)) : 0;
+
+  // vérifie que le verrou a bien protégé le compteur
+  if (atomic_load(&counter) != (long) sum) {
+    fprintf(stderr, "%s: compteur %ld au lieu de %ld\n", v->name,
+        atomic_load(&counter), (long) sum);
+    exit(EXIT_FAILURE);
+  }
+
+  pthread_barrier_destroy(&barrier);
+  locks_destroy();
+  free(workers);
+  free(a);
+  return time > 0 ? (long) (sum * 1000000 / time) : 0;
+}
+
+int main (int argc, char *argv[]) {
+  int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpu < 1) {
+    ncpu = 1;
+  }
+  int max_threads = 2 * ncpu > MAX_THREADS ? MAX_THREADS : 2 * ncpu;
+
+  timer *t = timer_alloc();
+  unsigned int i;
+  for (i = 0; i < NVARIANTS; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s.csv", variants[i].name);
+    recorder *tput_rec = recorder_alloc(name);
+    snprintf(name, sizeof(name), "%s-fairness.csv", variants[i].name);
+    recorder *fair_rec = recorder_alloc(name);
+
+    int n;
+    for (n = 1; n <= max_threads; n++) {
+      long fairness;
+      long tput = run(t, &variants[i], n, &fairness);
+      write_value(tput_rec, n, tput);
+      write_value(fair_rec, n, fairness);
+    }
+    printf("%s\n", variants[i].name);
+
+    recorder_free(tput_rec);
+    recorder_free(fair_rec);
+  }
+  timer_free(t);
+
+  return EXIT_SUCCESS;
+}
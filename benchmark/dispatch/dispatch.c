@@ -0,0 +1,394 @@
+/**
+ * \file dispatch.c
+ * \brief Coût des appels indirects dans une boucle d'interpréteur
+ *
+ * Un petit interpréteur exécute un programme de `PROG_LEN` instructions,
+ * chacune choisie parmi `targets` opérations (de 1 à `MAX_TARGETS`). La
+ * boucle est écrite de six façons :
+ * * `direct` : un appel direct à une seule fonction, la référence;
+ * * `fptr` : une table de pointeurs de fonction indexée par l'instruction;
+ * * `vtable` : des objets qui pointent vers une table de méthodes,
+ *   `o->vt->run(o, acc)`, comme un appel virtuel C++ (deux chargements
+ *   dépendants puis l'appel indirect);
+ * * `closure` : une paire (fonction, environnement) appelée avec son
+ *   environnement, comme `std::function` (un appel indirect vers la
+ *   fonction qui enveloppe l'objet appelé);
+ * * `switch` : un `switch` dans la boucle, un seul saut indirect par la
+ *   table de sauts;
+ * * `goto` : `goto` calculé (extension GNU), le saut vers l'instruction
+ *   suivante est recopié à la fin de chaque opération (threaded code).
+ *
+ * La suite est en C : `vtable` et `closure` reproduisent ce que génère un
+ * compilateur C++ pour un appel virtuel et pour `std::function`.
+ *
+ * Le programme interprété suit deux motifs :
+ * * `cycle` : les opérations se suivent dans un ordre fixe, de période
+ *   `targets`, que les prédicteurs de branchements indirects apprennent;
+ * * `random` : les opérations sont tirées au hasard, la cible n'est
+ *   prévisible que s'il n'y en a qu'une.
+ *
+ * On enregistre dans `<variante>-<motif>.csv` le temps pour 1000
+ * instructions en ns et dans `<variante>-<motif>-miss.csv` les
+ * branchements mal prédits par 1000 instructions (si les compteurs
+ * matériels sont disponibles), en fonction du nombre d'opérations.
+ *
+ * Le même programme est compilé avec les protections contre Spectre v2
+ * quand le compilateur les connaît : `dispatch-retpoline`
+ * (`-mindirect-branch=thunk`, chaque saut indirect passe par un
+ * retpoline qui empêche sa prédiction) et `dispatch-ibt`
+ * (`-fcf-protection=full`, une instruction `endbr64` à chaque cible).
+ * `dispatch` lui-même est compilé avec `-mindirect-branch=keep` et
+ * `-fcf-protection=none` : certains compilateurs (GCC d'Ubuntu) activent
+ * `-fcf-protection` par défaut.
+ * Sans argument, le programme mesure sa propre compilation puis lance
+ * ces deux programmes avec `--child`. Chacun ajoute une ligne, pour
+ * `MITIGATION_TARGETS` opérations, à `mitigations-cycle.csv` et
+ * `mitigations-random.csv`.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "benchmark.h"
+#include "counter.h"
+
+#ifndef BUILD
+#define BUILD "default"
+#endif
+
+#define MAX_TARGETS 16
+#define MITIGATION_TARGETS 8
+#define PROG_LEN 4096
+#define DISPATCHES (1L << 24) //!< Instructions exécutées par mesure
+
+static const char *others[] = {"retpoline", "ibt"};
+
+#define NOTHERS (sizeof(others) / sizeof(others[0]))
+
+/*
+ * Les opérations de l'interpréteur, différentes pour que le compilateur
+ * ne puisse pas remplacer le `switch` par un calcul
+ */
+#define OP_0(a) ((a) + 1)
+#define OP_1(a) ((a) ^ 0x5555)
+#define OP_2(a) ((a) * 3)
+#define OP_3(a) ((a) - 7)
+#define OP_4(a) ((a) >> 1)
+#define OP_5(a) ((a) | 0x100)
+#define OP_6(a) ((a) & 0xffffff)
+#define OP_7(a) ((a) + ((a) >> 3))
+#define OP_8(a) ((a) << 2)
+#define OP_9(a) ((a) ^ ((a) >> 7))
+#define OP_10(a) ((a) * 5 + 1)
+#define OP_11(a) ((a) - ((a) >> 2))
+#define OP_12(a) (~(a))
+#define OP_13(a) ((a) + 0x1234)
+#define OP_14(a) ((a) ^ 0x77777)
+#define OP_15(a) ((a) * 7)
+
+#define OPS(X) X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7) X(8) X(9) X(10) \
+  X(11) X(12) X(13) X(14) X(15)
+
+/*
+ * `fptr` : une fonction par opération
+ */
+#define FN(i) \
+  __attribute__((noinline)) long fn_##i (long acc) { return OP_##i(acc); }
+OPS(FN)
+
+#define FN_ENTRY(i) fn_##i,
+static long (* const fns[MAX_TARGETS]) (long acc) = {OPS(FN_ENTRY)};
+
+/*
+ * `vtable` : un objet par opération, sa table de méthodes et son opérande
+ */
+typedef struct object object;
+
+typedef struct methods {
+  long (*run) (const object *self, long acc);
+} methods;
+
+struct object {
+  const methods *vt;
+  long operand;
+};
+
+#define METHOD(i) \
+  __attribute__((noinline)) long method_##i (const object *self, long acc) { \
+    return OP_##i(acc) + self->operand; \
+  } \
+  static const methods methods_##i = {method_##i};
+OPS(METHOD)
+
+#define OBJECT_ENTRY(i) {&methods_##i, i},
+static const object objects[MAX_TARGETS] = {OPS(OBJECT_ENTRY)};
+
+/*
+ * `closure` : une fonction et l'environnement qu'elle reçoit
+ */
+typedef struct closure {
+  long (*fn) (const void *env, long acc);
+  const void *env;
+} closure;
+
+#define CLOSURE(i) \
+  __attribute__((noinline)) long closure_##i (const void *env, long acc) { \
+    return OP_##i(acc) + *(const long *) env; \
+  }
+OPS(CLOSURE)
+
+#define CLOSURE_ENTRY(i) closure_##i,
+static long (* const closure_fns[MAX_TARGETS]) (const void *env, long acc) =
+    {OPS(CLOSURE_ENTRY)};
+static const long operands[MAX_TARGETS] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+    11, 12, 13, 14, 15};
+
+/**
+ * \brief Le programme sous les trois formes utilisées par les variantes
+ */
+typedef struct program {
+  unsigned char code[PROG_LEN];
+  const object *objs[PROG_LEN];
+  closure closures[PROG_LEN];
+} program;
+
+/**
+ * \brief Le résultat des exécutions, pour que le compilateur les garde
+ */
+volatile long sink;
+
+long run_direct (const program *p, long rounds) {
+  long acc = 1, r;
+  int pc;
+  for (r = 0; r < rounds; r++) {
+    for (pc = 0; pc < PROG_LEN; pc++) {
+      acc = fn_0(acc);
+    }
+  }
+  return acc;
+}
+
+long run_fptr (const program *p, long rounds) {
+  long acc = 1, r;
+  int pc;
+  for (r = 0; r < rounds; r++) {
+    for (pc = 0; pc < PROG_LEN; pc++) {
+      acc = fns[p->code[pc]](acc);
+    }
+  }
+  return acc;
+}
+
+long run_vtable (const program *p, long rounds) {
+  long acc = 1, r;
+  int pc;
+  for (r = 0; r < rounds; r++) {
+    for (pc = 0; pc < PROG_LEN; pc++) {
+      const object *o = p->objs[pc];
+      acc = o->vt->run(o, acc);
+    }
+  }
+  return acc;
+}
+
+long run_closure (const program *p, long rounds) {
+  long acc = 1, r;
+  int pc;
+  for (r = 0; r < rounds; r++) {
+    for (pc = 0; pc < PROG_LEN; pc++) {
+      const closure *c = &p->closures[pc];
+      acc = c->fn(c->env, acc);
+    }
+  }
+  return acc;
+}
+
+#define CASE(i) case i: acc = OP_##i(acc); break;
+
+long run_switch (const program *p, long rounds) {
+  long acc = 1, r;
+  int pc;
+  for (r = 0; r < rounds; r++) {
+    for (pc = 0; pc < PROG_LEN; pc++) {
+      switch (p->code[pc]) {
+        OPS(CASE)
+      }
+    }
+  }
+  return acc;
+}
+
+#define LABEL(i) &&op_##i,
+#define THREADED(i) \
+  op_##i: \
+    acc = OP_##i(acc); \
+    if (++pc == PROG_LEN) goto end; \
+    goto *labels[p->code[pc]];
+
+long run_goto (const program *p, long rounds) {
+  static const void *labels[MAX_TARGETS] = {OPS(LABEL)};
+  long acc = 1, r;
+  int pc;
+  for (r = 0; r < rounds; r++) {
+    pc = 0;
+    goto *labels[p->code[0]];
+    OPS(THREADED)
+  end:
+    ;
+  }
+  return acc;
+}
+
+typedef struct variant {
+  const char *name;
+  long (*run) (const program *p, long rounds);
+} variant;
+
+static const variant variants[] = {
+  {"direct", run_direct},
+  {"fptr", run_fptr},
+  {"vtable", run_vtable},
+  {"closure", run_closure},
+  {"switch", run_switch},
+  {"goto", run_goto},
+};
+
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+#define CYCLE 0
+#define RANDOM 1
+static const char *patterns[] = {"cycle", "random"};
+
+/**
+ * \brief Remplit `p` avec `targets` opérations suivant `pattern`
+ */
+void program_init (program *p, int targets, int pattern) {
+  uint64_t x = 88172645463325252ULL;
+  int pc;
+  for (pc = 0; pc < PROG_LEN; pc++) {
+    int op;
+    if (pattern == CYCLE) {
+      op = pc % targets;
+    } else {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      op = (int) (x % targets);
+    }
+    p->code[pc] = (unsigned char) op;
+    p->objs[pc] = &objects[op];
+    p->closures[pc] = (closure) {closure_fns[op], &operands[op]};
+  }
+}
+
+/**
+ * \brief Exécute `DISPATCHES` instructions avec la variante `v`
+ *
+ * \param misses reçoit les branchements mal prédits, -1 sans compteur
+ * \return le temps
+ */
+long measure (timer *t, counter *ctr, const variant *v, const program *p,
+    long *misses) {
+  long rounds = DISPATCHES / PROG_LEN;
+  sink += v->run(p, 1);
+  counter_start(ctr);
+  start_timer(t);
+  sink += v->run(p, rounds);
+  long time = stop_timer(t);
+  *misses = counter_stop(ctr);
+  return time;
+}
+
+/**
+ * \brief Le balayage du nombre d'opérations, pour la compilation par défaut
+ */
+void sweep (timer *t, counter *ctr, program *p) {
+  int pattern;
+  for (pattern = CYCLE; pattern <= RANDOM; pattern++) {
+    recorder *time_rec[NVARIANTS];
+    recorder *miss_rec[NVARIANTS];
+    unsigned int v;
+    for (v = 0; v < NVARIANTS; v++) {
+      char name[64];
+      snprintf(name, sizeof(name), "%s-%s.csv", variants[v].name,
+          patterns[pattern]);
+      time_rec[v] = recorder_alloc(name);
+      snprintf(name, sizeof(name), "%s-%s-miss.csv", variants[v].name,
+          patterns[pattern]);
+      miss_rec[v] = recorder_alloc(name);
+    }
+    int targets;
+    for (targets = 1; targets <= MAX_TARGETS; targets *= 2) {
+      program_init(p, targets, pattern);
+      for (v = 0; v < NVARIANTS; v++) {
+        long misses;
+        long time = measure(t, ctr, &variants[v], p, &misses);
+        write_record_n(time_rec[v], targets, time, DISPATCHES / 1000);
+        if (misses >= 0) {
+          write_value(miss_rec[v], targets, misses * 1000 / DISPATCHES);
+        }
+      }
+    }
+    printf("%s\n", patterns[pattern]);
+    for (v = 0; v < NVARIANTS; v++) {
+      recorder_free(time_rec[v]);
+      recorder_free(miss_rec[v]);
+    }
+  }
+}
+
+int main (int argc, char *argv[]) {
+  int child = is_sibling_child(argc, argv);
+
+  timer *t = timer_alloc();
+  counter *ctr = counter_alloc(PERF_TYPE_HARDWARE,
+      PERF_COUNT_HW_BRANCH_MISSES);
+  program *p = (program *) malloc(sizeof(program));
+  if (p == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  if (!child) {
+    sweep(t, ctr, p);
+  }
+
+  // une ligne par compilation, en ns pour 1000 instructions
+  int pattern;
+  for (pattern = CYCLE; pattern <= RANDOM; pattern++) {
+    char name[64];
+    snprintf(name, sizeof(name), "mitigations-%s.csv", patterns[pattern]);
+    FILE *f = open_csv(name, child);
+    unsigned int v;
+    if (!child) {
+      fprintf(f, "# compilation");
+      for (v = 0; v < NVARIANTS; v++) {
+        fprintf(f, ", %s", variants[v].name);
+      }
+      fprintf(f, " (%d opérations)\n", MITIGATION_TARGETS);
+    }
+    program_init(p, MITIGATION_TARGETS, pattern);
+    long overhead = get_overhead();
+    fprintf(f, "%s", BUILD);
+    for (v = 0; v < NVARIANTS; v++) {
+      long misses;
+      long time = measure(t, ctr, &variants[v], p, &misses);
+      fprintf(f, ", %ld", (time - overhead) / (DISPATCHES / 1000));
+    }
+    fprintf(f, "\n");
+    fclose(f);
+  }
+  printf("%s\n", BUILD);
+
+  free(p);
+  counter_free(ctr);
+  timer_free(t);
+  if (child) {
+    return EXIT_SUCCESS;
+  }
+
+  // les compilations avec protections, à côté de ce programme
+  run_siblings(argv[0], "dispatch", others, NOTHERS);
+  return EXIT_SUCCESS;
+}
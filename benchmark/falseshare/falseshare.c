@@ -0,0 +1,191 @@
+/**
+ * \file falseshare.c
+ * \brief Coût du faux partage (false sharing) de lignes de cache
+ *
+ * Chaque thread incrémente son propre compteur, il n'y a donc aucun
+ * partage de données. Mais le cache travaille par lignes de 64 bytes :
+ * si plusieurs compteurs sont dans la même ligne, chaque écriture invalide
+ * la ligne dans les caches des autres coeurs, qui doivent la récupérer
+ * avant leur propre écriture. On place les compteurs
+ * * `packed` : les uns à côté des autres (8 compteurs par ligne);
+ * * `pad64` : un compteur par ligne de 64 bytes;
+ * * `pad128` : un compteur toutes les deux lignes, car le préchargement
+ *   de la ligne adjacente des processeurs Intel lit les lignes par paires;
+ * * `page` : un compteur par page de 4 KiB.
+ *
+ * Pour chaque nombre de threads (puissances de 2 jusqu'au nombre de CPUs),
+ * on enregistre
+ * * dans `<placement>.csv` le débit total en incréments par µs;
+ * * dans `<placement>-hitm.csv` le nombre de chargements servis par une
+ *   ligne modifiée dans le cache d'un autre coeur (HITM), par millier
+ *   d'incréments, vide si le processeur n'est pas Intel (`COUNTER_HITM`
+ *   est un code brut Intel);
+ * * dans `<placement>-l1miss.csv` le nombre de défauts de cache L1 en
+ *   lecture, par millier d'incréments.
+ * Les compteurs sont lus avec `lib/counter.c`. S'ils ne sont pas
+ * disponibles, les deux derniers fichiers restent vides.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "benchmark.h"
+#include "counter.h"
+
+#define ITER 20000000L //!< Incréments par thread
+#define PAGE 4096
+
+/**
+ * \brief Un placement : l'écart en bytes entre deux compteurs
+ */
+typedef struct placement {
+  const char *name;
+  size_t stride;
+} placement;
+
+static const placement placements[] = {
+  {"packed", sizeof(long)},
+  {"pad64", 64},
+  {"pad128", 128},
+  {"page", PAGE},
+};
+
+#define NPLACEMENTS (sizeof(placements) / sizeof(placements[0]))
+
+typedef struct args {
+  volatile long *counter;
+  int cpu;
+  pthread_barrier_t *barrier;
+} args;
+
+/**
+ * \brief Fixe le thread sur un CPU puis incrémente son compteur `ITER` fois
+ *
+ * `volatile` force une lecture et une écriture en mémoire à chaque
+ * incrément, comme pour un compteur dans une structure partagée.
+ */
+void *increment (void *param) {
+  args *a = (args *) param;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(a->cpu, &set);
+  sched_setaffinity(0, sizeof(set), &set);
+
+  pthread_barrier_wait(a->barrier);
+  long i;
+  for (i = 0; i < ITER; i++) {
+    (*a->counter)++;
+  }
+  return NULL;
+}
+
+/**
+ * \brief Lance `nthreads` threads avec des compteurs espacés de `stride`
+ *
+ * \return le temps jusqu'à ce que tous les threads aient fini
+ */
+long run (timer *t, counter *hitm, counter *l1miss, size_t stride,
+    int nthreads, int ncpu) {
+  char *base = (char *) aligned_alloc(PAGE,
+      (stride * nthreads + PAGE - 1) / PAGE * PAGE);
+  pthread_t *threads = (pthread_t *) malloc(sizeof(pthread_t) * nthreads);
+  args *a = (args *) malloc(sizeof(args) * nthreads);
+  if (base == NULL || threads == NULL || a == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  memset(base, 0, stride * nthreads);
+
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, nthreads + 1);
+  counter_start(hitm);
+  counter_start(l1miss);
+  int i;
+  for (i = 0; i < nthreads; i++) {
+    a[i].counter = (volatile long *) (base + i * stride);
+    a[i].cpu = i % ncpu;
+    a[i].barrier = &barrier;
+    if (pthread_create(&threads[i], NULL, increment, &a[i]) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+  pthread_barrier_wait(&barrier);
+  start_timer(t);
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  long time = stop_timer(t);
+
+  for (i = 0; i < nthreads; i++) {
+    if (*a[i].counter != ITER) {
+      fprintf(stderr, "compteur %d : %ld au lieu de %ld\n", i,
+          *a[i].counter, ITER);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  pthread_barrier_destroy(&barrier);
+  free(base);
+  free(threads);
+  free(a);
+  return time;
+}
+
+int main (int argc, char *argv[]) {
+  int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpu < 1) {
+    ncpu = 1;
+  }
+
+  // ouverts avant les threads pour qu'ils en héritent
+  counter *hitm = counter_alloc_raw(COUNTER_HITM_VENDOR, COUNTER_HITM);
+  counter *l1miss = counter_alloc(PERF_TYPE_HW_CACHE,
+      COUNTER_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+        PERF_COUNT_HW_CACHE_RESULT_MISS));
+
+  timer *t = timer_alloc();
+  unsigned int p;
+  for (p = 0; p < NPLACEMENTS; p++) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s.csv", placements[p].name);
+    recorder *tput_rec = recorder_alloc(name);
+    snprintf(name, sizeof(name), "%s-hitm.csv", placements[p].name);
+    recorder *hitm_rec = recorder_alloc(name);
+    snprintf(name, sizeof(name), "%s-l1miss.csv", placements[p].name);
+    recorder *l1miss_rec = recorder_alloc(name);
+
+    int n;
+    for (n = 1; ; n = (n * 2 > ncpu && n < ncpu) ? ncpu : n * 2) {
+      long time = run(t, hitm, l1miss, placements[p].stride, n, ncpu);
+      long h = counter_stop(hitm);
+      long m = counter_stop(l1miss);
+      long ops = ITER * n;
+      write_value(tput_rec, n, time > 0 ? ops * 1000 / time : 0);
+      if (h >= 0) {
+        write_value(hitm_rec, n, h * 1000 / ops);
+      }
+      if (m >= 0) {
+        write_value(l1miss_rec, n, m * 1000 / ops);
+      }
+      if (n >= ncpu) {
+        break;
+      }
+    }
+    printf("%s\n", placements[p].name);
+
+    recorder_free(tput_rec);
+    recorder_free(hitm_rec);
+    recorder_free(l1miss_rec);
+  }
+
+  timer_free(t);
+  counter_free(hitm);
+  counter_free(l1miss);
+  return EXIT_SUCCESS;
+}
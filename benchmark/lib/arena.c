@@ -0,0 +1,361 @@
+/**
+ * \file arena.c
+ * \brief arène, pool et slab pour la mémoire de travail des benchmarks
+ *
+ * `malloc` doit gérer toutes les tailles, tous les threads et des durées
+ * de vie quelconques. Quand on connaît la forme des allocations, on peut
+ * faire beaucoup moins de travail :
+ * * une `arena` ne fait qu'avancer un pointeur et oublie tout à
+ *   `arena_reset`, pour la mémoire d'une itération;
+ * * un `pool` garde ses objets libres dans une liste chaînée à l'intérieur
+ *   des objets eux-mêmes;
+ * * un `slab` ajoute au `pool` un cache par thread : les threads ne
+ *   prennent le verrou que pour échanger des lots de `SLAB_BATCH` objets
+ *   avec la liste partagée.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "arena.h"
+
+#define ALIGN 16 //!< Alignement des objets, comme `malloc`
+#define SLAB_BATCH 64 //!< Objets échangés entre un cache et la liste partagée
+#define SLAB_CHUNK (64 * 1024) //!< Taille des blocs découpés par un `slab`
+
+static size_t align_up (size_t size) {
+  return (size + ALIGN - 1) & ~(size_t) (ALIGN - 1);
+}
+
+static void *xmalloc (size_t size) {
+  void *p = aligned_alloc(ALIGN, align_up(size));
+  if (p == NULL) {
+    perror("aligned_alloc");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/*
+ * Arène
+ */
+
+/**
+ * \brief Un bloc de l'arène, les données suivent l'en-tête
+ */
+typedef struct block {
+  struct block *next;
+  size_t size;
+  _Alignas(ALIGN) char data[];
+} block;
+
+struct arena {
+  block *first;
+  block *current;
+  size_t used; //!< Bytes utilisés dans `current`
+  size_t capacity; //!< Taille minimale des nouveaux blocs
+};
+
+static block *block_alloc (size_t size) {
+  block *b = (block *) xmalloc(sizeof(block) + size);
+  b->next = NULL;
+  b->size = size;
+  return b;
+}
+
+/**
+ * \brief Crée une arène avec un premier bloc de `capacity` bytes
+ *
+ * Quand un bloc est plein, l'arène en ajoute un autre, d'au moins
+ * `capacity` bytes.
+ */
+arena *arena_alloc (size_t capacity) {
+  arena *a = (arena *) xmalloc(sizeof(arena));
+  a->capacity = align_up(capacity);
+  a->first = block_alloc(a->capacity);
+  a->current = a->first;
+  a->used = 0;
+  return a;
+}
+
+/**
+ * \brief Réserve `size` bytes, alignés sur 16 bytes
+ */
+void *arena_push (arena *a, size_t size) {
+  size = align_up(size);
+  while (a->used + size > a->current->size) {
+    // les blocs suivants existent déjà si l'arène a été remise à zéro
+    if (a->current->next == NULL) {
+      a->current->next = block_alloc(size > a->capacity ? size : a->capacity);
+    }
+    a->current = a->current->next;
+    a->used = 0;
+  }
+  void *p = a->current->data + a->used;
+  a->used += size;
+  return p;
+}
+
+/**
+ * \brief Libère toutes les allocations de `a` d'un coup, en gardant ses
+ *        blocs pour les suivantes
+ */
+void arena_reset (arena *a) {
+  a->current = a->first;
+  a->used = 0;
+}
+
+/**
+ * \brief Libère toutes les resources utilisées par `a`
+ */
+void arena_free (arena *a) {
+  block *b = a->first;
+  while (b != NULL) {
+    block *next = b->next;
+    free(b);
+    b = next;
+  }
+  free(a);
+}
+
+/*
+ * Pool
+ */
+
+/**
+ * \brief Un objet libre contient l'adresse de l'objet libre suivant
+ */
+typedef struct node {
+  struct node *next;
+} node;
+
+struct pool {
+  node *free;
+  char *objects;
+};
+
+/**
+ * \brief Crée un `pool` de `capacity` objets de `size` bytes
+ */
+pool *pool_alloc (size_t size, long capacity) {
+  pool *p = (pool *) xmalloc(sizeof(pool));
+  size = align_up(size < sizeof(node) ? sizeof(node) : size);
+  p->objects = (char *) xmalloc(size * capacity);
+  p->free = NULL;
+  long i;
+  for (i = capacity - 1; i >= 0; i--) {
+    node *n = (node *) (p->objects + i * size);
+    n->next = p->free;
+    p->free = n;
+  }
+  return p;
+}
+
+/**
+ * \brief Prend un objet libre
+ *
+ * \return l'objet ou `NULL` si les `capacity` objets sont utilisés
+ */
+void *pool_get (pool *p) {
+  node *n = p->free;
+  if (n != NULL) {
+    p->free = n->next;
+  }
+  return n;
+}
+
+/**
+ * \brief Rend `obj`, obtenu avec `pool_get`
+ */
+void pool_put (pool *p, void *obj) {
+  node *n = (node *) obj;
+  n->next = p->free;
+  p->free = n;
+}
+
+/**
+ * \brief Libère toutes les resources utilisées par `p`
+ */
+void pool_free (pool *p) {
+  free(p->objects);
+  free(p);
+}
+
+/*
+ * Slab
+ */
+
+/**
+ * \brief Le cache d'un thread pour un `slab`
+ */
+typedef struct cache {
+  struct slab *owner;
+  node *free;
+  int count;
+} cache;
+
+struct slab {
+  size_t size;
+  pthread_key_t key; //!< `cache` du thread
+  pthread_mutex_t lock; //!< Protège `free`, `count`, `chunks` et `offset`
+  node *free;
+  long count;
+  block *chunks; //!< Blocs découpés en objets, le premier en cours
+  size_t offset; //!< Bytes déjà découpés dans `chunks`
+};
+
+/**
+ * \brief Rend les objets du cache d'un thread qui se termine
+ */
+static void cache_destroy (void *param) {
+  cache *c = (cache *) param;
+  slab *s = c->owner;
+  if (c->free != NULL) {
+    node *last = c->free;
+    while (last->next != NULL) {
+      last = last->next;
+    }
+    pthread_mutex_lock(&s->lock);
+    last->next = s->free;
+    s->free = c->free;
+    s->count += c->count;
+    pthread_mutex_unlock(&s->lock);
+  }
+  free(c);
+}
+
+/**
+ * \brief Crée un `slab` d'objets de `size` bytes
+ *
+ * Les objets sont découpés dans des blocs de 64 KiB, qui ne sont rendus
+ * au système que par `slab_free`.
+ */
+slab *slab_alloc (size_t size) {
+  slab *s = (slab *) xmalloc(sizeof(slab));
+  s->size = align_up(size < sizeof(node) ? sizeof(node) : size);
+  if (s->size > SLAB_CHUNK) {
+    fprintf(stderr, "slab_alloc : objets de %zu bytes trop grands\n", size);
+    exit(EXIT_FAILURE);
+  }
+  // les fonctions pthread retournent l'erreur, `errno` n'est pas modifié
+  int ret;
+  if ((ret = pthread_key_create(&s->key, cache_destroy)) != 0 ||
+      (ret = pthread_mutex_init(&s->lock, NULL)) != 0) {
+    fprintf(stderr, "slab_alloc : %s\n", strerror(ret));
+    exit(EXIT_FAILURE);
+  }
+  s->free = NULL;
+  s->count = 0;
+  s->chunks = NULL;
+  s->offset = SLAB_CHUNK;
+  return s;
+}
+
+static cache *get_cache (slab *s) {
+  cache *c = (cache *) pthread_getspecific(s->key);
+  if (c == NULL) {
+    c = (cache *) xmalloc(sizeof(cache));
+    c->owner = s;
+    c->free = NULL;
+    c->count = 0;
+    pthread_setspecific(s->key, c);
+  }
+  return c;
+}
+
+/**
+ * \brief Remplit le cache `c` avec `SLAB_BATCH` objets de la liste
+ *        partagée, ou découpés dans un bloc
+ */
+static void refill (slab *s, cache *c) {
+  pthread_mutex_lock(&s->lock);
+  while (c->count < SLAB_BATCH) {
+    node *n = s->free;
+    if (n != NULL) {
+      s->free = n->next;
+      s->count--;
+    } else {
+      if (s->offset + s->size > SLAB_CHUNK) {
+        block *b = block_alloc(SLAB_CHUNK);
+        b->next = s->chunks;
+        s->chunks = b;
+        s->offset = 0;
+      }
+      n = (node *) (s->chunks->data + s->offset);
+      s->offset += s->size;
+    }
+    n->next = c->free;
+    c->free = n;
+    c->count++;
+  }
+  pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * \brief Rend `SLAB_BATCH` objets du cache `c` à la liste partagée
+ */
+static void drain (slab *s, cache *c) {
+  node *first = c->free;
+  node *last = first;
+  int i;
+  for (i = 1; i < SLAB_BATCH; i++) {
+    last = last->next;
+  }
+  c->free = last->next;
+  c->count -= SLAB_BATCH;
+  pthread_mutex_lock(&s->lock);
+  last->next = s->free;
+  s->free = first;
+  s->count += SLAB_BATCH;
+  pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * \brief Prend un objet, dans le cache du thread s'il n'est pas vide
+ */
+void *slab_get (slab *s) {
+  cache *c = get_cache(s);
+  if (c->free == NULL) {
+    refill(s, c);
+  }
+  node *n = c->free;
+  c->free = n->next;
+  c->count--;
+  return n;
+}
+
+/**
+ * \brief Rend `obj` dans le cache du thread, qui déborde par lots vers la
+ *        liste partagée
+ */
+void slab_put (slab *s, void *obj) {
+  cache *c = get_cache(s);
+  node *n = (node *) obj;
+  n->next = c->free;
+  c->free = n;
+  c->count++;
+  if (c->count >= 2 * SLAB_BATCH) {
+    drain(s, c);
+  }
+}
+
+/**
+ * \brief Libère toutes les resources utilisées par `s`
+ *
+ * Les autres threads qui ont utilisé `s` doivent être terminés : ils
+ * rendent leur cache à la liste partagée en se terminant.
+ */
+void slab_free (slab *s) {
+  free(pthread_getspecific(s->key));
+  pthread_key_delete(s->key);
+  pthread_mutex_destroy(&s->lock);
+  block *b = s->chunks;
+  while (b != NULL) {
+    block *next = b->next;
+    free(b);
+    b = next;
+  }
+  free(s);
+}
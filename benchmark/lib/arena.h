@@ -0,0 +1,40 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+/*
+ * Allocateurs spécialisés pour la mémoire de travail des benchmarks.
+ * * `arena` : allocation par incrément d'un pointeur, tout est libéré
+ *   d'un coup par `arena_reset`;
+ * * `pool` : objets d'une seule taille, liste des objets libres, capacité
+ *   fixée à la création, un seul thread;
+ * * `slab` : objets d'une seule taille, avec un cache par thread. Un objet
+ *   peut être rendu par un autre thread que celui qui l'a obtenu.
+ * Les erreurs d'allocation affichent un message et font `exit`.
+ */
+
+#include <stddef.h>
+
+typedef struct arena arena;
+struct arena;
+
+arena *arena_alloc (size_t capacity);
+void *arena_push (arena *a, size_t size);
+void arena_reset (arena *a);
+void arena_free (arena *a);
+
+typedef struct pool pool;
+struct pool;
+
+pool *pool_alloc (size_t size, long capacity);
+void *pool_get (pool *p);
+void pool_put (pool *p, void *obj);
+void pool_free (pool *p);
+
+typedef struct slab slab;
+struct slab;
+
+slab *slab_alloc (size_t size);
+void *slab_get (slab *s);
+void slab_put (slab *s, void *obj);
+void slab_free (slab *s);
+
+#endif
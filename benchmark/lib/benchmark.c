@@ -4,15 +4,19 @@
  *
  * Cette libraire contient `timer` pour mesurer le temps et `recorder`
  * pour écrire les temps dans un fichier au format `.csv` qu'on peut
- * plotter facilement avec `gnuplot`.
+ * plotter facilement avec `gnuplot`, et `memstat` pour les fautes de page
+ * et la mémoire résidente autour d'une mesure.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <sys/time.h>
 #include <sys/times.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/wait.h>
 #include "benchmark.h"
 
 /*  _____ _
@@ -173,6 +177,116 @@ void timer_free (timer *t) {
   free(t);
 }
 
+/*  __  __                     _        _
+ * |  \/  | ___ _ __ ___  ___| |_ __ _| |_
+ * | |\/| |/ _ \ '_ ` _ \/ __| __/ _` | __|
+ * | |  | |  __/ | | | | \__ \ || (_| | |_
+ * |_|  |_|\___|_| |_| |_|___/\__\__,_|\__|
+ */
+
+/**
+ * \brief Met dans `minflt` et `majflt` les fautes de page du processus
+ *
+ * En cas d'erreur, affiche un message sur `stderr` et `exit`
+ */
+static void read_faults (long *minflt, long *majflt) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == -1) {
+    perror("getrusage");
+    exit(EXIT_FAILURE);
+  }
+  *minflt = usage.ru_minflt;
+  *majflt = usage.ru_majflt;
+}
+
+/**
+ * \brief Retourne le RSS du processus en KiB, -1 si indisponible
+ *
+ * `/proc/self/statm` est plus simple à lire que `smaps_rollup`.
+ */
+static long read_rss () {
+  long size, resident;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f == NULL) {
+    return -1;
+  }
+  int ok = fscanf(f, "%ld %ld", &size, &resident) == 2;
+  fclose(f);
+  return ok ? resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+}
+
+/**
+ * \brief Lit PSS et `AnonHugePages` dans `/proc/self/smaps_rollup`
+ *
+ * Le fichier existe depuis Linux 4.14, sinon les deux valent -1.
+ */
+static void read_smaps (long *pss, long *thp) {
+  char line[256];
+  *pss = -1;
+  *thp = -1;
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  if (f == NULL) {
+    return;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, "Pss:", 4) == 0) {
+      sscanf(line + 4, "%ld", pss);
+    } else if (strncmp(line, "AnonHugePages:", 14) == 0) {
+      sscanf(line + 14, "%ld", thp);
+    }
+  }
+  fclose(f);
+}
+
+/**
+ * \brief Remet à zéro les valeurs accumulées dans `m`
+ */
+void memstat_reset (memstat *m) {
+  memset(m, 0, sizeof(memstat));
+  m->rss = -1;
+  m->pss = -1;
+  m->thp = -1;
+  m->start_pss = -1;
+  m->start_thp = -1;
+}
+
+/**
+ * \brief Note l'état de la mémoire au début d'un bloc
+ *
+ * `smaps_rollup` parcourt toutes les tables de pages, mais `memstat_start`
+ * est appelé avant `start_timer` : ce temps n'est pas mesuré. Les fautes
+ * sont lues en dernier : lire `/proc` peut en provoquer.
+ */
+void memstat_start (memstat *m) {
+  m->start_rss = read_rss();
+  read_smaps(&m->start_pss, &m->start_thp);
+  read_faults(&m->start_minflt, &m->start_majflt);
+}
+
+/**
+ * \brief Ajoute à `m` les fautes de page et la variation de RSS, PSS et
+ *        THP depuis `memstat_start`, et note RSS, PSS et THP à la fin du bloc
+ *
+ * Les fautes sont lues en premier : lire `/proc` peut en provoquer.
+ */
+void memstat_stop (memstat *m) {
+  long minflt, majflt;
+  read_faults(&minflt, &majflt);
+  m->minflt += minflt - m->start_minflt;
+  m->majflt += majflt - m->start_majflt;
+  m->rss = read_rss();
+  if (m->rss != -1 && m->start_rss != -1) {
+    m->drss += m->rss - m->start_rss;
+  }
+  read_smaps(&m->pss, &m->thp);
+  if (m->pss != -1 && m->start_pss != -1) {
+    m->dpss += m->pss - m->start_pss;
+  }
+  if (m->thp != -1 && m->start_thp != -1) {
+    m->dthp += m->thp - m->start_thp;
+  }
+}
+
 /*  ____                        _
  * |  _ \ ___  ___ ___  _ __ __| | ___ _ __
  * | |_) / _ \/ __/ _ \| '__/ _` |/ _ \ '__|
@@ -185,13 +299,25 @@ void timer_free (timer *t) {
  *        sans rien faire entre
  */
 volatile long int overhead = -1;
+#define OVERHEAD_SAMPLES 1000
 /**
  * \brief Mets à jours l'`overhead`
+ *
+ * Le minimum de `OVERHEAD_SAMPLES` mesures : la première paie les fautes
+ * de page et les caches froids, et un seul écart suffit à fausser les
+ * mesures d'appels courts dont on retire l'`overhead` à chaque fois.
  */
 void update_overhead() {
   timer *t = timer_alloc();
-  start_timer(t);
-  overhead = stop_timer(t);
+  int i;
+  overhead = -1;
+  for (i = 0; i < OVERHEAD_SAMPLES; i++) {
+    start_timer(t);
+    long sample = stop_timer(t);
+    if (overhead == -1 || sample < overhead) {
+      overhead = sample;
+    }
+  }
   timer_free(t);
   printf("overhead updated: %ld\n", overhead);
 }
@@ -208,6 +334,7 @@ long int get_overhead () {
 struct recorder {
   FILE *output;
   long int overhead;
+  int header; //!< le nom des colonnes de `write_record_mem` est écrit
 };
 
 /**
@@ -229,6 +356,7 @@ recorder *recorder_alloc (char *filename) {
     exit(EXIT_FAILURE);
   }
   rec->overhead = get_overhead();
+  rec->header = 0;
   return rec;
 }
 
@@ -254,6 +382,35 @@ void write_record_n (recorder *rec, long int x, long int time, long n) {
   fprintf(rec->output, "%ld, %ld\n", x, (time - rec->overhead) / n);
 }
 
+/**
+ * \brief Écris `value` en correspondance avec `x` sans retirer l'`overhead`
+ *
+ * À utiliser pour les valeurs qui ne sont pas des temps
+ * (compteurs de fautes de page, de cache miss, ...)
+ */
+void write_value (recorder *rec, long int x, long int value) {
+  fprintf(rec->output, "%ld, %ld\n", x, value);
+}
+
+/**
+ * \brief Comme `write_record_n`, suivi des colonnes de `m`
+ *
+ * Les fautes de page et la variation de RSS sont divisées par `n` comme le
+ * temps, mais sans arrondi : une opération ne provoque souvent qu'une
+ * fraction de faute.
+ */
+void write_record_mem (recorder *rec, long int x, long int time, long n,
+                       const memstat *m) {
+  if (!rec->header) {
+    fprintf(rec->output, "# x, time [ns], minflt, majflt, drss [KiB],"
+            " rss [KiB], pss [KiB], thp [KiB], dpss [KiB], dthp [KiB]\n");
+    rec->header = 1;
+  }
+  fprintf(rec->output, "%ld, %ld, %.3f, %.3f, %.3f, %ld, %ld, %ld, %.3f, %.3f\n",
+          x, (time - rec->overhead) / n, (double) m->minflt / n,
+          (double) m->majflt / n, (double) m->drss / n,
+          m->rss, m->pss, m->thp, (double) m->dpss / n, (double) m->dthp / n);
+}
 
 /**
  * \brief Libère toutes les resources utilisées par `rec`
@@ -264,3 +421,68 @@ void recorder_free (recorder *rec) {
   fclose(rec->output);
   free(rec);
 }
+
+/*  ____   _  _      _  _
+ * / ___| (_)| |__  | |(_) _ __    __ _
+ * \___ \ | || '_ \ | || || '_ \  / _` |
+ *  ___) || || |_) || || || | | || (_| |
+ * |____/ |_||_.__/ |_||_||_| |_| \__, |
+ *                                |___/
+ */
+
+/**
+ * \brief Indique si le programme a été lancé par `run_siblings`
+ */
+int is_sibling_child (int argc, char *argv[]) {
+  return argc > 1 && strcmp(argv[1], "--child") == 0;
+}
+
+/**
+ * \brief Ouvre `name`, à la suite si `child`, sinon en le vidant
+ *
+ * En cas d'erreur, affiche un message sur `stderr` et `exit`
+ */
+FILE *open_csv (const char *name, int child) {
+  FILE *f = fopen(name, child ? "a" : "w");
+  if (f == NULL) {
+    perror(name);
+    exit(EXIT_FAILURE);
+  }
+  return f;
+}
+
+/**
+ * \brief Lance l'une après l'autre les variantes `<prefix>-<others[i]>`
+ *
+ * \param argv0 le chemin du programme, les variantes sont dans le même
+ * dossier
+ *
+ * Chaque variante reçoit `--child`, celles qui ne sont pas exécutables
+ * sont ignorées. Les tampons de `stdio` sont vidés avant chaque `fork`
+ * pour que les lignes ne soient pas écrites deux fois.
+ */
+void run_siblings (const char *argv0, const char *prefix,
+                   const char *const others[], int nothers) {
+  const char *slash = strrchr(argv0, '/');
+  int dir = slash != NULL ? slash - argv0 + 1 : 0;
+  int o;
+  for (o = 0; o < nothers; o++) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%.*s%s-%s", dir, argv0, prefix, others[o]);
+    if (access(path, X_OK) != 0) {
+      continue;
+    }
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+      execl(path, path, "--child", (char *) NULL);
+      perror(path);
+      exit(EXIT_FAILURE);
+    }
+    waitpid(pid, NULL, 0);
+  }
+}
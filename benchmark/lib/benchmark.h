@@ -1,5 +1,7 @@
 #ifndef __BENCHMARK_H__
 #define __BENCHMARK_H__
+#include <stdio.h>
+
 /*  _____ _
  * |_   _(_)_ __ ___   ___ _ __
  *   | | | | '_ ` _ \ / _ \ '__|
@@ -23,6 +25,43 @@ long int stop_timer (timer *t);
 
 void timer_free (timer *t);
 
+/*  __  __                     _        _
+ * |  \/  | ___ _ __ ___  ___| |_ __ _| |_
+ * | |\/| |/ _ \ '_ ` _ \/ __| __/ _` | __|
+ * | |  | |  __/ | | | | \__ \ || (_| | |_
+ * |_|  |_|\___|_| |_| |_|___/\__\__,_|\__|
+ */
+
+/*
+ * Mémoire du processus autour d'un bloc mesuré, comme `timer` pour le
+ * temps : `memstat_start` avant le bloc, `memstat_stop` après. Les fautes
+ * de page (`getrusage`) et les variations de RSS, PSS et transparent
+ * hugepages (`/proc/self/smaps_rollup`) s'accumulent d'un bloc à l'autre
+ * jusqu'à `memstat_reset`, RSS, PSS et THP sont ceux de la fin du dernier
+ * bloc.
+ * Les tailles sont en KiB, -1 si elles ne sont pas disponibles.
+ */
+typedef struct memstat {
+  long minflt;   //!< fautes de page mineures
+  long majflt;   //!< fautes de page majeures (lecture sur le disque)
+  long drss;     //!< variation de RSS
+  long rss;
+  long pss;      //!< RSS où chaque page partagée compte pour sa part
+  long thp;      //!< RSS en transparent hugepages (`AnonHugePages`)
+  long dpss;     //!< variation de PSS
+  long dthp;     //!< variation de THP
+  // état au début du bloc en cours
+  long start_minflt;
+  long start_majflt;
+  long start_rss;
+  long start_pss;
+  long start_thp;
+} memstat;
+
+void memstat_reset (memstat *m);
+void memstat_start (memstat *m);
+void memstat_stop (memstat *m);
+
 /*  ____                        _
  * |  _ \ ___  ___ ___  _ __ __| | ___ _ __
  * | |_) / _ \/ __/ _ \| '__/ _` |/ _ \ '__|
@@ -40,7 +79,49 @@ recorder *recorder_alloc (char *filename);
 
 void write_record (recorder *rec, long int x, long int time);
 void write_record_n (recorder *rec, long int x, long int time, long n);
+void write_value (recorder *rec, long int x, long int value);
+/*
+ * Comme `write_record_n` avec en plus les colonnes de `m` :
+ * x, temps, fautes mineures, fautes majeures, variation de RSS (les trois
+ * par opération, sur les `n` opérations), RSS, PSS, THP, puis les
+ * variations de PSS et de THP (par opération).
+ * La première ligne du fichier est un commentaire avec le nom des colonnes.
+ */
+void write_record_mem (recorder *rec, long int x, long int time, long n,
+                       const memstat *m);
 
 void recorder_free (recorder *rec);
 
+/*  ____   _  _      _  _
+ * / ___| (_)| |__  | |(_) _ __    __ _
+ * \___ \ | || '_ \ | || || '_ \  / _` |
+ *  ___) || || |_) || || || | | || (_| |
+ * |____/ |_||_.__/ |_||_||_| |_| \__, |
+ *                                |___/
+ */
+
+/*
+ * Un programme peut être compilé plusieurs fois à côté de lui-même
+ * (`<prefix>-<variante>`, avec un autre allocateur, d'autres options, ...).
+ * Le premier ouvre les `.csv` en écriture avec `open_csv(name, 0)`, écrit
+ * l'en-tête et sa ligne, puis `run_siblings` lance chaque variante avec
+ * `--child` : elle ouvre les mêmes fichiers avec `open_csv(name, 1)` et y
+ * ajoute sa ligne. Les variantes absentes sont ignorées.
+ */
+int is_sibling_child (int argc, char *argv[]);
+FILE *open_csv (const char *name, int child);
+void run_siblings (const char *argv0, const char *prefix,
+                   const char *const others[], int nothers);
+
+/*
+ * Barrières pour le compilateur, sans aucune instruction générée.
+ * BM_DO_NOT_OPTIMIZE(x) : le compilateur doit calculer `x` et considère
+ * que toute la mémoire accessible (par exemple à travers le pointeur `x`)
+ * est lue et modifiée à cet endroit : les écritures qui précèdent ne
+ * peuvent pas être supprimées ni déplacées après.
+ * BM_CLOBBER_MEMORY() : pareil, sans valeur à garder.
+ */
+#define BM_DO_NOT_OPTIMIZE(x) __asm__ volatile("" : : "r,m"(x) : "memory")
+#define BM_CLOBBER_MEMORY() __asm__ volatile("" : : : "memory")
+
 #endif
@@ -0,0 +1,165 @@
+/**
+ * \file counter.c
+ * \brief compteurs matériels du processeur avec `perf_event_open`
+ *
+ * `perf stat` compte les événements de tout le programme. Ces fonctions
+ * permettent de compter autour d'une seule mesure, comme le `timer` de
+ * `benchmark.c` : `counter_start` lit le compteur et l'active,
+ * `counter_stop` le désactive et retourne la différence avec la valeur lue
+ * au départ.
+ *
+ * Le compteur est hérité par les threads créés après `counter_alloc`.
+ * Leurs événements ne sont ajoutés au compteur que quand ils se terminent,
+ * il faut donc les attendre avec `pthread_join` avant `counter_stop`.
+ * `PERF_EVENT_IOC_RESET` ne remettrait à zéro que le compteur du processus,
+ * pas les événements déjà ajoutés par les threads terminés : c'est pour ça
+ * qu'on soustrait la valeur de départ au lieu de remettre à zéro.
+ *
+ * Sans `<linux/perf_event.h>`, `counter_alloc` retourne toujours `NULL`.
+ *
+ * Le fabricant du processeur est vérifié avant d'ouvrir un événement brut
+ * défini pour un seul fabricant (`counter_alloc_raw`), comme dans
+ * `hw_prefetch_off` de prefetch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include "counter.h"
+
+struct counter {
+  int fd;
+  long long start; //!< valeur lue par `counter_start`
+};
+
+/**
+ * \brief Valeur courante de `c`, processus et threads terminés compris
+ *
+ * \return le nombre d'événements, -1 en cas d'erreur
+ */
+static long long counter_read (counter *c) {
+  long long value;
+  if (read(c->fd, &value, sizeof(value)) != sizeof(value)) {
+    perror("read");
+    return -1;
+  }
+  return value;
+}
+
+/**
+ * \brief Ouvre un compteur de l'événement `config` de type `type`
+ *
+ * \param type `PERF_TYPE_HARDWARE`, `PERF_TYPE_HW_CACHE` ou `PERF_TYPE_RAW`
+ * \return le compteur, ou `NULL` (avec un message sur `stderr`) si
+ *         l'événement n'est pas disponible
+ */
+counter *counter_alloc (unsigned int type, unsigned long long config) {
+#ifndef HAVE_LINUX_PERF_EVENT_H
+  fprintf(stderr, "perf_event_open(%u, 0x%llx) : pas disponible\n", type,
+      config);
+  return NULL;
+#else
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd == -1) {
+    fprintf(stderr, "perf_event_open(%u, 0x%llx) : ", type, config);
+    perror(NULL);
+    return NULL;
+  }
+  counter *c = (counter *) malloc(sizeof(counter));
+  if (c == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  c->fd = fd;
+  c->start = 0;
+  return c;
+#endif
+}
+
+/**
+ * \brief Indique si le processeur est de `vendor` ("intel" ou "amd")
+ */
+static int cpu_is_vendor (const char *vendor) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (strcmp(vendor, "intel") == 0) {
+    return __builtin_cpu_is("intel");
+  }
+  if (strcmp(vendor, "amd") == 0) {
+    return __builtin_cpu_is("amd");
+  }
+#endif
+  return 0;
+}
+
+/**
+ * \brief Alloue le compteur de l'événement brut `config` de `vendor`
+ *
+ * Retourne `NULL` si le processeur est d'un autre fabricant : le même code
+ * y compterait un autre événement. Sans vérification si `vendor` est `NULL`.
+ */
+counter *counter_alloc_raw (const char *vendor, unsigned long long config) {
+  if (vendor != NULL && !cpu_is_vendor(vendor)) {
+    fprintf(stderr, "perf_event_open(%u, 0x%llx) : événement %s, ignoré\n",
+        PERF_TYPE_RAW, config, vendor);
+    return NULL;
+  }
+  return counter_alloc(PERF_TYPE_RAW, config);
+}
+
+/**
+ * \brief Lit la valeur de départ de `c` et commence à compter
+ */
+void counter_start (counter *c) {
+  if (c == NULL) {
+    return;
+  }
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  c->start = counter_read(c);
+  ioctl(c->fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+/**
+ * \brief Arrête de compter
+ *
+ * \return le nombre d'événements depuis `counter_start`, -1 si `c` est `NULL`
+ */
+long counter_stop (counter *c) {
+  if (c == NULL) {
+    return -1;
+  }
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  ioctl(c->fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+  long long value = counter_read(c);
+  if (value < 0 || c->start < 0) {
+    return -1;
+  }
+  return (long) (value - c->start);
+}
+
+/**
+ * \brief Libère toutes les resources utilisées par `c`
+ */
+void counter_free (counter *c) {
+  if (c == NULL) {
+    return;
+  }
+  close(c->fd);
+  free(c);
+}
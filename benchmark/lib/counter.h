@@ -0,0 +1,88 @@
+#ifndef __COUNTER_H__
+#define __COUNTER_H__
+/*
+ * Compteurs matériels avec `perf_event_open`.
+ * Les événements du processus et de tous les threads créés après
+ * `counter_alloc` sont comptés, en mode utilisateur seulement.
+ * Si le compteur n'est pas disponible (noyau, machine virtuelle,
+ * `perf_event_paranoid`), `counter_alloc` retourne `NULL` et
+ * `counter_stop` retourne -1.
+ */
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#else
+/*
+ * Sans `perf_event_open` (macOS), `counter_alloc` retourne toujours `NULL`.
+ * Les constantes utilisées par les programmes gardent leur valeur Linux.
+ */
+enum { PERF_TYPE_HARDWARE = 0, PERF_TYPE_HW_CACHE = 3, PERF_TYPE_RAW = 4 };
+enum { PERF_COUNT_HW_BRANCH_MISSES = 5 };
+enum { PERF_COUNT_HW_CACHE_L1D = 0, PERF_COUNT_HW_CACHE_LL = 2,
+       PERF_COUNT_HW_CACHE_DTLB = 3 };
+enum { PERF_COUNT_HW_CACHE_OP_READ = 0 };
+enum { PERF_COUNT_HW_CACHE_RESULT_MISS = 1 };
+#endif
+
+/*
+ * Événement brut : `event` et `umask` viennent de la documentation du
+ * processeur (`perf list --details` les affiche).
+ */
+#define COUNTER_RAW(event, umask) (((umask) << 8) | (event))
+
+/*
+ * Un code brut ne vaut que pour le fabricant qui l'a défini : ailleurs il
+ * compte un autre événement. `<nom>_VENDOR` est ce fabricant ("intel",
+ * "amd"), ou `NULL` pour ne pas vérifier si l'événement est redéfini à la
+ * compilation pour le processeur utilisé.
+ */
+
+/*
+ * Chargements servis par une ligne modifiée dans le cache d'un autre coeur
+ * (MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM sur Intel depuis Skylake). Peut être
+ * redéfini à la compilation pour un autre processeur.
+ */
+#ifndef COUNTER_HITM
+#define COUNTER_HITM COUNTER_RAW(0xd2, 0x04)
+#define COUNTER_HITM_VENDOR "intel"
+#endif
+#ifndef COUNTER_HITM_VENDOR
+#define COUNTER_HITM_VENDOR NULL
+#endif
+
+/*
+ * Requêtes qui ratent le cache L2 (L2_RQSTS.MISS sur Intel depuis Skylake),
+ * il n'y a pas d'événement générique pour le L2.
+ */
+#ifndef COUNTER_L2_MISS
+#define COUNTER_L2_MISS COUNTER_RAW(0x24, 0x3f)
+#define COUNTER_L2_MISS_VENDOR "intel"
+#endif
+#ifndef COUNTER_L2_MISS_VENDOR
+#define COUNTER_L2_MISS_VENDOR NULL
+#endif
+
+/*
+ * Événement de cache générique, par exemple
+ * COUNTER_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+ *               PERF_COUNT_HW_CACHE_RESULT_MISS)
+ */
+#define COUNTER_CACHE(cache, op, result) \
+  ((cache) | ((op) << 8) | ((result) << 16))
+
+typedef struct counter counter;
+struct counter;
+
+counter *counter_alloc (unsigned int type, unsigned long long config);
+/*
+ * `counter_alloc(PERF_TYPE_RAW, config)`, mais retourne `NULL` si le
+ * processeur n'est pas de `vendor` (voir plus haut).
+ */
+counter *counter_alloc_raw (const char *vendor, unsigned long long config);
+
+void counter_start (counter *c);
+long counter_stop (counter *c);
+
+void counter_free (counter *c);
+
+#endif
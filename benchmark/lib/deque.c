@@ -0,0 +1,135 @@
+/**
+ * \file deque.c
+ * \brief deque de Chase-Lev pour répartir des tâches entre threads
+ *
+ * Chaque thread possède un `deque` dans lequel il ajoute et retire ses
+ * tâches par le bas (comme une pile) sans verrou. Quand il n'a plus de
+ * travail, il vole une tâche par le haut du `deque` d'un autre thread.
+ * Seul le vol et la dernière tâche nécessitent un `compare-and-swap`.
+ *
+ * C'est la version pour modèle mémoire faible de
+ * *Lê, Pop, Cohen et Zappa Nardelli*, "Correct and Efficient Work-Stealing
+ * for Weak Memory Models" (PPoPP 2013), avec les atomiques de C11.
+ * La capacité est fixée à l'allocation : `deque_push` échoue quand le
+ * `deque` est plein au lieu de l'agrandir.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "deque.h"
+
+/**
+ * \brief Tableau circulaire de `mask + 1` tâches
+ *
+ * `top` et `bottom` sont sur des lignes de cache différentes pour que
+ * les voleurs n'invalident pas la ligne du propriétaire.
+ */
+struct deque {
+  _Alignas(64) atomic_long top;
+  _Alignas(64) atomic_long bottom;
+  _Alignas(64) long mask;
+  _Atomic(void *) *buffer;
+};
+
+/**
+ * \brief Alloue un `deque` pouvant contenir `capacity` tâches
+ *
+ * `capacity` est arrondi à la puissance de 2 supérieure.
+ * En cas d'erreur, affiche un message sur `stderr` et `exit`
+ */
+deque *deque_alloc (long capacity) {
+  deque *d = (deque *) aligned_alloc(64, sizeof(deque));
+  if (d == NULL) {
+    perror("aligned_alloc");
+    exit(EXIT_FAILURE);
+  }
+  long size = 1;
+  while (size < capacity) {
+    size *= 2;
+  }
+  d->buffer = (_Atomic(void *) *) calloc(size, sizeof(_Atomic(void *)));
+  if (d->buffer == NULL) {
+    free(d);
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  d->mask = size - 1;
+  atomic_init(&d->top, 0);
+  atomic_init(&d->bottom, 0);
+  return d;
+}
+
+/**
+ * \brief Ajoute `item` en bas du `deque`, par le propriétaire uniquement
+ *
+ * \return 0 en cas de succès, -1 si le `deque` est plein
+ */
+int deque_push (deque *d, void *item) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&d->top, memory_order_acquire);
+  if (b - t > d->mask) {
+    return -1;
+  }
+  atomic_store_explicit(&d->buffer[b & d->mask], item, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  return 0;
+}
+
+/**
+ * \brief Retire la tâche du bas du `deque`, par le propriétaire uniquement
+ *
+ * \return la tâche ou `NULL` si le `deque` est vide
+ */
+void *deque_pop (deque *d) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+  void *item = NULL;
+  if (t <= b) {
+    item = atomic_load_explicit(&d->buffer[b & d->mask], memory_order_relaxed);
+    if (t == b) {
+      // dernière tâche : course avec les voleurs
+      if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed)) {
+        item = NULL;
+      }
+      atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+  } else {
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  }
+  return item;
+}
+
+/**
+ * \brief Vole la tâche du haut du `deque`, par n'importe quel thread
+ *
+ * \return la tâche ou `NULL` si le `deque` est vide ou si un autre
+ *         thread a pris la tâche en même temps
+ */
+void *deque_steal (deque *d) {
+  long t = atomic_load_explicit(&d->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+  if (t >= b) {
+    return NULL;
+  }
+  void *item = atomic_load_explicit(&d->buffer[t & d->mask],
+      memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+        memory_order_seq_cst, memory_order_relaxed)) {
+    return NULL;
+  }
+  return item;
+}
+
+/**
+ * \brief Libère toutes les resources utilisées par `d`
+ */
+void deque_free (deque *d) {
+  free(d->buffer);
+  free(d);
+}
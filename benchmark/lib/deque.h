@@ -0,0 +1,20 @@
+#ifndef __DEQUE_H__
+#define __DEQUE_H__
+/*
+ * Deque de Chase-Lev pour le vol de tâches (work-stealing).
+ * Seul le thread propriétaire peut appeler `deque_push` et `deque_pop`,
+ * les autres threads ne peuvent qu'appeler `deque_steal`.
+ */
+
+typedef struct deque deque;
+struct deque;
+
+deque *deque_alloc (long capacity);
+
+int deque_push (deque *d, void *item);
+void *deque_pop (deque *d);
+void *deque_steal (deque *d);
+
+void deque_free (deque *d);
+
+#endif
@@ -0,0 +1,231 @@
+/**
+ * \file prime.c
+ * \brief noyaux de décomposition en facteurs premiers
+ *
+ * Les benchmarks de parallélisation utilisent la décomposition en facteurs
+ * premiers comme charge de calcul. Ce fichier en propose plusieurs versions
+ * pour séparer le gain algorithmique du gain apporté par les threads :
+ * * `naive` : division par tous les entiers jusqu'à `n`;
+ * * `sqrt` : division jusqu'à la racine carrée du reste;
+ * * `wheel` : comme `sqrt` mais en sautant les multiples de 2, 3 et 5
+ *   (roue de 30, 8 candidats sur 30);
+ * * `sieve` : table du plus petit facteur premier construite une fois par
+ *   un crible, la décomposition ne fait plus aucune division;
+ * * `simd` : comme `sqrt` mais en testant 4 diviseurs impairs à la fois
+ *   avec AVX2. Il n'y a pas de division entière vectorielle, on divise donc
+ *   en `double`, ce qui est exact pour des `int`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "prime.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PRIME_HAVE_AVX2
+#endif
+
+/**
+ * \brief Décomposition par force brute
+ *
+ * Après chaque facteur trouvé, on reteste le même diviseur (`i--`).
+ */
+int prime_factors_naive (int n) {
+  int i, count = 0;
+  for (i = 2; i <= n; i++) {
+    if (n % i == 0) {
+      count++;
+      n = n / i;
+      i--;
+      if (n == 1) {
+        break;
+      }
+    }
+  }
+  return count;
+}
+
+/**
+ * \brief Division jusqu'à la racine carrée
+ *
+ * Quand `i * i > n`, le reste `n` n'a plus de diviseur inférieur à sa
+ * racine : c'est un nombre premier.
+ */
+int prime_factors_sqrt (int n) {
+  int i, count = 0;
+  for (i = 2; (long) i * i <= n; i++) {
+    while (n % i == 0) {
+      count++;
+      n = n / i;
+    }
+  }
+  return count + (n > 1);
+}
+
+/**
+ * \brief Écarts entre les entiers premiers avec 30, à partir de 7
+ */
+static const int wheel[8] = {4, 2, 4, 2, 4, 6, 2, 6};
+
+/**
+ * \brief Division par 2, 3, 5 puis par les candidats de la roue de 30
+ */
+int prime_factors_wheel (int n) {
+  int count = 0;
+  while (n > 1 && n % 2 == 0) {
+    count++;
+    n /= 2;
+  }
+  while (n > 1 && n % 3 == 0) {
+    count++;
+    n /= 3;
+  }
+  while (n > 1 && n % 5 == 0) {
+    count++;
+    n /= 5;
+  }
+  int i = 7, w = 0;
+  while ((long) i * i <= n) {
+    while (n % i == 0) {
+      count++;
+      n /= i;
+    }
+    i += wheel[w];
+    w = (w + 1) & 7;
+  }
+  return count + (n > 1);
+}
+
+static int *spf = NULL;
+static int spf_max = 0;
+
+/**
+ * \brief Construit la table du plus petit facteur premier de `0..max`
+ *
+ * Crible linéaire : chaque composé est barré une seule fois, par son plus
+ * petit facteur premier. À appeler avant de lancer les threads, la table
+ * n'est ensuite plus que lue.
+ * En cas d'erreur, affiche un message sur `stderr` et `exit`
+ */
+void prime_sieve_init (int max) {
+  int i, j, nprimes = 0;
+  int *primes = (int *) malloc(sizeof(int) * (max + 1));
+  prime_sieve_free();
+  spf = (int *) calloc(max + 1, sizeof(int));
+  if (spf == NULL || primes == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 2; i <= max; i++) {
+    if (spf[i] == 0) {
+      spf[i] = i;
+      primes[nprimes++] = i;
+    }
+    for (j = 0; j < nprimes && primes[j] <= spf[i]
+        && (long) i * primes[j] <= max; j++) {
+      spf[i * primes[j]] = primes[j];
+    }
+  }
+  spf_max = max;
+  free(primes);
+}
+
+/**
+ * \brief Libère la table construite par `prime_sieve_init`
+ */
+void prime_sieve_free (void) {
+  free(spf);
+  spf = NULL;
+  spf_max = 0;
+}
+
+/**
+ * \brief Décomposition avec la table du plus petit facteur premier
+ *
+ * Les nombres plus grands que la table passent par `prime_factors_wheel`.
+ */
+int prime_factors_sieve (int n) {
+  if (n > spf_max) {
+    return prime_factors_wheel(n);
+  }
+  int count = 0;
+  while (n > 1) {
+    n /= spf[n];
+    count++;
+  }
+  return count;
+}
+
+#ifdef PRIME_HAVE_AVX2
+/**
+ * \brief Teste les diviseurs impairs `d, d+2, d+4, d+6` en une fois
+ *
+ * Pour des entiers inférieurs à 2^31, `floor(n / d)` calculé en `double`
+ * est le quotient exact, et `n - q * d` est nul si et seulement si `d`
+ * divise `n`. Dès qu'un des 4 candidats divise `n`, on divise par le plus
+ * petit puis on reteste le même groupe.
+ */
+__attribute__((target("avx2")))
+static int prime_factors_avx2 (int n) {
+  int count = 0;
+  while (n > 1 && n % 2 == 0) {
+    count++;
+    n /= 2;
+  }
+  const __m256d step = _mm256_set_pd(6, 4, 2, 0);
+  const __m256d zero = _mm256_setzero_pd();
+  int d = 3;
+  while ((long) d * d <= n) {
+    __m256d div = _mm256_add_pd(_mm256_set1_pd(d), step);
+    __m256d num = _mm256_set1_pd(n);
+    __m256d q = _mm256_floor_pd(_mm256_div_pd(num, div));
+    __m256d r = _mm256_sub_pd(num, _mm256_mul_pd(q, div));
+    int mask = _mm256_movemask_pd(_mm256_cmp_pd(r, zero, _CMP_EQ_OQ));
+    if (mask == 0) {
+      d += 8;
+      continue;
+    }
+    int f = d + 2 * __builtin_ctz(mask);
+    while (n % f == 0) {
+      count++;
+      n /= f;
+    }
+  }
+  return count + (n > 1);
+}
+#endif
+
+/**
+ * \brief Version vectorielle, `prime_factors_sqrt` si AVX2 n'est pas
+ *        disponible sur le processeur
+ */
+int prime_factors_simd (int n) {
+#ifdef PRIME_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    return prime_factors_avx2(n);
+  }
+#endif
+  return prime_factors_sqrt(n);
+}
+
+const prime_kernel_desc prime_kernels[PRIME_NKERNELS] = {
+  {"naive", prime_factors_naive},
+  {"sqrt", prime_factors_sqrt},
+  {"wheel", prime_factors_wheel},
+  {"sieve", prime_factors_sieve},
+  {"simd", prime_factors_simd},
+};
+
+/**
+ * \brief Retourne le noyau nommé `name` ou `NULL` s'il n'existe pas
+ */
+prime_kernel prime_kernel_find (const char *name) {
+  int i;
+  for (i = 0; i < PRIME_NKERNELS; i++) {
+    if (strcmp(prime_kernels[i].name, name) == 0) {
+      return prime_kernels[i].fun;
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef __PRIME_H__
+#define __PRIME_H__
+/*
+ * Décomposition en facteurs premiers avec différents algorithmes.
+ * Chaque noyau retourne le nombre de facteurs premiers de `n` comptés
+ * avec leur multiplicité (0 pour `n < 2`).
+ */
+
+typedef int (*prime_kernel) (int n);
+
+int prime_factors_naive (int n);
+int prime_factors_sqrt (int n);
+int prime_factors_wheel (int n);
+int prime_factors_sieve (int n);
+int prime_factors_simd (int n);
+
+void prime_sieve_init (int max);
+void prime_sieve_free (void);
+
+/**
+ * \brief Un noyau et son nom, pour le choisir en ligne de commande
+ */
+typedef struct prime_kernel_desc {
+  const char *name;
+  prime_kernel fun;
+} prime_kernel_desc;
+
+#define PRIME_NKERNELS 5
+extern const prime_kernel_desc prime_kernels[PRIME_NKERNELS];
+
+prime_kernel prime_kernel_find (const char *name);
+
+#endif
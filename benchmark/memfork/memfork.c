@@ -1,150 +1,186 @@
 /**
 	\file memfork.c
-	\brief Ce programme compare le temps nécessaire pour effectuer le "copy-on-write"
+	\brief Ce programme mesure le coût du "copy-on-write" après un fork
 
-	Pour cela, nous allons donc faire un fork, modifier deux fois les données dans le fils et comparer la différence entre les deux.
-	Cette différence représente le temps nécessaire au copy-on-write.
+	Le père alloue une seule zone contiguë avec `mmap`, la remplit pour que toutes les pages soient présentes puis fait un fork. Le fils garde la mémoire partagée (comme un snapshot) pendant que le père en modifie une fraction : chaque première écriture dans une page partagée provoque une faute de page et une copie.
 
-	Dans le cas de l'utilisation de perf, on ne réécrit pas dans les records et n'effectue une seule des deux modifications. Dans ce cas la, on fait le perf sur la taille maximun
+	On fait varier
+		* la fraction de la zone modifiée (de 10% à 100%);
+		* le pas : un seul byte par page ou la page entière;
+		* les transparent hugepages : `madvise(MADV_HUGEPAGE)` ou `MADV_NOHUGEPAGE` (Linux seulement, ailleurs les deux cas sont identiques).
+
+	Le nombre de fautes de page est lu avec `memstat` (`lib/benchmark.c`) avant et après les écritures et le temps est divisé par ce nombre pour avoir le coût d'une faute. Les colonnes suivantes de `memfork-<cas>.csv` donnent aussi le RSS, le PSS et les transparent hugepages du père à la fin des écritures, pendant que le fils partage encore la zone : le PSS compte une page partagée pour moitié, et remonte à mesure que le père copie les pages. Les deux dernières colonnes donnent la variation du PSS et des THP pendant les écritures.
+	Le père et le fils se synchronisent avec un pipe : le fils bloque sur `read` jusqu'à ce que le père ferme le pipe après ses mesures.
+
+	Dans le cas de l'utilisation de perf (`--thp` ou `--nothp`), on n'écrit pas dans les records et on ne fait qu'une écriture de toute la zone page par page.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <string.h>
-#include <semaphore.h>
-#include <pthread.h>
+#include <unistd.h>
 
-#include "../lib/benchmark.c"
-#include "../lib/benchmark.h"
+#include "benchmark.h"
 
-#define N 10000
-#define MULTIPLICATEUR 1024
+#define SIZE 0x4000000 // 64 MiB
+#define HUGE_SIZE 0x200000 // 2 MiB, alignement nécessaire pour les hugepages
+#define STEP 10 // pas de la fraction modifiée en %
 
-timer *t;
-recorder* bftfork_rec;
-recorder* aftfork_rec;
-recorder* aftmodif_rec;
+#define STRIDE_BYTE 0 // un byte par page
+#define STRIDE_PAGE 1 // toute la page
 
 /**
-	Parcours un tableau et calcul le temps nécessaire
+	\brief Alloue une zone de `SIZE` bytes alignée sur `HUGE_SIZE` et la remplit
+
+	\param thp si vrai, demande des transparent hugepages avec `madvise`, sinon les interdit
 */
-long int parcoursTab(timer* t, int i, char** tab) {
-
-	int j, k, res;
-	start_timer(t);
-	for(j=0; j<i; j++)
-		for(k=0; k<i; k++) {
-			res +=tab[j][k];
-			tab[j][k]=j+k;
-		}
-	return stop_timer(t);
+char* alloc_zone(int thp) {
+	char *raw = mmap(NULL, SIZE + HUGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	// On libère le début et la fin pour garder une zone alignée
+	char *zone = (char*) (((unsigned long) raw + HUGE_SIZE - 1) & ~((unsigned long) HUGE_SIZE - 1));
+	if (zone > raw)
+		munmap(raw, zone - raw);
+	munmap(zone + SIZE, raw + HUGE_SIZE - zone);
+
+#ifdef MADV_HUGEPAGE
+	if (madvise(zone, SIZE, thp ? MADV_HUGEPAGE : MADV_NOHUGEPAGE) == -1)
+		perror("madvise");
+#endif
+
+	memset(zone, 1, SIZE);
+	return zone;
 }
 
+/**
+	\brief Écrit dans les `pages` premières pages de `zone` suivant `stride`
+*/
+void write_zone(char *zone, long pages, long page_size, int stride) {
+	long j;
+	if (stride == STRIDE_BYTE) {
+		for (j = 0; j < pages; j++)
+			zone[j * page_size] = (char) j;
+	} else {
+		for (j = 0; j < pages; j++)
+			memset(zone + j * page_size, (char) j, page_size);
+	}
+}
 
-int main (int argc, char *argv[])  {
-	// Regarde les arguments
-	int perfbft = argc>1 && strncmp(argv[1], "--before", 9);
-	int perfaft = argc>1 &&strncmp(argv[1], "--after", 8);
-
+/**
+	\brief Mesure les écritures du père pendant que le fils garde la zone partagée
 
-	if((!perfbft) && !perfaft) {
-		// Déclare un timer, ainsi que deux recorder qui vont contenir les résultats de l'exécution du programme
-		t = timer_alloc();
-		bftfork_rec = recorder_alloc("memfor-beforefork.csv");
-	 	aftfork_rec = recorder_alloc("memfor-aftfork.csv");
-		aftmodif_rec = recorder_alloc("memfor-aftmodif.csv");
+	\param pct le pourcentage de la zone à modifier
+	\param time si non `NULL`, on y met le temps des écritures
+	\param mem reçoit les fautes de page et la mémoire du père pendant les écritures
+	\return le nombre de fautes de page pendant les écritures
+*/
+long cow(timer *t, char *zone, int pct, int stride, long *time, memstat *mem) {
+	long page_size = sysconf(_SC_PAGESIZE);
+	long pages = (SIZE / page_size) * pct / 100;
+	int fd[2];
+	char c;
+
+	if (pipe(fd) == -1) {
+		perror("pipe");
+		exit(EXIT_FAILURE);
 	}
 
-	pid_t pid;
-	int status, i, j;
-	long int resultbft, resultaft;
-	for (i = MULTIPLICATEUR; i < N; i+=MULTIPLICATEUR) {
+	pid_t pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		// processus fils : garde la zone jusqu'à ce que le père ferme le pipe
+		close(fd[1]);
+		while (read(fd[0], &c, 1) > 0);
+		_exit(EXIT_SUCCESS);
+	}
+	close(fd[0]);
+
+	memstat_reset(mem);
+	memstat_start(mem);
+	if (time != NULL)
+		start_timer(t);
+	write_zone(zone, pages, page_size, stride);
+	if (time != NULL)
+		*time = stop_timer(t);
+	memstat_stop(mem);
+
+	// libère le fils
+	close(fd[1]);
+	if (waitpid(pid, NULL, 0) == -1) {
+		perror("waitpid");
+		exit(EXIT_FAILURE);
+	}
+	return mem->minflt;
+}
 
-		if(perfaft || perfbft)
-			i = N;
+/**
+	\brief Mesure une configuration pour toutes les fractions de 10% à 100%
 
-		char ** tab = malloc(i*sizeof(char*));
-		if(tab == NULL) {
-			perror("malloc fail");
+	Une nouvelle zone est allouée à chaque fois pour que toutes ses pages soient de nouveau partagées au moment du fork.
+*/
+void benchmark_cow(timer *t, int stride, int thp, recorder *cost_rec, recorder *faults_rec) {
+	int pct;
+	long time, faults;
+	memstat mem;
+	for (pct = STEP; pct <= 100; pct += STEP) {
+		char *zone = alloc_zone(thp);
+		faults = cow(t, zone, pct, stride, &time, &mem);
+		write_record_mem(cost_rec, pct, time, faults > 0 ? faults : 1, &mem);
+		write_value(faults_rec, pct, faults);
+		if (munmap(zone, SIZE) == -1) {
+			perror("munmap");
 			exit(EXIT_FAILURE);
 		}
-		for(j=0; j<i; j++)
-			tab[j] = malloc(i*sizeof(char));
-
-
-		// On le parcours une fois avant le fork pour avoir une mesure de référence
-		if( !perfbft && !perfaft)
-			write_record(bftfork_rec, i/MULTIPLICATEUR, parcoursTab(t, i, tab));
-
-
-		pid = fork();
-
-		if (pid == -1) {
-			// erreur à l'exécution de fork
-			perror("fork");
-			return EXIT_FAILURE;
-		}
-		if (pid == 0) {
-			// processus fils
-			sleep(1);
-
-			// On le parcours lors du copy-on-write
-			if(!perfaft)
-				resultbft = parcoursTab(t, i, tab);
-
-			sleep(1);
-
-			// On le parcours apres le copy-on-write
-			if(! perfbft)
-				resultaft = parcoursTab(t, i, tab);
-
-
-			if(!perfbft && !perfaft) {
-				write_record(aftfork_rec, i/MULTIPLICATEUR, resultbft);
-				write_record(aftmodif_rec, i/MULTIPLICATEUR, resultaft);
-			}
-
-			// Libération du tableau et des records si ils sont alloués
-			if(!perfbft && !perfaft) {
-			      	recorder_free(bftfork_rec);
-			  	recorder_free(aftfork_rec);
-				recorder_free(aftmodif_rec);
-				timer_free(t);
-			}
-
-			free(tab);
-			tab=NULL;
-			for(j=0; j<i; j++) {
-				free(tab[j]);
-				tab[j]=NULL;
-			}
-
-		      	return EXIT_SUCCESS;
-		}
-		else {
-		     	// processus père
-		      	pid = waitpid(pid, &status, 0);
-			
-
-		      	if (pid == -1) {
-				perror("wait");
-				return EXIT_FAILURE;
-		      	}
-		}
-		
-		
 	}
+}
 
-	// Libération du tableau et des records si ils sont alloués
-	if(!perfbft && !perfaft) {
-		recorder_free(bftfork_rec);
-	  	recorder_free(aftfork_rec);
-		recorder_free(aftmodif_rec);
-		timer_free(t);
+int main (int argc, char *argv[])  {
+	// Regarde les arguments
+	int perfthp = argc>1 && strncmp(argv[1], "--thp", 6) == 0;
+	int perfnothp = argc>1 && strncmp(argv[1], "--nothp", 8) == 0;
+
+	if (perfthp || perfnothp) {
+		memstat mem;
+		char *zone = alloc_zone(perfthp);
+		printf("%ld fautes de page\n", cow(NULL, zone, 100, STRIDE_PAGE, NULL, &mem));
+		munmap(zone, SIZE);
+		return EXIT_SUCCESS;
 	}
 
-
-  return EXIT_SUCCESS;
+	// Déclare un timer ainsi que les records qui vont contenir les résultats de l'exécution du programme
+	timer *t = timer_alloc();
+	recorder *byte_rec = recorder_alloc("memfork-byte.csv");
+	recorder *byte_faults_rec = recorder_alloc("memfork-byte-faults.csv");
+	recorder *page_rec = recorder_alloc("memfork-page.csv");
+	recorder *page_faults_rec = recorder_alloc("memfork-page-faults.csv");
+	recorder *byte_thp_rec = recorder_alloc("memfork-byte-thp.csv");
+	recorder *byte_thp_faults_rec = recorder_alloc("memfork-byte-thp-faults.csv");
+	recorder *page_thp_rec = recorder_alloc("memfork-page-thp.csv");
+	recorder *page_thp_faults_rec = recorder_alloc("memfork-page-thp-faults.csv");
+
+	benchmark_cow(t, STRIDE_BYTE, 0, byte_rec, byte_faults_rec);
+	benchmark_cow(t, STRIDE_PAGE, 0, page_rec, page_faults_rec);
+	benchmark_cow(t, STRIDE_BYTE, 1, byte_thp_rec, byte_thp_faults_rec);
+	benchmark_cow(t, STRIDE_PAGE, 1, page_thp_rec, page_thp_faults_rec);
+
+	recorder_free(byte_rec);
+	recorder_free(byte_faults_rec);
+	recorder_free(page_rec);
+	recorder_free(page_faults_rec);
+	recorder_free(byte_thp_rec);
+	recorder_free(byte_thp_faults_rec);
+	recorder_free(page_thp_rec);
+	recorder_free(page_thp_faults_rec);
+	timer_free(t);
+
+	return EXIT_SUCCESS;
 }
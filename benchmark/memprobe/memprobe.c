@@ -0,0 +1,324 @@
+/**
+ * \file memprobe.c
+ * \brief Bande passante et latence de la hiérarchie mémoire
+ *
+ * Deux mesures servent de référence pour les autres benchmarks :
+ * * la bande passante avec les quatre noyaux de STREAM sur des tableaux de
+ *   `double` bien plus grands que le dernier niveau de cache :
+ *   `copy` (`a = b`), `scale` (`a = s b`), `add` (`a = b + c`) et
+ *   `triad` (`a = b + s c`), pour 1 thread jusqu'à un thread par CPU.
+ *   Comme STREAM, on compte les bytes lus et écrits par le programme
+ *   (16 ou 24 par élément), sans la lecture de la ligne de destination
+ *   avant son écriture (write-allocate);
+ * * la latence en suivant une chaîne de pointeurs (pointer chasing) dans
+ *   un tableau de 4 KiB à `MAX_SIZE` : chaque chargement dépend du
+ *   précédent, et l'ordre aléatoire des lignes de cache empêche le
+ *   préchargement. Le temps par chargement monte par paliers à chaque
+ *   niveau de cache dépassé (L1, L2, LLC puis mémoire). Au-delà de la
+ *   couverture du TLB, il inclut aussi le parcours des tables de pages.
+ *
+ * On enregistre
+ * * dans `<noyau>.csv` la meilleure bande passante sur `NTIMES` essais,
+ *   en MB/s, en fonction du nombre de threads;
+ * * dans `latency.csv` le temps pour 1000 chargements en ns (soit des ps
+ *   par chargement), en fonction de la taille du tableau en KiB.
+ *
+ * La taille maximale du pointer chasing est de 4 GiB, pour dépasser la
+ * couverture du TLB, mais au plus la moitié de la mémoire physique : le
+ * tableau et l'ordre de ses lignes prennent 1,125 fois sa taille.
+ * `-m <MiB>` la change.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "benchmark.h"
+
+#define STREAM_LEN (64L << 20) //!< Éléments par tableau (512 MiB)
+#define NTIMES 5
+#define SCALAR 3.0
+#define MAX_SIZE (4L << 30) //!< Taille maximale par défaut du pointer chasing
+#define MIN_SIZE 4096
+#define LOADS (1L << 23) //!< Chargements par mesure de latence
+#define LINE 64
+#define MAX_THREADS 256
+
+/**
+ * \brief Un noyau de STREAM et le nombre de bytes qu'il déplace par élément
+ */
+typedef struct kernel {
+  const char *name;
+  void (*run)(double *a, const double *b, const double *c, long first,
+      long last);
+  int bytes;
+} kernel;
+
+void copy (double *a, const double *b, const double *c, long first,
+    long last) {
+  long i;
+  for (i = first; i < last; i++) {
+    a[i] = b[i];
+  }
+}
+
+void scale (double *a, const double *b, const double *c, long first,
+    long last) {
+  long i;
+  for (i = first; i < last; i++) {
+    a[i] = SCALAR * b[i];
+  }
+}
+
+void add (double *a, const double *b, const double *c, long first,
+    long last) {
+  long i;
+  for (i = first; i < last; i++) {
+    a[i] = b[i] + c[i];
+  }
+}
+
+void triad (double *a, const double *b, const double *c, long first,
+    long last) {
+  long i;
+  for (i = first; i < last; i++) {
+    a[i] = b[i] + SCALAR * c[i];
+  }
+}
+
+static const kernel kernels[] = {
+  {"copy", copy, 2 * sizeof(double)},
+  {"scale", scale, 2 * sizeof(double)},
+  {"add", add, 3 * sizeof(double)},
+  {"triad", triad, 3 * sizeof(double)},
+};
+
+#define NKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+typedef struct args {
+  const kernel *k; //!< `NULL` pour initialiser les tableaux
+  double *a, *b, *c;
+  long first, last;
+  int cpu;
+  pthread_barrier_t *barrier;
+} args;
+
+/**
+ * \brief Fixe le thread sur son CPU puis applique le noyau à sa tranche
+ */
+void *stream (void *param) {
+  args *a = (args *) param;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(a->cpu, &set);
+  sched_setaffinity(0, sizeof(set), &set);
+
+  pthread_barrier_wait(a->barrier);
+  if (a->k == NULL) {
+    long i;
+    for (i = a->first; i < a->last; i++) {
+      a->a[i] = 0;
+      a->b[i] = 1;
+      a->c[i] = 2;
+    }
+  } else {
+    a->k->run(a->a, a->b, a->c, a->first, a->last);
+  }
+  return NULL;
+}
+
+/**
+ * \brief Applique `k` sur les tableaux avec `nthreads` threads
+ *
+ * \return le temps entre le départ des threads et la fin du dernier
+ */
+long run (timer *t, const kernel *k, double *a, double *b, double *c,
+    int nthreads, int ncpu) {
+  pthread_t threads[MAX_THREADS];
+  args arg[MAX_THREADS];
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, nthreads + 1);
+  long chunk = (STREAM_LEN / nthreads + 7) / 8 * 8;
+  int i;
+  for (i = 0; i < nthreads; i++) {
+    arg[i].k = k;
+    arg[i].a = a;
+    arg[i].b = b;
+    arg[i].c = c;
+    arg[i].first = i * chunk < STREAM_LEN ? i * chunk : STREAM_LEN;
+    arg[i].last = (i + 1) * chunk < STREAM_LEN ? (i + 1) * chunk : STREAM_LEN;
+    arg[i].cpu = i % ncpu;
+    arg[i].barrier = &barrier;
+    if (pthread_create(&threads[i], NULL, stream, &arg[i]) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+  pthread_barrier_wait(&barrier);
+  start_timer(t);
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  long time = stop_timer(t);
+  pthread_barrier_destroy(&barrier);
+  return time;
+}
+
+/**
+ * \brief Une ligne de cache qui contient l'adresse de la suivante
+ */
+typedef struct line {
+  struct line *next;
+  char pad[LINE - sizeof(struct line *)];
+} line;
+
+/**
+ * \brief Relie les `n` lignes de `lines` en un seul cycle aléatoire
+ *
+ * L'algorithme de Sattolo tire une permutation qui n'a qu'un cycle : la
+ * chaîne passe par toutes les lignes avant de revenir au départ.
+ */
+void shuffle (line *lines, long n) {
+  long *order = (long *) malloc(sizeof(long) * n);
+  if (order == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  long i;
+  for (i = 0; i < n; i++) {
+    order[i] = i;
+  }
+  for (i = n - 1; i > 0; i--) {
+    long j = ((long) random() << 31 | random()) % i;
+    long tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+  for (i = 0; i < n; i++) {
+    lines[i].next = &lines[order[i]];
+  }
+  free(order);
+}
+
+/**
+ * \brief Suit `LOADS` pointeurs dans un tableau de `size` bytes
+ *
+ * \return le temps total
+ */
+long chase (timer *t, long size) {
+  long n = size / LINE;
+  line *lines = (line *) aligned_alloc(LINE, n * sizeof(line));
+  if (lines == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  shuffle(lines, n);
+
+  // un premier tour pour charger le tableau dans le cache s'il y tient
+  line *p = lines;
+  long i;
+  for (i = 0; i < n; i++) {
+    p = p->next;
+  }
+  start_timer(t);
+  for (i = 0; i < LOADS; i++) {
+    p = p->next;
+  }
+  long time = stop_timer(t);
+  // `p` est utilisé pour que le compilateur garde la boucle
+  if (p == NULL) {
+    fprintf(stderr, "chaîne cassée\n");
+    exit(EXIT_FAILURE);
+  }
+  free(lines);
+  return time;
+}
+
+int main (int argc, char *argv[]) {
+  long max_size = MAX_SIZE;
+  long phys = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+  if (phys > 0 && max_size > phys / 2) {
+    max_size = phys / 2;
+  }
+  int i;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      max_size = atol(argv[++i]) << 20;
+    } else {
+      fprintf(stderr, "usage: %s [-m <MiB>]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpu < 1) {
+    ncpu = 1;
+  }
+  if (ncpu > MAX_THREADS) {
+    ncpu = MAX_THREADS;
+  }
+
+  timer *t = timer_alloc();
+
+  double *a = (double *) aligned_alloc(LINE, STREAM_LEN * sizeof(double));
+  double *b = (double *) aligned_alloc(LINE, STREAM_LEN * sizeof(double));
+  double *c = (double *) aligned_alloc(LINE, STREAM_LEN * sizeof(double));
+  if (a == NULL || b == NULL || c == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  // premier accès par tous les CPUs, pour répartir les pages entre les
+  // noeuds NUMA comme le feront les mesures
+  run(t, NULL, a, b, c, ncpu, ncpu);
+
+  unsigned int k;
+  recorder *rec[NKERNELS];
+  for (k = 0; k < NKERNELS; k++) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s.csv", kernels[k].name);
+    rec[k] = recorder_alloc(name);
+  }
+  int n;
+  for (n = 1; ; n = (n * 2 > ncpu && n < ncpu) ? ncpu : n * 2) {
+    for (k = 0; k < NKERNELS; k++) {
+      long best = -1;
+      int r;
+      for (r = 0; r < NTIMES; r++) {
+        long time = run(t, &kernels[k], a, b, c, n, ncpu);
+        if (best == -1 || time < best) {
+          best = time;
+        }
+      }
+      write_value(rec[k], n,
+          kernels[k].bytes * STREAM_LEN * 1000 / (best > 0 ? best : 1));
+    }
+    printf("stream %d threads\n", n);
+    if (n >= ncpu) {
+      break;
+    }
+  }
+  for (k = 0; k < NKERNELS; k++) {
+    recorder_free(rec[k]);
+  }
+  free(a);
+  free(b);
+  free(c);
+
+  // deux tailles par octave : 4, 6, 8, 12, 16 KiB...
+  recorder *lat_rec = recorder_alloc("latency.csv");
+  long size;
+  for (size = MIN_SIZE; size <= max_size; size *= 2) {
+    long s;
+    for (s = size; s <= max_size && s < 2 * size; s += size / 2) {
+      write_record_n(lat_rec, s / 1024, chase(t, s), LOADS / 1000);
+    }
+    printf("chase %ld KiB\n", size / 1024);
+  }
+  recorder_free(lat_rec);
+
+  timer_free(t);
+  return EXIT_SUCCESS;
+}
@@ -1,199 +1,359 @@
 /**
 	\file mutsem.c
-	\brief Ce programme compare le temps nécessaire pour lock/unlock avec un mutex et celui pour wait/post avec une sémaphore
+	\brief Ce programme compare la latence d'un passage de relais entre threads avec différents mécanismes d'attente et de notification
 
-	Pour cela, nous allons créer une chaîne de thread ayant chacun un mutex et une sémaphore "personnelle". Pour un nombre "N" donné, nous allons lancer "N" thread où chaque thread bloquera son mutex et sa sémaphore. Chaque thread attendra ensuite que le thread précédent ait débloqué son mutex/sémaphore, pour à son tour débloqué le sien. Parmis ces threads, il y a un thread spécial : le **first**.  Celui ci est chargé de débloqué en premier son mutex/sémaphore et de calculé le temps que cela prend pour lui revenir.
+	On crée un anneau de `N` threads. Chaque thread a un `slot` d'entrée, qui est le `slot` de sortie du thread précédent. Un thread attend d'être notifié sur son `slot` d'entrée puis notifie son `slot` de sortie : c'est un saut. Le thread **first** lance le relais et compte les tours.
 
 	En schéma :
 
-	+-------+	+-------+			+-------+	+-------+
-	| first	|	| oth 1	|	  ...		| oth 2	| 	| oth N	| 
-	+-------+	+-------+			+-------+	+-------+
-	  |   ^___________|  ^____________|  ^____________|  ^____________|   ^
-	  |	   (1)		   (2)		   	  (3)		      |
-	  |						      		      |
-	  |___________________________________________________________________|
-				   (1)         			
-
-
-	(1) : first unlock son mut1, ce qui permet à oth N de lock son mut2 (puisqu'ils pointent vers le même mutex)
-	(2) : Puisque oth 1 a pu locker son mut2, il unlock son mut1
-	(3) : La chaîne continue
-	(4) : Lorsque first peut enfin faire un lock sur son mut2, il arrete le timer et écrit dans le record
-
+	+-------+  slot 1   +-------+  slot 2       slot N-1  +-------+
+	| first | --------> | oth 1 | --------> ... --------> | oth N |
+	+-------+           +-------+                         +-------+
+	    ^                                                     |
+	    |_____________________________________________________|
+	                            slot 0
+
+	Chaque mécanisme est un sémaphore binaire correct : seul le thread qui a attendu consomme la notification et aucun verrou n'est libéré par un autre thread que celui qui l'a pris.
+		* `sem` : `sem_wait`/`sem_post`;
+		* `cond` : un drapeau protégé par un mutex et une variable de condition;
+		* `futex` : un entier et les appels système `FUTEX_WAIT`/`FUTEX_WAKE`;
+		* `eventfd` : `read`/`write` sur un `eventfd`;
+		* `spin` : le thread tourne `SPIN` fois sur l'entier avant de s'endormir sur un futex, et celui qui notifie ne fait `FUTEX_WAKE` que si le thread s'est endormi.
+
+	Après `WARMUP` tours pour que tous les threads soient lancés, on mesure `LAPS` tours. Le temps total divisé par le nombre de sauts donne le temps moyen d'un saut. De plus, chaque thread note l'heure (`clock_gettime`) juste avant de notifier et le suivant calcule la latence du saut dès qu'il est réveillé. Ces latences sont rangées dans un histogramme par puissances de 2 pour en tirer la médiane et le 99e percentile.
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
-#include <fcntl.h>
 #include <string.h>
-#include <semaphore.h>	
+#include <stdint.h>
+#include <time.h>
+#include <semaphore.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "benchmark.h"
 
-#define MAX_SIZE 3
-#define TURN 100000000
+#define MIN_RING 2	// taille du plus petit anneau
+#define MAX_RING 32	// taille du plus grand anneau
+#define HIST_RING 2	// anneau pour lequel on écrit l'histogramme complet
+#define LAPS 10000	// tours mesurés
+#define WARMUP 1000	// tours de mise en route, non mesurés
+#define SPIN 200	// itérations d'attente active avant de s'endormir
+#define NBUCKETS 40	// cases de l'histogramme : [2^b, 2^(b+1)[ ns
 
-//Time by default (4)
-
-timer *t;
-int i;
-recorder *sem_rec;
-recorder *mut_rec;
+/**
+	\brief Point de passage entre deux threads de l'anneau
 
-#define MULTIPLICATEUR 1000
-#define NUMBER_THREAD 10000
+	Tous les mécanismes sont initialisés, chacun n'utilise que les siens. `stamp` est écrit avant la notification et lu après le réveil, la notification sert donc aussi de barrière mémoire.
+*/
+typedef struct slot {
+	_Alignas(64) atomic_int word;	// `futex` : 0 ou 1, `spin` : -1 si le thread dort
+	sem_t sem;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int flag;
+	int efd;
+	long stamp;	// heure de la notification en ns
+} slot;
 
 /**
-	\brief Structure utilisé pour stocker deux mutex et deux sémaphores
-
-	Cette structure est utilisée dans le cadre des tests comparant le temps de lock/unlock contre celui de wait/post
+	\brief Un mécanisme d'attente et de notification
 */
-struct arg { 
-	pthread_mutex_t * mut1;
-	pthread_mutex_t * mut2;
-	sem_t * sem1;
-	sem_t * sem2;
-};
+typedef struct mechanism {
+	const char *name;
+	void (*wait)(slot *s);
+	void (*post)(slot *s);
+} mechanism;
 
 /**
-	\brief Fonction threader permettant de lancer la chaine des lock/unlock puis des wait/post.
+	\brief Heure en ns de l'horloge monotone
+*/
+static inline long now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static long futex(atomic_int *addr, int op, int val) {
+	return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+void sem_wait_slot(slot *s) {
+	while (sem_wait(&s->sem) == -1);	// recommence si interrompu
+}
+
+void sem_post_slot(slot *s) {
+	sem_post(&s->sem);
+}
 
-	Cette fonction lance donc la chaîne et calcul le temps qu'il faut pour la parcourir completement.
-	Une fois les temps calculé, ils sont stocké dans les records
+void cond_wait_slot(slot *s) {
+	pthread_mutex_lock(&s->mutex);
+	while (!s->flag)
+		pthread_cond_wait(&s->cond, &s->mutex);
+	s->flag = 0;
+	pthread_mutex_unlock(&s->mutex);
+}
+
+void cond_post_slot(slot *s) {
+	pthread_mutex_lock(&s->mutex);
+	s->flag = 1;
+	pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->mutex);
+}
+
+/*
+	Le futex vaut 1 quand une notification est en attente. `FUTEX_WAIT` ne dort que si le mot vaut encore 0, une notification ne peut donc pas être perdue.
 */
-void * first(void* args) {
-	struct arg* mutex = (struct arg*) args;
 
-	// Bloque sont propre mutex et sémaphore
-	pthread_mutex_lock(mutex->mut1);
-	sem_wait(mutex->sem1);
+void futex_wait_slot(slot *s) {
+	while (atomic_exchange(&s->word, 0) == 0)
+		futex(&s->word, FUTEX_WAIT_PRIVATE, 0);
+}
 
-	// Attend une seconde pour être sur que tout le monde ait bloqué son mutex et sa sémaphore
-	sleep(1);
+void futex_post_slot(slot *s) {
+	atomic_store(&s->word, 1);
+	futex(&s->word, FUTEX_WAKE_PRIVATE, 1);
+}
 
-	// Commence le timer et débloque son mutex pour commencer la cascade de lock/unlock
-	start_timer(t);
-	pthread_mutex_unlock(mutex->mut1);
-	pthread_mutex_lock(mutex->mut2);
-	write_record_n(mut_rec, i/MULTIPLICATEUR, stop_timer(t), MULTIPLICATEUR);
+void eventfd_wait_slot(slot *s) {
+	uint64_t v;
+	if (read(s->efd, &v, sizeof(v)) != sizeof(v)) {
+		perror("read");
+		exit(EXIT_FAILURE);
+	}
+}
 
-	sleep(1);
+void eventfd_post_slot(slot *s) {
+	uint64_t v = 1;
+	if (write(s->efd, &v, sizeof(v)) != sizeof(v)) {
+		perror("write");
+		exit(EXIT_FAILURE);
+	}
+}
 
-	// Commence le timer et débloque sa sémaphore pour commencer la cascade de wait/post
-	start_timer(t);
-	sem_post(mutex->sem1);
-	sem_wait(mutex->sem2);
-	write_record_n(sem_rec, i/MULTIPLICATEUR, stop_timer(t), MULTIPLICATEUR);
+/*
+	Attente active puis futex : 0 pas de notification, 1 notification en attente, -1 le thread dort sur le futex. Celui qui notifie ne fait un appel système que s'il trouve -1.
+*/
 
-	return NULL;
+void spin_wait_slot(slot *s) {
+	int i;
+	for (i = 0; i < SPIN; i++) {
+		if (atomic_load_explicit(&s->word, memory_order_acquire) == 1) {
+			atomic_store_explicit(&s->word, 0, memory_order_relaxed);
+			return;
+		}
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+	int expected = 0;
+	if (atomic_compare_exchange_strong(&s->word, &expected, -1)) {
+		while (atomic_load(&s->word) == -1)
+			futex(&s->word, FUTEX_WAIT_PRIVATE, -1);
+	}
+	atomic_store_explicit(&s->word, 0, memory_order_relaxed);
 }
 
-void * other(void* args) {
-	struct arg * mutex = (struct arg*) args;
+void spin_post_slot(slot *s) {
+	if (atomic_exchange(&s->word, 1) == -1)
+		futex(&s->word, FUTEX_WAKE_PRIVATE, 1);
+}
 
-	// Bloque leur propre mutex/sem
-	pthread_mutex_lock(mutex->mut1);
-	sem_wait(mutex->sem1);
+static const mechanism mechanisms[] = {
+	{"sem", sem_wait_slot, sem_post_slot},
+	{"cond", cond_wait_slot, cond_post_slot},
+	{"futex", futex_wait_slot, futex_post_slot},
+	{"eventfd", eventfd_wait_slot, eventfd_post_slot},
+	{"spin", spin_wait_slot, spin_post_slot},
+};
 
-	// Attend une seconde pour être sur que tout le monde ait bloqué son mutex et sa sémaphore	
-	sleep(1);
+#define NMECHANISMS (sizeof(mechanisms) / sizeof(mechanisms[0]))
 
-	// Une fois que le mutex précédent est débloqué, on débloque son mutex pour permettre au suivant de faire de même
-	pthread_mutex_lock(mutex->mut2);
-	pthread_mutex_unlock(mutex->mut1);
+/**
+	\brief Arguments d'un thread de l'anneau et son histogramme
+*/
+typedef struct worker {
+	_Alignas(64) slot *in;
+	slot *out;
+	const mechanism *m;
+	timer *t;	// seulement pour first
+	long time;	// temps des `LAPS` tours, seulement pour first
+	pthread_barrier_t *barrier;
+	long hist[NBUCKETS];
+} worker;
 
-	// Idem avec les sémaphores
-	sem_wait(mutex->sem2);
-	sem_post(mutex->sem1);
+/**
+	\brief Range la latence `ns` dans l'histogramme
+*/
+static inline void record_hop(worker *w, long ns) {
+	int b = 0;
+	while (b < NBUCKETS - 1 && ns >= (2L << b))
+		b++;
+	w->hist[b]++;
+}
 
-	sleep(1);
+/**
+	\brief Le thread qui lance le relais et mesure le temps des tours
+*/
+void * first(void* args) {
+	worker *w = (worker*) args;
+	int lap;
+
+	pthread_barrier_wait(w->barrier);
+	for (lap = 0; lap < WARMUP + LAPS; lap++) {
+		if (lap == WARMUP)
+			start_timer(w->t);
+		w->out->stamp = now();
+		w->m->post(w->out);
+		w->m->wait(w->in);
+		if (lap >= WARMUP)
+			record_hop(w, now() - w->in->stamp);
+	}
+	w->time = stop_timer(w->t);
+	return NULL;
+}
 
+void * other(void* args) {
+	worker *w = (worker*) args;
+	int lap;
+
+	pthread_barrier_wait(w->barrier);
+	for (lap = 0; lap < WARMUP + LAPS; lap++) {
+		w->m->wait(w->in);
+		if (lap >= WARMUP)
+			record_hop(w, now() - w->in->stamp);
+		w->out->stamp = now();
+		w->m->post(w->out);
+	}
 	return NULL;
 }
-	
 
-int main (int argc, char *argv[])  {
-	// Déclare un timer, ainsi que deux recorder qui vont contenir les résultats de l'exécution du programme
-	t = timer_alloc();
-	sem_rec = recorder_alloc("mutsem-sem.csv");
- 	mut_rec = recorder_alloc("mutsem-mut.csv");
+/**
+	\brief Retourne la borne supérieure de la case contenant le percentile `pct`
+*/
+long percentile(long *hist, int pct) {
+	long total = 0, seen = 0;
+	int b;
+	for (b = 0; b < NBUCKETS; b++)
+		total += hist[b];
+	for (b = 0; b < NBUCKETS; b++) {
+		seen += hist[b];
+		if (seen * 100 >= total * pct)
+			break;
+	}
+	return 2L << b;
+}
+
+/**
+	\brief Fait tourner le relais sur un anneau de `n` threads avec le mécanisme `m`
+
+	\param hist reçoit l'histogramme des latences de tous les sauts
+	\return le temps des `LAPS` tours
+*/
+long ring(timer *t, const mechanism *m, int n, long *hist) {
+	pthread_t *threads = malloc(n * sizeof(pthread_t));
+	slot *slots = aligned_alloc(64, n * sizeof(slot));
+	worker *workers = aligned_alloc(64, n * sizeof(worker));
+	if (threads == NULL || slots == NULL || workers == NULL) {
+		perror("Impossible d'allouer la mémoire nécessaire : mutsem.c");
+		exit(EXIT_FAILURE);
+	}
+	memset(workers, 0, n * sizeof(worker));
 
 	int j;
-	pthread_t * threads;
-	pthread_mutex_t * mutex;
-	sem_t * sems;
-	struct arg * args;
-	
-	for(i=MULTIPLICATEUR; i<NUMBER_THREAD; i+=MULTIPLICATEUR) {
-		/* Alloue l'espace mémoire utilisé pour stocker les threads, 
-								les mutex, 
-								les sémaphores et 
-								les structures contenant les arguments */
-		threads = malloc(i*sizeof(pthread_t));
-		mutex = malloc(i*sizeof(pthread_mutex_t));
-		sems = malloc(i*sizeof(sem_t));
-		args = malloc(i*sizeof(struct arg));
-
-		if(threads == NULL || mutex == NULL || sems == NULL || args == NULL) {
-			perror("Impossible d'allouer la mémoire nécessaire : mutsem.c");
-   			exit(EXIT_FAILURE);
+	for (j = 0; j < n; j++) {
+		atomic_init(&slots[j].word, 0);
+		sem_init(&slots[j].sem, 0, 0);
+		pthread_mutex_init(&slots[j].mutex, NULL);
+		pthread_cond_init(&slots[j].cond, NULL);
+		slots[j].flag = 0;
+		slots[j].efd = eventfd(0, 0);
+		if (slots[j].efd == -1) {
+			perror("eventfd");
+			exit(EXIT_FAILURE);
 		}
+	}
 
-		// Initialisation des mutex et sémaphores
-		for(j=0; j<i;j++) {
-			pthread_mutex_init(mutex+j, NULL);
-			sem_init(sems+j,0,1);
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, n);
+	for (j = 0; j < n; j++) {
+		workers[j].in = &slots[j];
+		workers[j].out = &slots[(j + 1) % n];
+		workers[j].m = m;
+		workers[j].t = t;
+		workers[j].barrier = &barrier;
+		if (pthread_create(&threads[j], NULL, j == 0 ? first : other, &workers[j]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
 		}
+	}
+	for (j = 0; j < n; j++)
+		pthread_join(threads[j], NULL);
+
+	int b;
+	memset(hist, 0, NBUCKETS * sizeof(long));
+	for (j = 0; j < n; j++)
+		for (b = 0; b < NBUCKETS; b++)
+			hist[b] += workers[j].hist[b];
+	long time = workers[0].time;
+
+	pthread_barrier_destroy(&barrier);
+	for (j = 0; j < n; j++) {
+		sem_destroy(&slots[j].sem);
+		pthread_mutex_destroy(&slots[j].mutex);
+		pthread_cond_destroy(&slots[j].cond);
+		close(slots[j].efd);
+	}
+	free(threads);
+	free(slots);
+	free(workers);
+	return time;
+}
 
-		/** Remplissage des N arguments compris entre 1 et N.
-		    Pour un argument A tel que : * 1 < A < N-1 : mut1 de A = mut2 de A-1 et mut2 de A = mut1 de A+1
-						 * A = 1       : mut1 de A = mut2 de N et mut2 de A = mut1 de A+1
-						 * A = N       : mut1 de A = mut2 de A-1 et mut2 de A = mut1 de 1
-		*/
-		for(j=0; j<i-1;j++) {
-			(args+j)->mut1 = mutex+j;
-			(args+j)->mut2 = (mutex+j+1);
-			(args+j)->sem1 = sems+j;
-			(args+j)->sem2 = (sems+j+1);
-		}
-		(args+i-1)->mut1 = (mutex+i-1);
-		(args+i-1)->mut2 = mutex;
-		(args+i-1)->sem1 = (sems+i-1);
-		(args+i-1)->sem2 = sems;
-		
-		// Démarrage des threads
-		pthread_create(threads, NULL, first, (void*)args);
-		for(j=1; j<i;j++)
-			pthread_create(threads+j, NULL, other, (void*)(args+j));
-		
-		// Récupération des threads
-		for(j=i-1; j>=0;j--)
-			pthread_join(*(threads+j), NULL);
-	
-		// Destruction des mutex et des sémaphores
-		for(j=0; j<i; j++) {
-			pthread_mutex_destroy(mutex+j);
-			sem_destroy(sems+j);
+int main (int argc, char *argv[])  {
+	// Déclare un timer, ainsi que les records qui vont contenir les résultats de l'exécution du programme
+	timer *t = timer_alloc();
+	long hist[NBUCKETS];
+	char name[64];
+	unsigned int i;
+	int n, b;
+
+	for (i = 0; i < NMECHANISMS; i++) {
+		const mechanism *m = &mechanisms[i];
+		snprintf(name, sizeof(name), "%s.csv", m->name);
+		recorder *hop_rec = recorder_alloc(name);
+		snprintf(name, sizeof(name), "%s-p50.csv", m->name);
+		recorder *p50_rec = recorder_alloc(name);
+		snprintf(name, sizeof(name), "%s-p99.csv", m->name);
+		recorder *p99_rec = recorder_alloc(name);
+		snprintf(name, sizeof(name), "%s-hist.csv", m->name);
+		recorder *hist_rec = recorder_alloc(name);
+
+		for (n = MIN_RING; n <= MAX_RING; n *= 2) {
+			long time = ring(t, m, n, hist);
+			write_record_n(hop_rec, n, time, (long) LAPS * n);
+			write_value(p50_rec, n, percentile(hist, 50));
+			write_value(p99_rec, n, percentile(hist, 99));
+			if (n == HIST_RING) {
+				for (b = 0; b < NBUCKETS; b++)
+					if (hist[b] > 0)
+						write_value(hist_rec, 2L << b, hist[b]);
+			}
 		}
+		printf("%s\n", m->name);
 
-		// Libération de la mémoire
-		free(threads);
-		threads=NULL;
-		free(mutex);
-		mutex =NULL;
-		free(sems);
-		sems=NULL;	
-		free(args);
-		args = NULL;
+		recorder_free(hop_rec);
+		recorder_free(p50_rec);
+		recorder_free(p99_rec);
+		recorder_free(hist_rec);
 	}
-
-	recorder_free(sem_rec);
-  	recorder_free(mut_rec);
 	timer_free(t);
 
-  return EXIT_SUCCESS;
+	return EXIT_SUCCESS;
 }
@@ -0,0 +1,358 @@
+/**
+ * \file numa.c
+ * \brief Impact du placement NUMA de la mémoire sur un parcours de tableau
+ *
+ * Le parcours `work()` de `shm.c` et les threads de `amdahl.c` ne
+ * contrôlent jamais où se trouve la mémoire par rapport au CPU qui la lit.
+ * Sur une machine à plusieurs sockets, c'est pourtant la variable qui
+ * compte le plus.
+ *
+ * Ce benchmark alloue un tableau avec `mmap` puis fixe son placement avec
+ * `mbind` :
+ * * `local` : la mémoire est sur le même nœud que les threads qui la lisent;
+ * * `remote` : la mémoire est sur le nœud le plus éloigné (d'après
+ *   `/sys/devices/system/node/node0/distance`);
+ * * `interleave` : les pages sont réparties sur tous les nœuds.
+ *
+ * Les threads de parcours sont fixés (`sched_setaffinity`) sur les CPUs
+ * du nœud 0. On mesure
+ * * la bande passante d'un parcours séquentiel par tous les CPUs du nœud;
+ * * la latence d'un parcours de pointeurs aléatoire par un seul thread.
+ *
+ * Sur une machine avec un seul nœud, seul le placement `local` est mesuré,
+ * les fichiers `remote` et `interleave` restent vides.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "benchmark.h"
+
+#define MIN_SIZE 0x100000   //!<   1 MiB
+#define MAX_SIZE 0x10000000 //!< 256 MiB
+#define REPEAT 4            //!< Nombre de parcours par mesure de bande passante
+#define STEPS 0x400000      //!< Nombre de sauts par mesure de latence
+#define LINE 64             //!< Taille d'une ligne de cache
+#define MAX_NODES 64        //!< Nombre max de nœuds gérés (un `unsigned long`)
+#define MAX_THREADS 256     //!< Nombre max de threads de parcours
+
+// Constantes de <linux/mempolicy.h>, redéfinies pour ne pas dépendre de libnuma
+#define BM_MPOL_DEFAULT    0
+#define BM_MPOL_BIND       2
+#define BM_MPOL_INTERLEAVE 3
+#define BM_MPOL_MF_MOVE    (1 << 1)
+
+/**
+ * \brief Lit une liste au format de `/sys` (`0-3,8,10-11`) dans `mask`
+ *
+ * \return le nombre d'éléments de la liste ou `-1` si `path` n'est pas
+ *         lisible
+ */
+int read_list (char *path, cpu_set_t *mask) {
+  char buf[4096];
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return -1;
+  }
+  if (fgets(buf, sizeof(buf), f) == NULL) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  CPU_ZERO(mask);
+  char *s = buf;
+  while (*s != '\0' && *s != '\n') {
+    char *end;
+    long a = strtol(s, &end, 10), b = a;
+    if (end == s) {
+      break;
+    }
+    if (*end == '-') {
+      s = end + 1;
+      b = strtol(s, &end, 10);
+    }
+    long i;
+    for (i = a; i <= b && i < CPU_SETSIZE; i++) {
+      CPU_SET(i, mask);
+    }
+    s = (*end == ',') ? end + 1 : end;
+  }
+  return CPU_COUNT(mask);
+}
+
+/**
+ * \brief Retourne le nœud le plus éloigné du nœud 0 parmi `nodes`
+ *
+ * Utilise la table de distances du firmware (SLIT) exposée dans `/sys`.
+ * Si elle n'est pas disponible, retourne le dernier nœud en ligne.
+ */
+int farthest_node (cpu_set_t *nodes) {
+  int node, far = 0, best = -1;
+  for (node = 0; node < MAX_NODES; node++) {
+    if (CPU_ISSET(node, nodes)) {
+      far = node;
+    }
+  }
+  FILE *f = fopen("/sys/devices/system/node/node0/distance", "r");
+  if (f == NULL) {
+    return far;
+  }
+  int d;
+  for (node = 0; node < MAX_NODES && fscanf(f, "%d", &d) == 1; node++) {
+    if (CPU_ISSET(node, nodes) && d > best) {
+      best = d;
+      far = node;
+    }
+  }
+  fclose(f);
+  return far;
+}
+
+/**
+ * \brief Applique la politique `mode` sur les nœuds `mask` à `[addr, addr+len[`
+ *
+ * Doit être appelé avant le premier accès aux pages. En cas d'échec (noyau
+ * sans NUMA, conteneur sans les droits, ...), affiche un avertissement et
+ * la mémoire garde la politique par défaut.
+ */
+void place (void *addr, size_t len, int mode, unsigned long mask) {
+  if (syscall(SYS_mbind, addr, len, mode, &mask, MAX_NODES + 1,
+        BM_MPOL_MF_MOVE) == -1) {
+    perror("mbind");
+  }
+}
+
+/**
+ * \brief Fixe le thread appelant sur les CPUs `cpus`
+ */
+void pin (cpu_set_t *cpus) {
+  if (sched_setaffinity(0, sizeof(cpu_set_t), cpus) == -1) {
+    perror("sched_setaffinity");
+  }
+}
+
+/**
+ * \brief Arguments d'un thread de parcours
+ */
+typedef struct scanargs {
+  long *array;          //!< Début de la portion à parcourir
+  size_t len;           //!< Nombre d'éléments de la portion
+  int cpu;              //!< CPU sur lequel fixer le thread
+  pthread_barrier_t *barrier; //!< Synchronise le début et la fin des parcours
+  long sum;             //!< Résultat, pour que le parcours ne soit pas optimisé
+} scanargs;
+
+/**
+ * \brief Parcourt `REPEAT` fois une portion du tableau entre deux barrières
+ */
+void *scan (void *param) {
+  scanargs *args = (scanargs *) param;
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(args->cpu, &cpus);
+  pin(&cpus);
+
+  long sum = 0;
+  size_t i;
+  int k;
+  pthread_barrier_wait(args->barrier);
+  for (k = 0; k < REPEAT; k++) {
+    for (i = 0; i < args->len; i++) {
+      sum += args->array[i];
+    }
+  }
+  pthread_barrier_wait(args->barrier);
+  args->sum = sum;
+  return NULL;
+}
+
+/**
+ * \brief Mesure le temps de `REPEAT` parcours de `array` par un thread
+ *        par CPU de `cpus`
+ */
+long int bandwidth (timer *t, long *array, size_t size, cpu_set_t *cpus) {
+  scanargs args[MAX_THREADS];
+  pthread_t threads[MAX_THREADS];
+  pthread_barrier_t barrier;
+  int cpu, n = 0, j;
+
+  int nthreads = CPU_COUNT(cpus);
+  if (nthreads > MAX_THREADS) {
+    nthreads = MAX_THREADS;
+  }
+  size_t len = size / sizeof(long);
+  size_t slice = len / nthreads;
+
+  pthread_barrier_init(&barrier, NULL, nthreads + 1);
+  for (cpu = 0; cpu < CPU_SETSIZE && n < nthreads; cpu++) {
+    if (!CPU_ISSET(cpu, cpus)) {
+      continue;
+    }
+    args[n].array = array + n * slice;
+    // le dernier thread prend aussi le reste de la division
+    args[n].len = (n == nthreads - 1) ? len - n * slice : slice;
+    args[n].cpu = cpu;
+    args[n].barrier = &barrier;
+    if (pthread_create(&threads[n], NULL, &scan, &args[n]) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+    n++;
+  }
+
+  pthread_barrier_wait(&barrier);
+  start_timer(t);
+  pthread_barrier_wait(&barrier);
+  long int time = stop_timer(t);
+
+  for (j = 0; j < n; j++) {
+    pthread_join(threads[j], NULL);
+  }
+  pthread_barrier_destroy(&barrier);
+  return time;
+}
+
+/**
+ * \brief Mesure le temps de `STEPS` sauts dans une chaîne de pointeurs
+ *
+ * Chaque ligne de cache de `array` contient un pointeur vers une autre
+ * ligne, l'ordre étant une permutation aléatoire de toutes les lignes
+ * pour que ni le préchargement ni le cache ne puissent aider.
+ */
+long int latency (timer *t, char *array, size_t size) {
+  size_t lines = size / LINE, i;
+  size_t *order = (size_t *) malloc(sizeof(size_t) * lines);
+  if (order == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < lines; i++) {
+    order[i] = i;
+  }
+  // mélange de Fisher-Yates
+  for (i = lines - 1; i > 0; i--) {
+    size_t j = ((size_t) rand() * RAND_MAX + rand()) % (i + 1);
+    size_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+  for (i = 0; i < lines; i++) {
+    *(char **) (array + order[i] * LINE) = array + order[(i + 1) % lines] * LINE;
+  }
+  free(order);
+
+  char **p = (char **) array;
+  long k;
+  start_timer(t);
+  for (k = 0; k < STEPS; k++) {
+    p = (char **) *p;
+  }
+  long int time = stop_timer(t);
+  // empêche le compilateur de supprimer la boucle
+  if (p == NULL) {
+    printf("%p\n", (void *) p);
+  }
+  return time;
+}
+
+/**
+ * \brief Mesure bande passante et latence pour un placement donné
+ *
+ * \param mode la politique passée à `mbind`
+ * \param mask les nœuds sur lesquels placer la mémoire
+ * \param cpus les CPUs du nœud qui parcourt le tableau
+ */
+void benchmark_placement (timer *t, recorder *bw_rec, recorder *lat_rec,
+    int mode, unsigned long mask, cpu_set_t *cpus) {
+  size_t size;
+  for (size = MIN_SIZE; size <= MAX_SIZE; size *= 2) {
+    char *array = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (array == MAP_FAILED) {
+      perror("mmap");
+      exit(EXIT_FAILURE);
+    }
+    place(array, size, mode, mask);
+    // premier accès : les pages sont allouées suivant la politique
+    memset(array, 1, size);
+
+    write_record_n(bw_rec, size >> 10, bandwidth(t, (long *) array, size, cpus),
+        REPEAT);
+
+    // le thread principal reste sur le nœud 0 pour la latence
+    pin(cpus);
+    write_record_n(lat_rec, size >> 10, latency(t, array, size), STEPS);
+
+    if (munmap(array, size) == -1) {
+      perror("munmap");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+int main (int argc, char *argv[]) {
+  timer *t = timer_alloc();
+  recorder *local_bw_rec = recorder_alloc("local-bw.csv");
+  recorder *local_lat_rec = recorder_alloc("local-lat.csv");
+  recorder *remote_bw_rec = recorder_alloc("remote-bw.csv");
+  recorder *remote_lat_rec = recorder_alloc("remote-lat.csv");
+  recorder *inter_bw_rec = recorder_alloc("interleave-bw.csv");
+  recorder *inter_lat_rec = recorder_alloc("interleave-lat.csv");
+
+  cpu_set_t nodes, cpus;
+  int nnodes = read_list("/sys/devices/system/node/online", &nodes);
+  if (nnodes < 1) {
+    // pas de NUMA dans le noyau : un seul nœud avec tous les CPUs
+    nnodes = 1;
+    CPU_ZERO(&nodes);
+    CPU_SET(0, &nodes);
+  }
+  if (read_list("/sys/devices/system/node/node0/cpulist", &cpus) < 1
+      && sched_getaffinity(0, sizeof(cpu_set_t), &cpus) == -1) {
+    perror("sched_getaffinity");
+    return EXIT_FAILURE;
+  }
+
+  unsigned long all = 0;
+  int node;
+  for (node = 0; node < MAX_NODES; node++) {
+    if (CPU_ISSET(node, &nodes)) {
+      all |= 1UL << node;
+    }
+  }
+  int far = farthest_node(&nodes);
+  printf("%d nœud(s), %d CPU(s) sur le nœud 0, nœud distant : %d\n",
+      nnodes, CPU_COUNT(&cpus), far);
+
+  srand(1252);
+  if (nnodes == 1) {
+    puts("un seul nœud NUMA : seul le placement local est mesuré");
+    benchmark_placement(t, local_bw_rec, local_lat_rec, BM_MPOL_DEFAULT, 0,
+        &cpus);
+  } else {
+    benchmark_placement(t, local_bw_rec, local_lat_rec, BM_MPOL_BIND, 1UL,
+        &cpus);
+    benchmark_placement(t, remote_bw_rec, remote_lat_rec, BM_MPOL_BIND,
+        1UL << far, &cpus);
+    benchmark_placement(t, inter_bw_rec, inter_lat_rec, BM_MPOL_INTERLEAVE,
+        all, &cpus);
+  }
+
+  recorder_free(local_bw_rec);
+  recorder_free(local_lat_rec);
+  recorder_free(remote_bw_rec);
+  recorder_free(remote_lat_rec);
+  recorder_free(inter_bw_rec);
+  recorder_free(inter_lat_rec);
+  timer_free(t);
+
+  return EXIT_SUCCESS;
+}
@@ -13,10 +13,17 @@
 #include <sys/wait.h>
 
 #include "benchmark.h"
+#include "arena.h"
 
 #define SIZE_MAX 65536
 // pipe buffer is 64k => more is impossible
 
+/**
+ * \brief Mémoire de travail des messages, remise à zéro après chaque
+ * message au lieu d'un `malloc`/`free` par message
+ */
+arena* scratch;
+
 /**
  * \brief Alloue un string et l'init à 'a'
  *
@@ -26,8 +33,7 @@
  */
 
 char* ipsum (int size) {
-	char* ipsum = (char*)malloc(sizeof(char)*size);
-	if (ipsum == NULL) err(1, "erreur de malloc dans ipsum");
+	char* ipsum = (char*)arena_push(scratch, sizeof(char)*size);
 	memset(ipsum,'a',size);
 	
 	ipsum[size-1] = '\0';
@@ -52,12 +58,11 @@ int send (int size, int* fd) {
 	if (size == 1) close(fd[0]);
 	
 	char* message = ipsum(size);
-	if (message == NULL) err(1, "erreur de malloc dans send");
 	
 	int sent = write(fd[1], message, size);
 	if (sent != size ) err(1,"erreur de write dans send");
 	
-	free(message);
+	arena_reset(scratch);
 	
 	//if (size == SIZE_MAX) close(fd[1]);
 	
@@ -82,8 +87,7 @@ int respond (int size, int* fdin, int* fdout) {
 	if (size == 1) close(fdout[0]);
 	if (size == 1) close(fdin[1]);
 	
-	char* buffer = (char*)malloc(sizeof(char)*size);
-	if (buffer == NULL) err(1, "erreur de malloc dans respond");
+	char* buffer = (char*)arena_push(scratch, sizeof(char)*size);
 	
 	int received = read(fdin[0], buffer, size);
 	if (received != size ) err(1,"erreur de read dans respond");
@@ -93,7 +97,7 @@ int respond (int size, int* fdin, int* fdout) {
 	int sent = write(fdout[1], buffer, size);
 	if (sent != size ) err(1,"erreur de write dans respond");
 	
-	free(buffer);
+	arena_reset(scratch);
 	
 	//if (size == SIZE_MAX) close(fdout[1]);
 	//if (size == SIZE_MAX) close(fdin[0]);
@@ -116,15 +120,14 @@ int receive (int size, int* fd) {
 	
 	if (size == 1) close(fd[1]);
 	
-	char* buffer = (char*)malloc(sizeof(char)*size);
-	if (buffer == NULL) err(1, "erreur de malloc dans receive");
+	char* buffer = (char*)arena_push(scratch, sizeof(char)*size);
 	
 	int received = read(fd[0], buffer, size);
 	if (received != size ) err(1,"erreur de read dans receive");
 	
 	//puts(buffer);
 	
-	free(buffer);
+	arena_reset(scratch);
 	
 	//if (size == SIZE_MAX) close(fd[0]);
 	
@@ -147,6 +150,8 @@ int main (int argc, char* argv[]) {
 	
 	timer *t = timer_alloc();
 	recorder *pipe_rec = recorder_alloc("pipe.csv");
+	// copiée dans le fils par le fork
+	scratch = arena_alloc(SIZE_MAX);
 	//start_timer(t);
 	pid_t pid = fork();
 	
@@ -178,6 +183,7 @@ int main (int argc, char* argv[]) {
 	
 	recorder_free(pipe_rec);
 	timer_free(t);
+	arena_free(scratch);
 	
 	return 0;
 }
@@ -0,0 +1,291 @@
+/**
+ * \file prefetch.c
+ * \brief Préchargement matériel et logiciel sur un parcours à pas constant
+ *
+ * Le parcours par colonne de `tab` lit un entier toutes les `n` cases : un
+ * accès à pas constant, que les préchargeurs matériels du processeur
+ * reconnaissent ou non selon le pas. On lit ici un entier tous les
+ * `stride` bytes, de 4 bytes à `MAX_STRIDE`, dans un tableau qui tient
+ * dans le L2 (256 KiB), dans le LLC (16 MiB) ou seulement en mémoire
+ * (512 MiB), avec
+ * * `none` : sans indication;
+ * * `pf<d>` : `__builtin_prefetch` de l'élément lu `d` accès plus tard;
+ * * `nta<d>` : pareil, avec l'indication non temporelle
+ *   (`prefetchnta`) qui évite de polluer les niveaux de cache externes;
+ * * `ntload` : chargements non temporels `movntdqa` (SSE4.1). Sur de la
+ *   mémoire normale (write-back), le processeur les traite comme des
+ *   chargements ordinaires : c'est ce que la mesure doit montrer. Hors
+ *   x86, les fichiers `ntload` restent vides.
+ *
+ * On enregistre dans `<variante>-<taille>.csv` le temps pour 1000 lectures
+ * en ns, en fonction du pas en bytes.
+ *
+ * Si le programme peut écrire dans `/dev/cpu/<n>/msr` (root et module
+ * `msr`) sur un processeur Intel, la même mesure est refaite avec les
+ * quatre préchargeurs matériels désactivés (bits 0 à 3 du MSR `0x1a4`,
+ * `MISC_FEATURE_CONTROL`) dans `<variante>-<taille>-hwoff.csv`. Sinon ces
+ * fichiers restent vides. Les valeurs d'origine sont remises à la fin.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "benchmark.h"
+
+#define MIN_STRIDE 4
+#define MAX_STRIDE 16384
+#define LOADS (1L << 22) //!< Lectures au minimum par mesure
+#define MAX_DIST 128
+#define MSR_PREFETCH 0x1a4 //!< `MISC_FEATURE_CONTROL` sur Intel
+#define MSR_PREFETCH_OFF 0xf
+#define MAX_CPUS 1024
+
+/**
+ * \brief Une variante : le parcours `walk` avec `dist` accès d'avance
+ *
+ * Le degré de localité de `__builtin_prefetch` est fixé par `walk` :
+ * `walk_prefetch` garde la ligne dans tous les niveaux, `walk_nta` la
+ * marque non temporelle.
+ */
+typedef struct variant {
+  const char *name;
+  long (*walk)(const char *a, long stride, long n, long passes, int dist);
+  int dist;
+} variant;
+
+typedef struct size {
+  const char *name;
+  long bytes;
+} size;
+
+static const size sizes[] = {
+  {"256k", 256L << 10},
+  {"16m", 16L << 20},
+  {"512m", 512L << 20},
+};
+
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+long walk_none (const char *a, long stride, long n, long passes, int dist) {
+  long sum = 0;
+  long p, i;
+  for (p = 0; p < passes; p++) {
+    for (i = 0; i < n; i++) {
+      sum += *(const int *) (a + i * stride);
+    }
+  }
+  return sum;
+}
+
+/**
+ * Le tableau a `MAX_DIST * MAX_STRIDE` bytes de plus : les préchargements
+ * après la fin restent dans la zone allouée.
+ */
+long walk_prefetch (const char *a, long stride, long n, long passes,
+    int dist) {
+  long sum = 0;
+  long p, i;
+  for (p = 0; p < passes; p++) {
+    for (i = 0; i < n; i++) {
+      __builtin_prefetch(a + (i + dist) * stride, 0, 3);
+      sum += *(const int *) (a + i * stride);
+    }
+  }
+  return sum;
+}
+
+long walk_nta (const char *a, long stride, long n, long passes, int dist) {
+  long sum = 0;
+  long p, i;
+  for (p = 0; p < passes; p++) {
+    for (i = 0; i < n; i++) {
+      __builtin_prefetch(a + (i + dist) * stride, 0, 0);
+      sum += *(const int *) (a + i * stride);
+    }
+  }
+  return sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * `movntdqa` lit 16 bytes alignés : on lit le bloc qui contient l'entier
+ */
+__attribute__((target("sse4.1")))
+long walk_ntload (const char *a, long stride, long n, long passes,
+    int dist) {
+  long sum = 0;
+  long p, i;
+  for (p = 0; p < passes; p++) {
+    for (i = 0; i < n; i++) {
+      __m128i v = _mm_stream_load_si128((__m128i *)
+          ((uintptr_t) (a + i * stride) & ~(uintptr_t) 15));
+      sum += _mm_cvtsi128_si32(v);
+    }
+  }
+  return sum;
+}
+#else
+#define walk_ntload NULL
+#endif
+
+static const variant variants[] = {
+  {"none", walk_none, 0},
+  {"pf8", walk_prefetch, 8},
+  {"pf32", walk_prefetch, 32},
+  {"pf128", walk_prefetch, 128},
+  {"nta32", walk_nta, 32},
+  {"ntload", walk_ntload, 0},
+};
+
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+/**
+ * \brief Le résultat des parcours, pour que le compilateur les garde
+ */
+volatile long sink;
+
+int ncpu;
+uint64_t saved[MAX_CPUS]; //!< Valeurs d'origine du MSR de chaque CPU
+
+/**
+ * \brief Lit ou écrit le MSR des préchargeurs de `cpu`
+ *
+ * \return 0, ou -1 si `/dev/cpu/<cpu>/msr` n'est pas accessible
+ */
+int msr_access (int cpu, uint64_t *value, int write) {
+  char path[64];
+  snprintf(path, sizeof(path), "/dev/cpu/%d/msr", cpu);
+  int fd = open(path, write ? O_WRONLY : O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  ssize_t ret = write ? pwrite(fd, value, sizeof(*value), MSR_PREFETCH)
+      : pread(fd, value, sizeof(*value), MSR_PREFETCH);
+  close(fd);
+  return ret == sizeof(*value) ? 0 : -1;
+}
+
+/**
+ * \brief Désactive les préchargeurs matériels de tous les CPUs
+ *
+ * \return 0, ou -1 (avec un message) si ce n'est pas possible
+ */
+int hw_prefetch_off (void) {
+#if defined(__x86_64__) || defined(__i386__)
+  int intel = __builtin_cpu_is("intel");
+#else
+  int intel = 0;
+#endif
+  if (!intel) {
+    fprintf(stderr, "MSR 0x%x : processeur non Intel, mode hwoff ignoré\n",
+        MSR_PREFETCH);
+    return -1;
+  }
+  int cpu;
+  for (cpu = 0; cpu < ncpu; cpu++) {
+    if (msr_access(cpu, &saved[cpu], 0) == -1) {
+      fprintf(stderr, "/dev/cpu/%d/msr : ", cpu);
+      perror("mode hwoff ignoré");
+      return -1;
+    }
+  }
+  for (cpu = 0; cpu < ncpu; cpu++) {
+    uint64_t off = saved[cpu] | MSR_PREFETCH_OFF;
+    if (msr_access(cpu, &off, 1) == -1) {
+      perror("wrmsr");
+      while (cpu-- > 0) {
+        msr_access(cpu, &saved[cpu], 1);
+      }
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void hw_prefetch_restore (void) {
+  int cpu;
+  for (cpu = 0; cpu < ncpu; cpu++) {
+    msr_access(cpu, &saved[cpu], 1);
+  }
+}
+
+/**
+ * \brief Fait tout le balayage, en écrivant dans `<variante>-<taille><suffix>.csv`
+ *
+ * Avec `skip`, les fichiers sont créés vides.
+ */
+void sweep (timer *t, char *a, const char *suffix, int skip) {
+  unsigned int s, v;
+  for (s = 0; s < NSIZES; s++) {
+    recorder *rec[NVARIANTS];
+    for (v = 0; v < NVARIANTS; v++) {
+      char name[64];
+      snprintf(name, sizeof(name), "%s-%s%s.csv", variants[v].name,
+          sizes[s].name, suffix);
+      rec[v] = recorder_alloc(name);
+    }
+    long stride;
+    for (stride = MIN_STRIDE; !skip && stride <= MAX_STRIDE; stride *= 2) {
+      long n = sizes[s].bytes / stride;
+      long passes = n >= LOADS ? 1 : LOADS / n;
+      for (v = 0; v < NVARIANTS; v++) {
+        if (variants[v].walk == NULL) {
+          continue;
+        }
+        // un premier passage pour charger le tableau dans le cache s'il y tient
+        sink += variants[v].walk(a, stride, n, 1, variants[v].dist);
+        start_timer(t);
+        sink += variants[v].walk(a, stride, n, passes, variants[v].dist);
+        long time = stop_timer(t);
+        write_record_n(rec[v], stride, time, n * passes / 1000);
+      }
+    }
+    if (!skip) {
+      printf("%s%s\n", sizes[s].name, suffix);
+    }
+    for (v = 0; v < NVARIANTS; v++) {
+      recorder_free(rec[v]);
+    }
+  }
+}
+
+int main (int argc, char *argv[]) {
+  ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpu < 1) {
+    ncpu = 1;
+  }
+  if (ncpu > MAX_CPUS) {
+    ncpu = MAX_CPUS;
+  }
+
+  long bytes = sizes[NSIZES - 1].bytes + (long) MAX_DIST * MAX_STRIDE;
+  char *a = (char *) aligned_alloc(4096, bytes);
+  if (a == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  long i;
+  for (i = 0; i < bytes / (long) sizeof(int); i++) {
+    ((int *) a)[i] = (int) i;
+  }
+
+  timer *t = timer_alloc();
+  sweep(t, a, "", 0);
+  if (hw_prefetch_off() == 0) {
+    sweep(t, a, "-hwoff", 0);
+    hw_prefetch_restore();
+  } else {
+    sweep(t, a, "-hwoff", 1);
+  }
+  timer_free(t);
+  free(a);
+  return EXIT_SUCCESS;
+}
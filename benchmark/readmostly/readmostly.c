@@ -0,0 +1,455 @@
+/**
+ * \file readmostly.c
+ * \brief Données lues très souvent et rarement modifiées : rwlock, seqlock,
+ *        RCU et hazard pointers
+ *
+ * Une table de `WORDS` entiers (comme une table de configuration ou de
+ * routage) est lue en boucle par plusieurs threads pendant qu'un thread
+ * la modifie. On compare
+ * * `rwlock` : `pthread_rwlock_t`, les lecteurs le prennent en lecture;
+ * * `seqlock` : le rédacteur incrémente un compteur avant et après
+ *   l'écriture, les lecteurs recommencent si le compteur a changé ou était
+ *   impair. Les lecteurs n'écrivent rien en mémoire partagée;
+ * * `rcu` : la table est remplacée par une copie avec un échange de
+ *   pointeur. Un RCU minimal à base d'époques : chaque lecteur publie
+ *   l'époque pendant laquelle il lit et le rédacteur attend que tous les
+ *   lecteurs aient quitté les époques précédentes avant de libérer
+ *   l'ancienne table (période de grâce);
+ * * `hazard` : échange de pointeur aussi, mais chaque lecteur publie le
+ *   pointeur qu'il lit (hazard pointer). Le rédacteur ne libère une
+ *   ancienne table que si aucun lecteur ne la protège.
+ *
+ * Le rédacteur fait une mise à jour par ms (`1k`), en continu (`max`) ou
+ * pas du tout (`none`). Pour chaque nombre de lecteurs, on enregistre
+ * * dans `<variante>-read-<débit>.csv` le nombre de lectures par µs,
+ *   tous lecteurs confondus;
+ * * dans `<variante>-write-<débit>.csv` le temps moyen d'une mise à jour
+ *   en ns, libération de l'ancienne table comprise.
+ *
+ * Chaque lecture vérifie que la table est cohérente (pas un mélange de
+ * deux versions) et le programme s'arrête sinon.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "benchmark.h"
+
+#define DURATION 100       //!< Durée d'une mesure en ms
+#define WORDS 16           //!< Taille de la table en `long`
+#define MAX_READERS 256
+
+static inline void cpu_relax () {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#else
+  atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+static inline long now () {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * \brief La table lue par les threads
+ *
+ * La version `v` contient `v + i` dans la case `i`. Les cases sont
+ * atomiques pour le seqlock, où les lecteurs lisent pendant que le
+ * rédacteur écrit; les accès `relaxed` ne coûtent rien de plus.
+ */
+typedef struct table {
+  atomic_long words[WORDS];
+} table;
+
+/**
+ * \brief Lit toute la table
+ *
+ * \return la version lue, ou -1 si la table mélange deux versions
+ */
+static inline long read_table (table *tb) {
+  long v = atomic_load_explicit(&tb->words[0], memory_order_relaxed);
+  long bad = 0;
+  int i;
+  for (i = 1; i < WORDS; i++) {
+    bad |= atomic_load_explicit(&tb->words[i], memory_order_relaxed) - i - v;
+  }
+  return bad ? -1 : v;
+}
+
+static inline void write_table (table *tb, long v) {
+  int i;
+  for (i = 0; i < WORDS; i++) {
+    atomic_store_explicit(&tb->words[i], v + i, memory_order_relaxed);
+  }
+}
+
+static table *table_alloc (long v) {
+  table *tb = (table *) aligned_alloc(64, sizeof(table));
+  if (tb == NULL) {
+    perror("aligned_alloc");
+    exit(EXIT_FAILURE);
+  }
+  write_table(tb, v);
+  return tb;
+}
+
+/**
+ * \brief Contexte d'un lecteur, sur sa propre ligne de cache
+ */
+typedef struct reader {
+  _Alignas(64) long reads;
+  atomic_long epoch;          //!< `rcu` : époque de la lecture, 0 hors lecture
+  _Atomic(table *) hazard;    //!< `hazard` : la table en cours de lecture
+  pthread_t thread;
+} reader;
+
+/*
+ * État partagé
+ */
+
+static _Alignas(64) atomic_int stop;
+static _Alignas(64) pthread_rwlock_t rwlock;
+static _Alignas(64) atomic_long seq;
+static _Alignas(64) table *fixed;       //!< `rwlock` et `seqlock`
+static _Alignas(64) _Atomic(table *) current; //!< `rcu` et `hazard`
+static _Alignas(64) atomic_long epoch;
+static reader *readers;
+static int nreaders;
+
+/*
+ * rwlock
+ */
+
+long rwlock_read (reader *r) {
+  pthread_rwlock_rdlock(&rwlock);
+  long v = read_table(fixed);
+  pthread_rwlock_unlock(&rwlock);
+  return v;
+}
+
+void rwlock_update (long v) {
+  pthread_rwlock_wrlock(&rwlock);
+  write_table(fixed, v);
+  pthread_rwlock_unlock(&rwlock);
+}
+
+/*
+ * seqlock
+ */
+
+long seqlock_read (reader *r) {
+  for (;;) {
+    long s = atomic_load_explicit(&seq, memory_order_acquire);
+    if (s & 1) {
+      cpu_relax();
+      continue;
+    }
+    long v = read_table(fixed);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&seq, memory_order_relaxed) == s) {
+      return v;
+    }
+  }
+}
+
+void seqlock_update (long v) {
+  long s = atomic_load_explicit(&seq, memory_order_relaxed);
+  atomic_store_explicit(&seq, s + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  write_table(fixed, v);
+  atomic_store_explicit(&seq, s + 2, memory_order_release);
+}
+
+/*
+ * RCU à base d'époques. Le lecteur publie l'époque courante avant de lire
+ * le pointeur : avec des accès `seq_cst` des deux côtés, soit le
+ * rédacteur voit l'époque publiée, soit le lecteur voit la nouvelle table.
+ * Après l'échange, le rédacteur avance l'époque et attend chaque lecteur
+ * encore dans une époque précédente : ces lecteurs sont les seuls qui
+ * peuvent encore tenir l'ancienne table.
+ */
+
+long rcu_read (reader *r) {
+  atomic_store(&r->epoch, atomic_load_explicit(&epoch, memory_order_acquire));
+  table *tb = atomic_load(&current);
+  long v = read_table(tb);
+  atomic_store_explicit(&r->epoch, 0, memory_order_release);
+  return v;
+}
+
+void rcu_update (long v) {
+  table *tb = table_alloc(v);
+  table *old = atomic_exchange(&current, tb);
+  long e = atomic_fetch_add(&epoch, 1) + 1;
+  int i;
+  for (i = 0; i < nreaders; i++) {
+    long re;
+    while ((re = atomic_load(&readers[i].epoch)) != 0 && re < e) {
+      sched_yield();
+    }
+  }
+  free(old);
+}
+
+/*
+ * Hazard pointers. Le lecteur publie le pointeur puis vérifie qu'il est
+ * toujours courant : sinon le rédacteur a pu le retirer avant de voir la
+ * publication. Le rédacteur garde les tables retirées encore protégées
+ * et réessaie de les libérer à la mise à jour suivante.
+ */
+
+static table *retired[MAX_READERS + 2];
+static int nretired;
+
+long hazard_read (reader *r) {
+  table *tb = atomic_load(&current);
+  for (;;) {
+    atomic_store(&r->hazard, tb);
+    table *again = atomic_load(&current);
+    if (again == tb) {
+      break;
+    }
+    tb = again;
+  }
+  long v = read_table(tb);
+  atomic_store_explicit(&r->hazard, NULL, memory_order_release);
+  return v;
+}
+
+void hazard_scan () {
+  int i, j, kept = 0;
+  for (j = 0; j < nretired; j++) {
+    int protected = 0;
+    for (i = 0; i < nreaders && !protected; i++) {
+      protected = atomic_load(&readers[i].hazard) == retired[j];
+    }
+    if (protected) {
+      retired[kept++] = retired[j];
+    } else {
+      free(retired[j]);
+    }
+  }
+  nretired = kept;
+}
+
+void hazard_update (long v) {
+  table *tb = table_alloc(v);
+  retired[nretired++] = atomic_exchange(&current, tb);
+  hazard_scan();
+}
+
+/**
+ * \brief Une variante : une lecture et une mise à jour
+ */
+typedef struct variant {
+  const char *name;
+  long (*read) (reader *r);
+  void (*update) (long v);
+} variant;
+
+static const variant variants[] = {
+  {"rwlock", rwlock_read, rwlock_update},
+  {"seqlock", seqlock_read, seqlock_update},
+  {"rcu", rcu_read, rcu_update},
+  {"hazard", hazard_read, hazard_update},
+};
+
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+/**
+ * \brief Débit du rédacteur
+ */
+typedef struct rate {
+  const char *name;
+  long interval;  //!< ns entre deux mises à jour, 0 en continu, -1 aucune
+} rate;
+
+static const rate rates[] = {
+  {"none", -1},
+  {"1k", 1000000},
+  {"max", 0},
+};
+
+#define NRATES (sizeof(rates) / sizeof(rates[0]))
+
+typedef struct args {
+  const variant *v;
+  reader *r;
+  long interval;
+  long updates;
+  long update_time;
+  pthread_barrier_t *barrier;
+} args;
+
+void *read_loop (void *param) {
+  args *a = (args *) param;
+  long (*read) (reader *) = a->v->read;
+  long reads = 0;
+
+  pthread_barrier_wait(a->barrier);
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    if (read(a->r) < 0) {
+      fprintf(stderr, "%s : table incohérente\n", a->v->name);
+      exit(EXIT_FAILURE);
+    }
+    reads++;
+  }
+  a->r->reads = reads;
+  return NULL;
+}
+
+void *write_loop (void *param) {
+  args *a = (args *) param;
+  struct timespec pause = {0, a->interval};
+  long v = 1;
+
+  pthread_barrier_wait(a->barrier);
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    long start = now();
+    a->v->update(v++);
+    a->update_time += now() - start;
+    a->updates++;
+    if (a->interval > 0) {
+      nanosleep(&pause, NULL);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * \brief Lance `n` lecteurs et éventuellement un rédacteur pendant
+ *        `DURATION` ms
+ *
+ * \param write_time reçoit le temps moyen d'une mise à jour
+ * \return le nombre de lectures par µs
+ */
+long run (timer *t, const variant *v, const rate *rt, int n, long *write_time) {
+  readers = (reader *) aligned_alloc(64, sizeof(reader) * n);
+  args *a = (args *) calloc(n + 1, sizeof(args));
+  if (readers == NULL || a == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  memset(readers, 0, sizeof(reader) * n);
+  nreaders = n;
+  nretired = 0;
+  atomic_store(&stop, 0);
+  atomic_store(&seq, 0);
+  atomic_store(&epoch, 1);
+  pthread_rwlock_init(&rwlock, NULL);
+  fixed = table_alloc(0);
+  atomic_store(&current, table_alloc(0));
+
+  int writer = rt->interval >= 0;
+  pthread_t wthread;
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, n + writer + 1);
+  int i;
+  for (i = 0; i < n; i++) {
+    a[i].v = v;
+    a[i].r = &readers[i];
+    a[i].barrier = &barrier;
+    if (pthread_create(&readers[i].thread, NULL, read_loop, &a[i]) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (writer) {
+    a[n].v = v;
+    a[n].interval = rt->interval;
+    a[n].barrier = &barrier;
+    if (pthread_create(&wthread, NULL, write_loop, &a[n]) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  struct timespec duration = {DURATION / 1000, (DURATION % 1000) * 1000000L};
+  pthread_barrier_wait(&barrier);
+  start_timer(t);
+  nanosleep(&duration, NULL);
+  atomic_store(&stop, 1);
+  for (i = 0; i < n; i++) {
+    pthread_join(readers[i].thread, NULL);
+  }
+  long time = stop_timer(t);
+  if (writer) {
+    pthread_join(wthread, NULL);
+  }
+
+  long reads = 0;
+  for (i = 0; i < n; i++) {
+    reads += readers[i].reads;
+  }
+  *write_time = a[n].updates > 0 ? a[n].update_time / a[n].updates : 0;
+
+  pthread_barrier_destroy(&barrier);
+  pthread_rwlock_destroy(&rwlock);
+  free(fixed);
+  free(atomic_load(&current));
+  for (i = 0; i < nretired; i++) {
+    free(retired[i]);
+  }
+  free(readers);
+  free(a);
+  return time > 0 ? reads * 1000 / time : 0;
+}
+
+int main (int argc, char *argv[]) {
+  int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpu < 1) {
+    ncpu = 1;
+  }
+  if (ncpu > MAX_READERS) {
+    ncpu = MAX_READERS;
+  }
+
+  timer *t = timer_alloc();
+  unsigned int i, j;
+  for (i = 0; i < NVARIANTS; i++) {
+    for (j = 0; j < NRATES; j++) {
+      char name[64];
+      snprintf(name, sizeof(name), "%s-read-%s.csv", variants[i].name,
+          rates[j].name);
+      recorder *read_rec = recorder_alloc(name);
+      recorder *write_rec = NULL;
+      if (rates[j].interval >= 0) {
+        snprintf(name, sizeof(name), "%s-write-%s.csv", variants[i].name,
+            rates[j].name);
+        write_rec = recorder_alloc(name);
+      }
+
+      int n;
+      for (n = 1; ; n = (n * 2 > ncpu && n < ncpu) ? ncpu : n * 2) {
+        long write_time;
+        long tput = run(t, &variants[i], &rates[j], n, &write_time);
+        write_value(read_rec, n, tput);
+        if (write_rec != NULL) {
+          write_value(write_rec, n, write_time);
+        }
+        if (n >= ncpu) {
+          break;
+        }
+      }
+
+      recorder_free(read_rec);
+      if (write_rec != NULL) {
+        recorder_free(write_rec);
+      }
+    }
+    printf("%s\n", variants[i].name);
+  }
+  timer_free(t);
+
+  return EXIT_SUCCESS;
+}
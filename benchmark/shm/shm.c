@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/shm.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <err.h>
@@ -32,7 +33,10 @@ int main (int argc, char *argv[])  {
 	pthread_t thread;
 	
 	int i;
+	memstat mem;
 	for (i=100; i<=ARRAY_LEN; i+=100) {
+		memstat_reset(&mem);
+		memstat_start(&mem);
 		start_timer(t);
 		int* array = (int*)malloc(sizeof(int)*i);
 		
@@ -47,7 +51,9 @@ int main (int argc, char *argv[])  {
 			pthread_create(&thread,NULL,work,(void*)array);
 			pthread_join(thread,NULL);
 		}
-		write_record_n(heap_rec,i,stop_timer(t),ARRAY_LEN);
+		long time = stop_timer(t);
+		memstat_stop(&mem);
+		write_record_mem(heap_rec,i,time,ARRAY_LEN,&mem);
 		free(array);
 	}
 	
@@ -58,6 +64,8 @@ int main (int argc, char *argv[])  {
 		int* array = shmat(shm_id,NULL,0);
 		//if (array = -1) err(-1, "erreur lors de shmat");
 		
+		memstat_reset(&mem);
+		memstat_start(&mem);
 		start_timer(t);
 		
 		int k;
@@ -95,7 +103,9 @@ int main (int argc, char *argv[])  {
 				waitpid(pid,NULL,0);
 			}
 		}
-		write_record_n(shm_rec,i,stop_timer(t),ARRAY_LEN);
+		long time = stop_timer(t);
+		memstat_stop(&mem);
+		write_record_mem(shm_rec,i,time,ARRAY_LEN,&mem);
 		int ctl = shmctl(shm_id, IPC_RMID, NULL);
 		if (ctl < 0) err(ctl,"erreur lors de shmctl");
 		int dt = shmdt(array);
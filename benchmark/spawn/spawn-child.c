@@ -0,0 +1,13 @@
+/**
+ * \file spawn-child.c
+ * \brief Programme lancé par `spawn` : il se termine immédiatement
+ *
+ * Il ne fait rien pour que le temps mesuré par `spawn` soit celui de la
+ * création du processus, de l'`exec` et de la terminaison.
+ */
+
+#include <stdlib.h>
+
+int main (int argc, char *argv[]) {
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,322 @@
+/**
+ * \file spawn.c
+ * \brief Compare les manières de lancer un programme en fonction de la
+ *        taille du processus père
+ *
+ * `fork.c` mesure `fork` depuis un tout petit processus et `shell.c` passe
+ * par `system`, ce qui ajoute le lancement de `/bin/sh` à chaque mesure.
+ * Ici le père occupe de plus en plus de mémoire (`RSS`) et lance
+ * `spawn-child`, qui se termine directement, avec
+ * * `fork` puis `execv` : toutes les tables de pages du père sont copiées;
+ * * `vfork` puis `execv` : le fils emprunte la mémoire du père, qui est
+ *   suspendu jusqu'à l'`exec`;
+ * * `posix_spawn` : la glibc utilise elle-même un `clone` avec `CLONE_VM`;
+ * * `clone(CLONE_VM | CLONE_VFORK)` avec une pile dédiée au fils;
+ * * un serveur de fork : un processus créé au début, quand le père est
+ *   encore petit, reçoit les commandes sur une `socketpair`, fait
+ *   `fork` et `execv` et renvoie le statut de sortie.
+ *
+ * Pour `clone`, on utilise l'enveloppe de la glibc plutôt que `clone3`
+ * directement : la glibc n'a pas d'enveloppe pour `clone3` et un `syscall`
+ * brut avec `CLONE_VM` ne peut pas revenir dans du code C dans le fils.
+ * Les deux appels aboutissent au même code dans le noyau.
+ *
+ * On mesure pour chaque méthode
+ * * la latence : `N` lancements successifs, chacun attendu avec `waitpid`
+ *   avant le suivant;
+ * * le débit : `N` lancements sans attendre puis `N` `waitpid`.
+ *
+ * Le premier argument optionnel est la taille maximale du père en MiB.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "benchmark.h"
+
+#define N 200                //!< Nombre de lancements par mesure
+#define MAX_RSS 1024         //!< Taille maximale par défaut du père en MiB
+#define MIB 0x100000
+#define STACK_SIZE 0x10000   //!< Pile du fils pour `clone` (64 KiB)
+#define CHILD "./spawn-child"
+
+extern char **environ;
+
+static char *child_argv[] = {CHILD, NULL};
+
+/**
+ * \brief Une méthode de lancement : retourne le `pid` du fils
+ */
+typedef pid_t (*spawn_fun) ();
+
+/**
+ * \brief Attend le fils `pid` et vérifie qu'il s'est bien terminé
+ */
+void reap (pid_t pid) {
+  int status;
+  if (waitpid(pid, &status, 0) == -1) {
+    perror("waitpid");
+    exit(EXIT_FAILURE);
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    fprintf(stderr, "%s ne s'est pas terminé correctement\n", CHILD);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * \brief Lance `CHILD` avec `fork` et `execv`
+ */
+pid_t spawn_fork () {
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    execv(CHILD, child_argv);
+    _exit(127);
+  }
+  return pid;
+}
+
+/**
+ * \brief Lance `CHILD` avec `vfork` et `execv`
+ *
+ * Le fils ne peut appeler que `execv` ou `_exit` puisqu'il partage
+ * la pile et la mémoire du père.
+ */
+pid_t spawn_vfork () {
+  pid_t pid = vfork();
+  if (pid == -1) {
+    perror("vfork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    execv(CHILD, child_argv);
+    _exit(127);
+  }
+  return pid;
+}
+
+/**
+ * \brief Lance `CHILD` avec `posix_spawn`
+ */
+pid_t spawn_posix () {
+  pid_t pid;
+  int err = posix_spawn(&pid, CHILD, NULL, NULL, child_argv, environ);
+  if (err != 0) {
+    fprintf(stderr, "posix_spawn: %s\n", strerror(err));
+    exit(EXIT_FAILURE);
+  }
+  return pid;
+}
+
+static char *clone_stack = NULL;
+
+/**
+ * \brief Point d'entrée du fils créé par `clone`, sur sa propre pile
+ */
+int clone_child (void *arg) {
+  execv(CHILD, child_argv);
+  _exit(127);
+}
+
+/**
+ * \brief Lance `CHILD` avec `clone(CLONE_VM | CLONE_VFORK)`
+ *
+ * Le père est suspendu jusqu'à l'`exec` du fils (comme `vfork`) donc
+ * une seule pile suffit pour tous les fils.
+ */
+pid_t spawn_clone () {
+  pid_t pid = clone(clone_child, clone_stack + STACK_SIZE,
+      CLONE_VM | CLONE_VFORK | SIGCHLD, NULL);
+  if (pid == -1) {
+    perror("clone");
+    exit(EXIT_FAILURE);
+  }
+  return pid;
+}
+
+/**
+ * \brief Boucle du serveur de fork
+ *
+ * Chaque commande est un `int` : le nombre de fils à lancer sans attendre.
+ * Une fois qu'ils sont tous terminés, le serveur renvoie ce nombre.
+ * Il s'arrête quand le père ferme la `socket`.
+ */
+void fork_server (int sock) {
+  int n, i;
+  pid_t pids[N];
+  while (read(sock, &n, sizeof(n)) == sizeof(n)) {
+    for (i = 0; i < n; i++) {
+      pids[i] = spawn_fork();
+    }
+    for (i = 0; i < n; i++) {
+      reap(pids[i]);
+    }
+    if (write(sock, &n, sizeof(n)) != sizeof(n)) {
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+  }
+  exit(EXIT_SUCCESS);
+}
+
+/**
+ * \brief Demande au serveur de fork de lancer `n` fils et attend la réponse
+ */
+void ask_server (int sock, int n) {
+  int done;
+  if (write(sock, &n, sizeof(n)) != sizeof(n)) {
+    perror("write");
+    exit(EXIT_FAILURE);
+  }
+  if (read(sock, &done, sizeof(done)) != sizeof(done) || done != n) {
+    perror("read");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * \brief Mesure la latence et le débit de la méthode `fun`
+ *
+ * \param x l'abscisse, la taille du père en MiB
+ */
+void benchmark_spawn (timer *t, spawn_fun fun, recorder *lat_rec,
+    recorder *tput_rec, long x) {
+  pid_t pids[N];
+  int i;
+
+  start_timer(t);
+  for (i = 0; i < N; i++) {
+    reap(fun());
+  }
+  write_record_n(lat_rec, x, stop_timer(t), N);
+
+  start_timer(t);
+  for (i = 0; i < N; i++) {
+    pids[i] = fun();
+  }
+  for (i = 0; i < N; i++) {
+    reap(pids[i]);
+  }
+  write_record_n(tput_rec, x, stop_timer(t), N);
+}
+
+/**
+ * \brief Comme `benchmark_spawn` mais en passant par le serveur de fork
+ */
+void benchmark_server (timer *t, int sock, recorder *lat_rec,
+    recorder *tput_rec, long x) {
+  int i;
+
+  start_timer(t);
+  for (i = 0; i < N; i++) {
+    ask_server(sock, 1);
+  }
+  write_record_n(lat_rec, x, stop_timer(t), N);
+
+  start_timer(t);
+  ask_server(sock, N);
+  write_record_n(tput_rec, x, stop_timer(t), N);
+}
+
+int main (int argc, char *argv[]) {
+  long max_rss = argc > 1 ? atol(argv[1]) : MAX_RSS;
+
+  if (access(CHILD, X_OK) == -1) {
+    perror(CHILD);
+    return EXIT_FAILURE;
+  }
+
+  // le serveur est créé quand le père est encore petit
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+    perror("socketpair");
+    return EXIT_FAILURE;
+  }
+  pid_t server = fork();
+  if (server == -1) {
+    perror("fork");
+    return EXIT_FAILURE;
+  }
+  if (server == 0) {
+    close(sv[0]);
+    fork_server(sv[1]);
+  }
+  close(sv[1]);
+
+  clone_stack = (char *) malloc(STACK_SIZE);
+  if (clone_stack == NULL) {
+    perror("malloc");
+    return EXIT_FAILURE;
+  }
+
+  timer *t = timer_alloc();
+  recorder *fork_lat_rec = recorder_alloc("fork-lat.csv");
+  recorder *fork_tput_rec = recorder_alloc("fork-tput.csv");
+  recorder *vfork_lat_rec = recorder_alloc("vfork-lat.csv");
+  recorder *vfork_tput_rec = recorder_alloc("vfork-tput.csv");
+  recorder *posix_lat_rec = recorder_alloc("posix_spawn-lat.csv");
+  recorder *posix_tput_rec = recorder_alloc("posix_spawn-tput.csv");
+  recorder *clone_lat_rec = recorder_alloc("clone-lat.csv");
+  recorder *clone_tput_rec = recorder_alloc("clone-tput.csv");
+  recorder *server_lat_rec = recorder_alloc("server-lat.csv");
+  recorder *server_tput_rec = recorder_alloc("server-tput.csv");
+
+  long rss;
+  for (rss = 0; rss <= max_rss; rss = (rss == 0) ? 16 : rss * 2) {
+    // la mémoire est touchée pour qu'elle soit vraiment dans le RSS
+    char *ballast = NULL;
+    if (rss > 0) {
+      ballast = (char *) mmap(NULL, rss * MIB, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (ballast == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+      }
+      memset(ballast, 1, rss * MIB);
+    }
+    printf("%ld MiB\n", rss);
+
+    benchmark_spawn(t, spawn_fork, fork_lat_rec, fork_tput_rec, rss);
+    benchmark_spawn(t, spawn_vfork, vfork_lat_rec, vfork_tput_rec, rss);
+    benchmark_spawn(t, spawn_posix, posix_lat_rec, posix_tput_rec, rss);
+    benchmark_spawn(t, spawn_clone, clone_lat_rec, clone_tput_rec, rss);
+    benchmark_server(t, sv[0], server_lat_rec, server_tput_rec, rss);
+
+    if (ballast != NULL && munmap(ballast, rss * MIB) == -1) {
+      perror("munmap");
+      return EXIT_FAILURE;
+    }
+  }
+
+  // arrête le serveur de fork
+  close(sv[0]);
+  reap(server);
+
+  recorder_free(fork_lat_rec);
+  recorder_free(fork_tput_rec);
+  recorder_free(vfork_lat_rec);
+  recorder_free(vfork_tput_rec);
+  recorder_free(posix_lat_rec);
+  recorder_free(posix_tput_rec);
+  recorder_free(clone_lat_rec);
+  recorder_free(clone_tput_rec);
+  recorder_free(server_lat_rec);
+  recorder_free(server_tput_rec);
+  timer_free(t);
+  free(clone_stack);
+
+  return EXIT_SUCCESS;
+}
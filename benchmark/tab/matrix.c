@@ -0,0 +1,547 @@
+/**
+	\file matrix.c
+	\brief Produit et transposée de matrices, comparés au roofline mesuré de la machine
+
+	`tab.c` ne fait qu'additionner les éléments : chaque élément n'est utilisé qu'une fois, seule la bande passante compte. Le produit de deux matrices `n` x `n` fait `2n³` opérations sur `3n²` éléments : chaque élément peut être réutilisé `n` fois, si l'ordre des boucles le permet.
+
+	Produit `C = A B` (`double`) :
+		* `naive` : boucles `i, j, k`, `B` est lue colonne par colonne;
+		* `interchange` : boucles `i, k, j`, les trois matrices sont lues ligne par ligne;
+		* `blocked` : `interchange` par blocs de `BLOCK` x `BLOCK` qui tiennent dans le cache L1;
+		* `avx2` : un micro-noyau AVX2/FMA calcule un bloc de 4 x 8 de `C` dans 8 registres, sur des panneaux de `KC` lignes de `B` qui tiennent dans le cache L2;
+		* `threads` : `avx2` avec les lignes de `C` réparties entre un thread par CPU.
+
+	Transposée `B = Aᵀ` :
+		* `naive` : `A` est lue ligne par ligne, `B` est écrite colonne par colonne;
+		* `blocked` : par tuiles de `TILE` x `TILE`;
+		* `threads` : `blocked` avec les tuiles réparties entre un thread par CPU.
+
+	Le roofline est mesuré au début, avec 1 thread et avec un thread par CPU : la bande passante mémoire avec la triade de STREAM (`a = b + s c`) sur des tableaux plus grands que le cache, et la puissance de calcul avec des chaînes indépendantes de FMA AVX2. On enregistre
+		* `roofline-bw.csv` (MB/s) et `roofline-flops.csv` (MFLOP/s) en fonction du nombre de threads;
+		* `gemm-<noyau>.csv` en MFLOP/s et `transpose-<noyau>.csv` en MB/s, en fonction de `n`;
+		* `gemm-<noyau>-bw.csv` : la bande passante minimale du produit en MB/s, `3n² x 8` bytes (chaque matrice lue ou écrite une fois) sur le temps;
+		* `gemm-<noyau>-roof.csv` et `transpose-<noyau>-roof.csv` : le pourcentage de la borne du roofline atteint.
+
+	Pour le produit, la borne est `min(flops, I x bw)` avec l'intensité arithmétique minimale `I = 2n³ / (3n² x 8)` (chaque matrice lue ou écrite une seule fois). Pour la transposée, c'est la bande passante (`2n² x 8` bytes).
+
+	Note : sans AVX2/FMA, `avx2` et `threads` utilisent le noyau `blocked`. Hors x86, le noyau `avx2` n'est pas compilé : `gemm-avx2.csv` reste vide, `threads` utilise `blocked` et la puissance de calcul est mesurée en scalaire.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "benchmark.h"
+
+#define GEMM_MIN 64
+#define GEMM_MAX 1024
+#define TRANSPOSE_MIN 256
+#define TRANSPOSE_MAX 4096
+#define MIN_FLOPS (1L << 30)	// opérations au minimum par mesure du produit
+#define MIN_BYTES (1L << 30)	// bytes au minimum par mesure de la transposée
+#define BLOCK 64
+#define KC 128
+#define TILE 32
+#define STREAM_LEN (16L << 20)	// 3 tableaux de 128 MiB, plus grands que le LLC
+#define PEAK_ITER 10000000L
+#define NTHREAD 64
+
+/**
+	\brief Les résultats des calculs, pour que le compilateur ne les supprime pas
+*/
+volatile double sink;
+
+/**
+	\brief Le travail d'un thread : les lignes `[first, last[` de la matrice
+*/
+typedef struct work {
+	int first, last;
+	int n;
+	const double *a, *b;
+	double *c;
+	long iter;
+	double result;
+} work;
+
+/**
+	\brief Lance `fn` sur `nthreads` threads, chacun avec une tranche des `n` lignes (multiple de `align`)
+*/
+void parallel(int nthreads, void *(*fn)(void *), work *model, int n, int align) {
+	pthread_t threads[NTHREAD];
+	work w[NTHREAD];
+	int chunk = (n / align + nthreads - 1) / nthreads * align;
+	int i;
+	for (i = 0; i < nthreads; i++) {
+		w[i] = *model;
+		w[i].first = i * chunk < n ? i * chunk : n;
+		w[i].last = (i + 1) * chunk < n ? (i + 1) * chunk : n;
+		if (pthread_create(&threads[i], NULL, fn, &w[i]) != 0) {
+			perror("pthread_create fail");
+			exit(EXIT_FAILURE);
+		}
+	}
+	model->result = 0;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], NULL);
+		model->result += w[i].result;
+	}
+}
+
+/* ---------------------------------------------------------------- roofline */
+
+/**
+	\brief Triade de STREAM sur la tranche du thread : `a = b + 3 c`
+*/
+void *triad(void *param) {
+	work *w = (work *) param;
+	double *a = w->c;
+	const double *b = w->a, *c = w->b;
+	long i;
+	for (i = w->first; i < w->last; i++)
+		a[i] = b[i] + 3.0 * c[i];
+	return NULL;
+}
+
+/**
+	\brief Premier accès aux pages par le thread qui les utilisera
+*/
+void *first_touch(void *param) {
+	work *w = (work *) param;
+	long i;
+	for (i = w->first; i < w->last; i++) {
+		w->c[i] = 0;
+		((double *) w->a)[i] = 1;
+		((double *) w->b)[i] = 2;
+	}
+	return NULL;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+	\brief 12 chaînes indépendantes de FMA sur 4 `double`, assez pour couvrir la latence des deux unités FMA
+*/
+__attribute__((target("avx2,fma")))
+void *peak_avx2(void *param) {
+	work *w = (work *) param;
+	__m256d x = _mm256_set1_pd(0.999999), y = _mm256_set1_pd(1e-9);
+	// des variables plutôt qu'un tableau, pour qu'elles restent dans les registres
+	__m256d a0 = _mm256_set1_pd(0), a1 = _mm256_set1_pd(1), a2 = _mm256_set1_pd(2), a3 = _mm256_set1_pd(3);
+	__m256d a4 = _mm256_set1_pd(4), a5 = _mm256_set1_pd(5), a6 = _mm256_set1_pd(6), a7 = _mm256_set1_pd(7);
+	__m256d a8 = _mm256_set1_pd(8), a9 = _mm256_set1_pd(9), a10 = _mm256_set1_pd(10), a11 = _mm256_set1_pd(11);
+	long i;
+	for (i = 0; i < w->iter; i++) {
+		a0 = _mm256_fmadd_pd(a0, x, y);
+		a1 = _mm256_fmadd_pd(a1, x, y);
+		a2 = _mm256_fmadd_pd(a2, x, y);
+		a3 = _mm256_fmadd_pd(a3, x, y);
+		a4 = _mm256_fmadd_pd(a4, x, y);
+		a5 = _mm256_fmadd_pd(a5, x, y);
+		a6 = _mm256_fmadd_pd(a6, x, y);
+		a7 = _mm256_fmadd_pd(a7, x, y);
+		a8 = _mm256_fmadd_pd(a8, x, y);
+		a9 = _mm256_fmadd_pd(a9, x, y);
+		a10 = _mm256_fmadd_pd(a10, x, y);
+		a11 = _mm256_fmadd_pd(a11, x, y);
+	}
+	a0 = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(a0, a1), _mm256_add_pd(a2, a3)),
+			_mm256_add_pd(_mm256_add_pd(a4, a5), _mm256_add_pd(a6, a7)));
+	a0 = _mm256_add_pd(a0, _mm256_add_pd(_mm256_add_pd(a8, a9), _mm256_add_pd(a10, a11)));
+	double out[4];
+	_mm256_storeu_pd(out, a0);
+	w->result = out[0] + out[1] + out[2] + out[3];
+	return NULL;
+}
+#endif
+
+/**
+	\brief Comme `peak_avx2` en scalaire, pour les processeurs sans AVX2
+*/
+void *peak_scalar(void *param) {
+	work *w = (work *) param;
+	double acc[12];
+	int j;
+	for (j = 0; j < 12; j++)
+		acc[j] = j;
+	long i;
+	for (i = 0; i < w->iter; i++)
+		for (j = 0; j < 12; j++)
+			acc[j] = acc[j] * 0.999999 + 1e-9;
+	w->result = 0;
+	for (j = 0; j < 12; j++)
+		w->result += acc[j];
+	return NULL;
+}
+
+int has_avx2;
+
+/**
+	\brief Mesure la bande passante (MB/s) et la puissance de calcul (MFLOP/s) avec `nthreads` threads
+*/
+void roofline(timer *t, int nthreads, long *bw, long *flops) {
+	double *a = aligned_alloc(64, STREAM_LEN * sizeof(double));
+	double *b = aligned_alloc(64, STREAM_LEN * sizeof(double));
+	double *c = aligned_alloc(64, STREAM_LEN * sizeof(double));
+	if (a == NULL || b == NULL || c == NULL) {
+		perror("malloc fail");
+		exit(EXIT_FAILURE);
+	}
+	work w = {0, 0, 0, b, c, a, 0, 0};
+	parallel(nthreads, first_touch, &w, STREAM_LEN, 8);
+	long best = -1;
+	int r;
+	for (r = 0; r < 5; r++) {
+		start_timer(t);
+		parallel(nthreads, triad, &w, STREAM_LEN, 8);
+		long time = stop_timer(t);
+		if (best == -1 || time < best)
+			best = time;
+	}
+	sink += a[STREAM_LEN / 2];
+	*bw = 3 * sizeof(double) * STREAM_LEN * 1000 / best;
+	free(a);
+	free(b);
+	free(c);
+
+	// chaque thread fait PEAK_ITER itérations, `first` et `last` ne servent pas
+	w.iter = PEAK_ITER;
+	start_timer(t);
+	void *(*peak)(void *) = peak_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+	if (has_avx2)
+		peak = peak_avx2;
+#endif
+	parallel(nthreads, peak, &w, nthreads, 1);
+	long time = stop_timer(t);
+	sink += w.result;
+	*flops = (double) PEAK_ITER * 12 * (has_avx2 ? 8 : 2) * nthreads * 1000 / time;
+}
+
+/* -------------------------------------------------------------------- GEMM */
+
+/**
+	\brief Boucles `i, j, k` : le produit scalaire d'une ligne de `A` et d'une colonne de `B`
+*/
+void gemm_naive(const double *a, const double *b, double *c, int n, int first, int last) {
+	int i, j, k;
+	for (i = first; i < last; i++)
+		for (j = 0; j < n; j++) {
+			double s = 0;
+			for (k = 0; k < n; k++)
+				s += a[(long) i * n + k] * b[(long) k * n + j];
+			c[(long) i * n + j] = s;
+		}
+}
+
+/**
+	\brief Boucles `i, k, j` : on ajoute à la ligne `i` de `C` la ligne `k` de `B` multipliée par `A[i][k]`
+*/
+void gemm_interchange(const double *a, const double *b, double *c, int n, int first, int last) {
+	int i, j, k;
+	memset(c + (long) first * n, 0, (long) (last - first) * n * sizeof(double));
+	for (i = first; i < last; i++)
+		for (k = 0; k < n; k++) {
+			double aik = a[(long) i * n + k];
+			for (j = 0; j < n; j++)
+				c[(long) i * n + j] += aik * b[(long) k * n + j];
+		}
+}
+
+/**
+	\brief `gemm_interchange` par blocs de `BLOCK` x `BLOCK`
+*/
+void gemm_blocked(const double *a, const double *b, double *c, int n, int first, int last) {
+	int i, j, k, ii, jj, kk;
+	memset(c + (long) first * n, 0, (long) (last - first) * n * sizeof(double));
+	for (ii = first; ii < last; ii += BLOCK)
+		for (kk = 0; kk < n; kk += BLOCK)
+			for (jj = 0; jj < n; jj += BLOCK)
+				for (i = ii; i < ii + BLOCK && i < last; i++)
+					for (k = kk; k < kk + BLOCK && k < n; k++) {
+						double aik = a[(long) i * n + k];
+						for (j = jj; j < jj + BLOCK && j < n; j++)
+							c[(long) i * n + j] += aik * b[(long) k * n + j];
+					}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+	\brief Micro-noyau : `C[i..i+4][j..j+8] += A[i..i+4][k0..k1] B[k0..k1][j..j+8]` dans 8 registres
+*/
+__attribute__((target("avx2,fma")))
+static inline void kernel_4x8(const double *a, const double *b, double *c, int n, int i, int j, int k0, int k1) {
+	__m256d c00 = _mm256_loadu_pd(c + (long) i * n + j);
+	__m256d c01 = _mm256_loadu_pd(c + (long) i * n + j + 4);
+	__m256d c10 = _mm256_loadu_pd(c + (long) (i + 1) * n + j);
+	__m256d c11 = _mm256_loadu_pd(c + (long) (i + 1) * n + j + 4);
+	__m256d c20 = _mm256_loadu_pd(c + (long) (i + 2) * n + j);
+	__m256d c21 = _mm256_loadu_pd(c + (long) (i + 2) * n + j + 4);
+	__m256d c30 = _mm256_loadu_pd(c + (long) (i + 3) * n + j);
+	__m256d c31 = _mm256_loadu_pd(c + (long) (i + 3) * n + j + 4);
+	int k;
+	for (k = k0; k < k1; k++) {
+		__m256d b0 = _mm256_loadu_pd(b + (long) k * n + j);
+		__m256d b1 = _mm256_loadu_pd(b + (long) k * n + j + 4);
+		__m256d a0 = _mm256_broadcast_sd(a + (long) i * n + k);
+		__m256d a1 = _mm256_broadcast_sd(a + (long) (i + 1) * n + k);
+		__m256d a2 = _mm256_broadcast_sd(a + (long) (i + 2) * n + k);
+		__m256d a3 = _mm256_broadcast_sd(a + (long) (i + 3) * n + k);
+		c00 = _mm256_fmadd_pd(a0, b0, c00);
+		c01 = _mm256_fmadd_pd(a0, b1, c01);
+		c10 = _mm256_fmadd_pd(a1, b0, c10);
+		c11 = _mm256_fmadd_pd(a1, b1, c11);
+		c20 = _mm256_fmadd_pd(a2, b0, c20);
+		c21 = _mm256_fmadd_pd(a2, b1, c21);
+		c30 = _mm256_fmadd_pd(a3, b0, c30);
+		c31 = _mm256_fmadd_pd(a3, b1, c31);
+	}
+	_mm256_storeu_pd(c + (long) i * n + j, c00);
+	_mm256_storeu_pd(c + (long) i * n + j + 4, c01);
+	_mm256_storeu_pd(c + (long) (i + 1) * n + j, c10);
+	_mm256_storeu_pd(c + (long) (i + 1) * n + j + 4, c11);
+	_mm256_storeu_pd(c + (long) (i + 2) * n + j, c20);
+	_mm256_storeu_pd(c + (long) (i + 2) * n + j + 4, c21);
+	_mm256_storeu_pd(c + (long) (i + 3) * n + j, c30);
+	_mm256_storeu_pd(c + (long) (i + 3) * n + j + 4, c31);
+}
+
+/**
+	\brief Produit par panneaux de `KC` lignes de `B` avec le micro-noyau 4 x 8 (`n` multiple de 8, lignes multiples de 4)
+*/
+__attribute__((target("avx2,fma")))
+void gemm_avx2(const double *a, const double *b, double *c, int n, int first, int last) {
+	int i, j, kk;
+	memset(c + (long) first * n, 0, (long) (last - first) * n * sizeof(double));
+	for (kk = 0; kk < n; kk += KC) {
+		int k1 = kk + KC < n ? kk + KC : n;
+		for (i = first; i < last; i += 4)
+			for (j = 0; j < n; j += 8)
+				kernel_4x8(a, b, c, n, i, j, kk, k1);
+	}
+}
+#endif
+
+typedef void (*gemm_kernel)(const double *a, const double *b, double *c, int n, int first, int last);
+
+gemm_kernel gemm_best;
+
+void *gemm_thread(void *param) {
+	work *w = (work *) param;
+	gemm_best(w->a, w->b, w->c, w->n, w->first, w->last);
+	return NULL;
+}
+
+int nthreads;
+
+void gemm_threads(const double *a, const double *b, double *c, int n, int first, int last) {
+	work w = {first, last, n, a, b, c, 0, 0};
+	parallel(nthreads, gemm_thread, &w, n, 4);
+}
+
+/* --------------------------------------------------------------- transpose */
+
+/**
+	\brief `B[j][i] = A[i][j]` : écriture colonne par colonne
+*/
+void transpose_naive(const double *a, double *b, int n, int first, int last) {
+	int i, j;
+	for (i = first; i < last; i++)
+		for (j = 0; j < n; j++)
+			b[(long) j * n + i] = a[(long) i * n + j];
+}
+
+/**
+	\brief Transposée par tuiles de `TILE` x `TILE` : les lignes de cache de la tuile de `B` sont remplies avant d'être évincées
+*/
+void transpose_blocked(const double *a, double *b, int n, int first, int last) {
+	int i, j, ii, jj;
+	for (ii = first; ii < last; ii += TILE)
+		for (jj = 0; jj < n; jj += TILE)
+			for (i = ii; i < ii + TILE && i < last; i++)
+				for (j = jj; j < jj + TILE && j < n; j++)
+					b[(long) j * n + i] = a[(long) i * n + j];
+}
+
+void *transpose_thread(void *param) {
+	work *w = (work *) param;
+	transpose_blocked(w->a, w->c, w->n, w->first, w->last);
+	return NULL;
+}
+
+void transpose_threads(const double *a, double *b, int n, int first, int last) {
+	work w = {first, last, n, a, NULL, b, 0, 0};
+	parallel(nthreads, transpose_thread, &w, n, TILE);
+}
+
+typedef void (*transpose_kernel)(const double *a, double *b, int n, int first, int last);
+
+/* -------------------------------------------------------------------- main */
+
+typedef struct gemm_desc {
+	const char *name;
+	gemm_kernel kernel;
+	int threaded;
+} gemm_desc;
+
+typedef struct transpose_desc {
+	const char *name;
+	transpose_kernel kernel;
+	int threaded;
+} transpose_desc;
+
+double *matrix_alloc(int n) {
+	double *m = aligned_alloc(64, (long) n * n * sizeof(double));
+	if (m == NULL) {
+		perror("malloc fail");
+		exit(EXIT_FAILURE);
+	}
+	return m;
+}
+
+recorder *open_rec(const char *prefix, const char *name, const char *suffix) {
+	char file[64];
+	snprintf(file, sizeof(file), "%s-%s%s.csv", prefix, name, suffix);
+	return recorder_alloc(file);
+}
+
+int main (int argc, char *argv[])  {
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > NTHREAD) nthreads = NTHREAD;
+	gemm_kernel avx2 = NULL;	// pas de noyau avx2 hors x86
+	gemm_best = gemm_blocked;
+#if defined(__x86_64__) || defined(__i386__)
+	has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	if (has_avx2)
+		gemm_best = gemm_avx2;
+	avx2 = gemm_best;
+#endif
+
+	gemm_desc gemms[] = {
+		{"naive", gemm_naive, 0},
+		{"interchange", gemm_interchange, 0},
+		{"blocked", gemm_blocked, 0},
+		{"avx2", avx2, 0},
+		{"threads", gemm_threads, 1},
+	};
+	transpose_desc transposes[] = {
+		{"naive", transpose_naive, 0},
+		{"blocked", transpose_blocked, 0},
+		{"threads", transpose_threads, 1},
+	};
+	int ngemm = sizeof(gemms) / sizeof(gemms[0]);
+	int ntranspose = sizeof(transposes) / sizeof(transposes[0]);
+
+	timer *t = timer_alloc();
+
+	// Le roofline, avec 1 thread (index 0) et un thread par CPU (index 1)
+	long bw[2], flops[2];
+	recorder *bw_rec = recorder_alloc("roofline-bw.csv");
+	recorder *flops_rec = recorder_alloc("roofline-flops.csv");
+	roofline(t, 1, &bw[0], &flops[0]);
+	roofline(t, nthreads, &bw[1], &flops[1]);
+	write_value(bw_rec, 1, bw[0]);
+	write_value(flops_rec, 1, flops[0]);
+	if (nthreads > 1) {
+		write_value(bw_rec, nthreads, bw[1]);
+		write_value(flops_rec, nthreads, flops[1]);
+	}
+	recorder_free(bw_rec);
+	recorder_free(flops_rec);
+	printf("roofline : %ld MB/s, %ld MFLOP/s (1 thread), %ld MB/s, %ld MFLOP/s (%d threads)\n",
+			bw[0], flops[0], bw[1], flops[1], nthreads);
+
+	int n, g, r;
+	long j;
+	recorder *rec[8], *roof_rec[8], *bw_gemm_rec[8];
+	for (g = 0; g < ngemm; g++) {
+		rec[g] = open_rec("gemm", gemms[g].name, "");
+		roof_rec[g] = open_rec("gemm", gemms[g].name, "-roof");
+		bw_gemm_rec[g] = open_rec("gemm", gemms[g].name, "-bw");
+	}
+	for (n = GEMM_MIN; n <= GEMM_MAX; n *= 2) {
+		double *a = matrix_alloc(n), *b = matrix_alloc(n), *c = matrix_alloc(n), *ref = matrix_alloc(n);
+		for (j = 0; j < (long) n * n; j++) {
+			a[j] = (double) (j % 7) - 3;
+			b[j] = (double) (j % 5) - 2;
+		}
+		gemm_interchange(a, b, ref, n, 0, n);
+
+		double ops = 2.0 * n * n * n;
+		long repeat = ops >= MIN_FLOPS ? 1 : MIN_FLOPS / ops;
+		for (g = 0; g < ngemm; g++) {
+			if (gemms[g].kernel == NULL)
+				continue;
+			start_timer(t);
+			for (r = 0; r < repeat; r++)
+				gemms[g].kernel(a, b, c, n, 0, n);
+			long time = stop_timer(t);
+			for (j = 0; j < (long) n * n; j++)
+				if (fabs(c[j] - ref[j]) > 1e-6) {
+					fprintf(stderr, "gemm %s %d : C[%ld] = %g au lieu de %g\n", gemms[g].name, n, j, c[j], ref[j]);
+					exit(EXIT_FAILURE);
+				}
+			long mflops = ops * repeat * 1000 / time;
+			double bytes = 3.0 * n * n * sizeof(double);
+			double intensity = ops / bytes;
+			double bound = fmin(flops[gemms[g].threaded], intensity * bw[gemms[g].threaded]);
+			write_value(rec[g], n, mflops);
+			write_value(roof_rec[g], n, 100 * mflops / bound);
+			write_value(bw_gemm_rec[g], n, bytes * repeat * 1000 / time);
+		}
+		printf("gemm %d\n", n);
+		free(a);
+		free(b);
+		free(c);
+		free(ref);
+	}
+	for (g = 0; g < ngemm; g++) {
+		recorder_free(rec[g]);
+		recorder_free(roof_rec[g]);
+		recorder_free(bw_gemm_rec[g]);
+	}
+
+	for (g = 0; g < ntranspose; g++) {
+		rec[g] = open_rec("transpose", transposes[g].name, "");
+		roof_rec[g] = open_rec("transpose", transposes[g].name, "-roof");
+	}
+	for (n = TRANSPOSE_MIN; n <= TRANSPOSE_MAX; n *= 2) {
+		double *a = matrix_alloc(n), *b = matrix_alloc(n);
+		for (j = 0; j < (long) n * n; j++)
+			a[j] = j;
+		memset(b, 0, (long) n * n * sizeof(double));
+
+		double bytes = 2.0 * n * n * sizeof(double);
+		long repeat = bytes >= MIN_BYTES ? 1 : MIN_BYTES / bytes;
+		for (g = 0; g < ntranspose; g++) {
+			start_timer(t);
+			for (r = 0; r < repeat; r++)
+				transposes[g].kernel(a, b, n, 0, n);
+			long time = stop_timer(t);
+			for (j = 0; j < (long) n * n; j++)
+				if (b[(j % n) * n + j / n] != a[j]) {
+					fprintf(stderr, "transpose %s %d : élément %ld faux\n", transposes[g].name, n, j);
+					exit(EXIT_FAILURE);
+				}
+			long mbs = bytes * repeat * 1000 / time;
+			write_value(rec[g], n, mbs);
+			write_value(roof_rec[g], n, 100 * mbs / bw[transposes[g].threaded]);
+		}
+		printf("transpose %d\n", n);
+		free(a);
+		free(b);
+	}
+	for (g = 0; g < ntranspose; g++) {
+		recorder_free(rec[g]);
+		recorder_free(roof_rec[g]);
+	}
+
+	timer_free(t);
+
+	return EXIT_SUCCESS;
+}
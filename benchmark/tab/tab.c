@@ -1,112 +1,295 @@
 /**
 	\file tab.c
-	\brief Compare les performances lorsque l'on parcourt un tableau par ligne ou par colonne
+	\brief Compare les performances de différents ordres de parcours d'un tableau à deux dimensions
 
-	Ce programme additionne les valeurs d'un tableau en le parcourant :
-		* Soit par colonne
-		* Soit par ligne
+	Ce programme additionne les valeurs d'un tableau carré de `n` x `n` entiers, stocké ligne par ligne dans une seule zone contiguë, en le parcourant :
+		* `lig` : ligne par ligne, dans l'ordre de la mémoire;
+		* `col` : colonne par colonne, avec un saut de `n` entiers entre deux accès;
+		* `tile<T>` : par tuiles de `T` x `T`, chaque tuile étant parcourue ligne par ligne (cache blocking);
+		* `morton` : dans l'ordre de la courbe de Morton (Z-order);
+		* `hilbert` : dans l'ordre de la courbe de Hilbert.
 
-	Lorsque l'on spécifie un argument pour effectuer les perfs, sur les lignes ou les colonnes, on n'écrit pas dans les records et on ne n'exécute soit les lignes soit les colonnes selon l'arguments reçu.
+	Les deux courbes gardent proches dans le temps des éléments proches dans les deux dimensions, à toutes les échelles, sans devoir choisir une taille de tuile. Leur ordre est calculé une fois par taille dans un tableau d'indices, lu séquentiellement pendant le parcours.
+
+	La taille `n` va de 16 à `MAX_SIZE` (de 1 KiB à 256 MiB) pour dépasser chaque niveau de cache. Chaque mesure parcourt au moins `MIN_ELEMS` éléments. On enregistre le temps pour 1000 éléments dans `tab-<ordre>.csv` et, si les compteurs matériels sont disponibles (`lib/counter.c`), les défauts de cache L1, L2 et du dernier niveau par millier d'éléments dans `tab-<ordre>-l1.csv`, `-l2.csv` et `-llc.csv`. Le L2 n'a pas d'événement générique : `-l2.csv` reste vide si le processeur n'est pas Intel (`COUNTER_L2_MISS`).
+
+	L'option `-t T` remplace les tailles de tuile par défaut par `T`.
+
+	Lorsque l'on spécifie `--ligne`, `--colonne` ou `--<ordre>` pour effectuer les perfs, on n'écrit pas dans les records et on n'exécute que ce parcours sur le plus grand tableau.
 
 	Note : Le plus rapide profite de la localité spatiale
 */
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
-#include <fcntl.h>
 #include <string.h>
-#include <semaphore.h>	
-#include <pthread.h>
 
 #include "benchmark.h"
+#include "counter.h"
 
-#define MAX_SIZE 4000
-#define MULTIPLICATEUR 100
+#define MIN_SIZE 16
+#define MAX_SIZE 8192	// 256 MiB d'entiers
+#define MIN_ELEMS (1L << 26)	// éléments parcourus au minimum par mesure
+#define MAX_TILES 8
 
-timer * t ;
-recorder * lig_rec;
-recorder * col_rec;
-	
+/**
+	\brief Un ordre de parcours
+*/
+typedef struct mode {
+	char name[16];
+	long (*traverse)(const int *tab, int n, const unsigned int *order, int tile);
+	int tile;
+	int curve;	// indice de la table d'ordre utilisée, -1 si aucune
+} mode;
+
+#define MORTON 0
+#define HILBERT 1
 
 /**
-	On parcourt le double tableau par ligne, en retournant le temps nécessaire au parcours du tableau
+	On parcourt le tableau ligne par ligne
 */
-long int ligne(int i, timer *t, int ** tab) {
-	int m,n,res=0;
-	start_timer(t);
-	for(m=0; m<i; m++) 
-		for(n=0; n<i; n++) 	
-			res+= tab[n][m];
-		
-	return stop_timer(t);
+long ligne(const int *tab, int n, const unsigned int *order, int tile) {
+	long res = 0;
+	int x, y;
+	for (y = 0; y < n; y++)
+		for (x = 0; x < n; x++)
+			res += tab[(long) y * n + x];
+	return res;
 }
 
 /**
-	On parcourt le double tableau par colonne, en retournant le temps nécessaire au parcours du tableau
+	On parcourt le tableau colonne par colonne
 */
-long int colonne(int i, timer *t, int ** tab) {
-	int m,n,res=0;
-	start_timer(t);
-	for(m=0; m<i; m++) 
-		for(n=0; n<i; n++) 	
-			res+= tab[m][n];
-		
-	 return stop_timer(t);
+long colonne(const int *tab, int n, const unsigned int *order, int tile) {
+	long res = 0;
+	int x, y;
+	for (x = 0; x < n; x++)
+		for (y = 0; y < n; y++)
+			res += tab[(long) y * n + x];
+	return res;
 }
 
+/**
+	On parcourt le tableau par tuiles de `tile` x `tile`
+*/
+long tuiles(const int *tab, int n, const unsigned int *order, int tile) {
+	long res = 0;
+	int bx, by, x, y;
+	for (by = 0; by < n; by += tile)
+		for (bx = 0; bx < n; bx += tile)
+			for (y = by; y < by + tile && y < n; y++)
+				for (x = bx; x < bx + tile && x < n; x++)
+					res += tab[(long) y * n + x];
+	return res;
+}
+
+/**
+	On parcourt le tableau dans l'ordre donné par `order`
+*/
+long courbe(const int *tab, int n, const unsigned int *order, int tile) {
+	long res = 0;
+	long d;
+	for (d = 0; d < (long) n * n; d++)
+		res += tab[order[d]];
+	return res;
+}
+
+/**
+	\brief Garde un bit sur deux de `d` (les bits pairs), tassés vers la droite
+*/
+static unsigned int compact(unsigned long d) {
+	d &= 0x5555555555555555UL;
+	d = (d | (d >> 1)) & 0x3333333333333333UL;
+	d = (d | (d >> 2)) & 0x0f0f0f0f0f0f0f0fUL;
+	d = (d | (d >> 4)) & 0x00ff00ff00ff00ffUL;
+	d = (d | (d >> 8)) & 0x0000ffff0000ffffUL;
+	d = (d | (d >> 16)) & 0x00000000ffffffffUL;
+	return (unsigned int) d;
+}
+
+/**
+	\brief Remplit `order` avec la courbe de Morton : les bits de `x` et `y` sont entrelacés
+*/
+void morton_order(unsigned int *order, int n) {
+	unsigned long d;
+	for (d = 0; d < (unsigned long) n * n; d++)
+		order[d] = compact(d >> 1) * n + compact(d);
+}
+
+/**
+	\brief Remplit `order` avec la courbe de Hilbert (`n` doit être une puissance de 2)
+
+	Conversion classique de la distance `d` le long de la courbe en coordonnées : à chaque niveau, le quadrant est donné par deux bits de `d` et le sous-carré est tourné ou retourné selon le quadrant.
+*/
+void hilbert_order(unsigned int *order, int n) {
+	unsigned long d;
+	for (d = 0; d < (unsigned long) n * n; d++) {
+		unsigned long t = d;
+		int x = 0, y = 0, s, rx, ry, tmp;
+		for (s = 1; s < n; s *= 2) {
+			rx = 1 & (t / 2);
+			ry = 1 & (t ^ rx);
+			if (ry == 0) {
+				if (rx == 1) {
+					x = s - 1 - x;
+					y = s - 1 - y;
+				}
+				tmp = x;
+				x = y;
+				y = tmp;
+			}
+			x += s * rx;
+			y += s * ry;
+			t /= 4;
+		}
+		order[d] = (unsigned int) y * n + x;
+	}
+}
+
+/**
+	\brief Les résultats de la somme, pour que le compilateur ne supprime pas les parcours
+*/
+volatile long sink;
+
+/**
+	\brief Parcourt `repeat` fois le tableau avec le mode `m`
+
+	\param misses reçoit le nombre de défauts de cache L1, L2 et LLC
+	\return le temps total
+*/
+long mesure(timer *t, counter **ctr, const mode *m, const int *tab, int n, unsigned int **orders, long repeat, long *misses) {
+	long r;
+	int c;
+	for (c = 0; c < 3; c++)
+		counter_start(ctr[c]);
+	start_timer(t);
+	for (r = 0; r < repeat; r++)
+		sink += m->traverse(tab, n, m->curve >= 0 ? orders[m->curve] : NULL, m->tile);
+	long time = stop_timer(t);
+	for (c = 0; c < 3; c++)
+		misses[c] = counter_stop(ctr[c]);
+	return time;
+}
 
 int main (int argc, char *argv[])  {
+	mode modes[4 + MAX_TILES];
+	int nmodes = 0, i;
+	int tiles[MAX_TILES] = {8, 32, 128};
+	int ntiles = 3;
+
 	// Verification des arguments
-  	int perfligne = argc>1 && strncmp(argv[1], "--ligne", 8);
-	int perfcolonne = argc>1 &&strncmp(argv[1], "--colonne", 10);
-
-	timer * t = timer_alloc();
-	if(!perfligne && !perfcolonne) {
-		// Déclare un timer, ainsi que deux recorder qui vont contenir les résultats de l'exécution du programme
-		lig_rec = recorder_alloc("tab-lig.csv");
-	 	col_rec = recorder_alloc("tab-col.csv");
+	const char *perf = NULL;
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			tiles[0] = atoi(argv[++i]);
+			ntiles = 1;
+			if (tiles[0] < 1) {
+				fprintf(stderr, "taille de tuile invalide : %s\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		} else if (strcmp(argv[i], "--ligne") == 0) {
+			perf = "lig";
+		} else if (strcmp(argv[i], "--colonne") == 0) {
+			perf = "col";
+		} else if (strncmp(argv[i], "--", 2) == 0) {
+			perf = argv[i] + 2;
+		}
 	}
 
-	int i,j;
-	long int rescol, reslig;
-	for(i=MULTIPLICATEUR; i<MAX_SIZE ; i+=MULTIPLICATEUR) {
-	
-		if(perfligne || perfcolonne)
-			i = MAX_SIZE;
+	modes[nmodes++] = (mode) {"lig", ligne, 0, -1};
+	modes[nmodes++] = (mode) {"col", colonne, 0, -1};
+	for (i = 0; i < ntiles; i++) {
+		modes[nmodes] = (mode) {"", tuiles, tiles[i], -1};
+		snprintf(modes[nmodes].name, sizeof(modes[nmodes].name), "tile%d", tiles[i]);
+		nmodes++;
+	}
+	modes[nmodes++] = (mode) {"morton", courbe, 0, MORTON};
+	modes[nmodes++] = (mode) {"hilbert", courbe, 0, HILBERT};
 
-		// On crée le tableau
-		int ** tab = malloc(i*sizeof(int*));
-		if(tab == NULL) {
-			perror("malloc fail");
+	int selected = -1;
+	if (perf != NULL) {
+		for (i = 0; i < nmodes; i++)
+			if (strcmp(modes[i].name, perf) == 0)
+				selected = i;
+		if (selected == -1) {
+			fprintf(stderr, "parcours inconnu : %s\n", perf);
 			exit(EXIT_FAILURE);
 		}
-		for(j=0; j<i; j++) 
-			tab[j] = malloc(i*sizeof(int));
+	}
 
-		if(!perfcolonne)
-			reslig = ligne(i, t, tab);
-		if(!perfligne)
-			rescol = colonne(i, t, tab);
+	// Déclare un timer, les compteurs et les records qui vont contenir les résultats de l'exécution du programme
+	timer *t = timer_alloc();
+	counter *ctr[3];
+	ctr[0] = counter_alloc(PERF_TYPE_HW_CACHE, COUNTER_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS));
+	ctr[1] = counter_alloc_raw(COUNTER_L2_MISS_VENDOR, COUNTER_L2_MISS);
+	ctr[2] = counter_alloc(PERF_TYPE_HW_CACHE, COUNTER_CACHE(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS));
+	const char *levels[3] = {"l1", "l2", "llc"};
+	recorder *time_rec[4 + MAX_TILES];
+	recorder *miss_rec[4 + MAX_TILES][3];
+	char name[64];
+	int c;
+	if (selected == -1) {
+		for (i = 0; i < nmodes; i++) {
+			snprintf(name, sizeof(name), "tab-%s.csv", modes[i].name);
+			time_rec[i] = recorder_alloc(name);
+			for (c = 0; c < 3; c++) {
+				snprintf(name, sizeof(name), "tab-%s-%s.csv", modes[i].name, levels[c]);
+				miss_rec[i][c] = recorder_alloc(name);
+			}
+		}
+	}
 
-		if(!perfligne && !perfcolonne) {
-			write_record_n(col_rec, i/MULTIPLICATEUR, rescol, MULTIPLICATEUR);
-			write_record_n(lig_rec, i/MULTIPLICATEUR, reslig, MULTIPLICATEUR);
+	int n;
+	for (n = selected == -1 ? MIN_SIZE : MAX_SIZE; n <= MAX_SIZE; n *= 2) {
+		long elems = (long) n * n;
+		// On crée le tableau et les ordres des courbes
+		int *tab = aligned_alloc(64, elems * sizeof(int));
+		unsigned int *orders[2];
+		orders[MORTON] = malloc(elems * sizeof(unsigned int));
+		orders[HILBERT] = malloc(elems * sizeof(unsigned int));
+		if (tab == NULL || orders[MORTON] == NULL || orders[HILBERT] == NULL) {
+			perror("malloc fail");
+			exit(EXIT_FAILURE);
 		}
+		long j;
+		for (j = 0; j < elems; j++)
+			tab[j] = (int) j;
+		morton_order(orders[MORTON], n);
+		hilbert_order(orders[HILBERT], n);
 
-		//On libère la mémoire
-		for(j=0; j<i; j++) {
-			free(tab[j]);
-			tab[j]=NULL;
+		long repeat = elems >= MIN_ELEMS ? 1 : MIN_ELEMS / elems;
+		long misses[3];
+		for (i = 0; i < nmodes; i++) {
+			if (selected != -1 && i != selected)
+				continue;
+			// un premier parcours non mesuré pour charger le tableau dans le cache s'il y tient
+			sink += modes[i].traverse(tab, n, modes[i].curve >= 0 ? orders[modes[i].curve] : NULL, modes[i].tile);
+			long time = mesure(t, ctr, &modes[i], tab, n, orders, repeat, misses);
+			if (selected != -1)
+				continue;
+			write_record_n(time_rec[i], elems * sizeof(int) / 1024, time, elems * repeat / 1000);
+			for (c = 0; c < 3; c++)
+				if (misses[c] >= 0)
+					write_value(miss_rec[i][c], elems * sizeof(int) / 1024, misses[c] * 1000 / (elems * repeat));
 		}
+		printf("%ld KiB\n", elems * sizeof(int) / 1024);
+
+		//On libère la mémoire
 		free(tab);
+		free(orders[MORTON]);
+		free(orders[HILBERT]);
 	}
-	
-	if(!perfligne && !perfcolonne) {
-		recorder_free(lig_rec);
-	  	recorder_free(col_rec);
-		timer_free(t);
+
+	if (selected == -1) {
+		for (i = 0; i < nmodes; i++) {
+			recorder_free(time_rec[i]);
+			for (c = 0; c < 3; c++)
+				recorder_free(miss_rec[i][c]);
+		}
 	}
+	for (c = 0; c < 3; c++)
+		counter_free(ctr[c]);
+	timer_free(t);
 
 	return EXIT_SUCCESS;
 }
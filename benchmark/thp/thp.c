@@ -0,0 +1,358 @@
+/**
+ * \file thp.c
+ * \brief Grandes zones de mémoire avec et sans hugepages
+ *
+ * `tab`, `memfork` ou `shm` allouent de grands tableaux avec le réglage
+ * des transparent hugepages (THP) de la machine, quel qu'il soit. Ce
+ * programme alloue une zone anonyme de 4 MiB à `MAX_SIZE` avec chaque
+ * politique :
+ * * `default` : aucune indication, le réglage de
+ *   `/sys/kernel/mm/transparent_hugepage/enabled` s'applique;
+ * * `nohuge` : `madvise(MADV_NOHUGEPAGE)`, pages de 4 KiB;
+ * * `huge` : `madvise(MADV_HUGEPAGE)`, pages de 2 MiB dès le premier accès
+ *   si le noyau en trouve (sauf si `enabled` vaut `never`);
+ * * `collapse` : remplie avec des pages de 4 KiB, puis regroupée en pages
+ *   de 2 MiB par `madvise(MADV_COLLAPSE)` (Linux 6.1), de façon synchrone;
+ * * `hugetlb2m`, `hugetlb1g` : `mmap` avec `MAP_HUGETLB`, dans la réserve
+ *   de hugepages explicites (`/proc/sys/vm/nr_hugepages`, ou
+ *   `/sys/kernel/mm/hugepages/hugepages-1048576kB/nr_hugepages`). Si elle
+ *   est vide, `mmap` échoue et les fichiers de la politique restent vides.
+ *
+ * Pour chaque taille, en MiB, on enregistre
+ * * `<politique>-touch.csv` : le premier accès à toute la zone, en ns par
+ *   page de 4 KiB, suivi des colonnes de `write_record_mem` (fautes de page
+ *   par page de 4 KiB, RSS, PSS et mémoire en THP, puis les variations de
+ *   PSS et de THP pendant la mesure);
+ * * `<politique>-seq.csv` et `<politique>-rand.csv` : des lectures de
+ *   `long` dans l'ordre de la mémoire ou à des positions aléatoires
+ *   indépendantes, en ns pour 1000 lectures;
+ * * `<politique>-seq-tlb.csv` et `<politique>-rand-tlb.csv` : les défauts
+ *   de TLB de données par 1000 lectures, si les compteurs matériels sont
+ *   disponibles (`lib/counter.c`);
+ * * `collapse-time.csv` : le temps de `MADV_COLLAPSE` en ns par MiB.
+ *
+ * Enfin, `khugepaged.csv` suit le travail de `khugepaged` : une zone de
+ * `KHUGEPAGED_SIZE` bytes est remplie avec des pages de 4 KiB puis marquée
+ * `MADV_HUGEPAGE`, et on enregistre chaque seconde la part de la zone en
+ * hugepages (en %), jusqu'à 100% ou `-k <secondes>` (0 pour ne pas le
+ * mesurer).
+ *
+ * `-m <MiB>` change la taille maximale.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "benchmark.h"
+#include "counter.h"
+
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define MAP_HUGE_2M (21 << MAP_HUGE_SHIFT)
+#define MAP_HUGE_1G (30 << MAP_HUGE_SHIFT)
+
+#define MIN_SIZE (4L << 20)
+#define MAX_SIZE (1L << 30)
+#define PAGE_SIZE 4096
+#define HUGE_SIZE (2L << 20)
+#define LOADS (1L << 24) //!< Lectures au minimum par mesure
+#define KHUGEPAGED_SIZE (64L << 20)
+#define KHUGEPAGED_TIMEOUT 60
+
+/**
+ * \brief Une façon d'obtenir la zone
+ */
+typedef struct policy {
+  const char *name;
+  int flags; //!< ajoutés à ceux de `mmap`
+  int advice; //!< pour `madvise` avant le premier accès, -1 si aucun
+  int collapse; //!< `MADV_COLLAPSE` après le premier accès
+  long page; //!< taille des pages explicites, 0 pour les pages normales
+} policy;
+
+static const policy policies[] = {
+  {"default", 0, -1, 0, 0},
+  {"nohuge", 0, MADV_NOHUGEPAGE, 0, 0},
+  {"huge", 0, MADV_HUGEPAGE, 0, 0},
+  {"collapse", 0, MADV_NOHUGEPAGE, 1, 0},
+  {"hugetlb2m", MAP_HUGETLB | MAP_HUGE_2M, -1, 0, 2L << 20},
+  {"hugetlb1g", MAP_HUGETLB | MAP_HUGE_1G, -1, 0, 1L << 30},
+};
+
+#define NPOLICIES (sizeof(policies) / sizeof(policies[0]))
+
+/**
+ * \brief Le résultat des lectures, pour que le compilateur les garde
+ */
+volatile long sink;
+
+/**
+ * \brief Alloue `size` bytes alignés sur 2 MiB avec la politique `p`
+ *
+ * \param mapped reçoit la longueur à passer à `munmap`
+ * \return la zone, ou `NULL` si `MAP_HUGETLB` échoue
+ */
+char *zone_alloc (const policy *p, long size, long *mapped) {
+  char *zone;
+  if (p->page != 0) {
+    *mapped = (size + p->page - 1) / p->page * p->page;
+    zone = (char *) mmap(NULL, *mapped, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | p->flags, -1, 0);
+    return zone == MAP_FAILED ? NULL : zone;
+  }
+  char *raw = (char *) mmap(NULL, size + HUGE_SIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | p->flags, -1, 0);
+  if (raw == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  // on libère le début et la fin pour garder une zone alignée
+  zone = (char *) (((uintptr_t) raw + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1));
+  if (zone > raw) {
+    munmap(raw, zone - raw);
+  }
+  munmap(zone + size, raw + HUGE_SIZE - zone);
+  if (p->advice != -1 && madvise(zone, size, p->advice) == -1) {
+    perror("madvise");
+    exit(EXIT_FAILURE);
+  }
+  *mapped = size;
+  return zone;
+}
+
+/**
+ * \brief Regroupe `zone` en hugepages avec `MADV_COLLAPSE`
+ *
+ * \return le temps de `madvise`, ou -1 s'il a échoué
+ */
+long collapse (timer *t, char *zone, long size) {
+  // `MADV_COLLAPSE` refuse une zone marquée `MADV_NOHUGEPAGE`
+  if (madvise(zone, size, MADV_HUGEPAGE) == -1) {
+    perror("madvise(MADV_HUGEPAGE)");
+    return -1;
+  }
+  start_timer(t);
+  int ret = madvise(zone, size, MADV_COLLAPSE);
+  long time = stop_timer(t);
+  if (ret == -1) {
+    perror("madvise(MADV_COLLAPSE)");
+    return -1;
+  }
+  return time;
+}
+
+long read_seq (const long *a, long n, long passes) {
+  long sum = 0;
+  long p, i;
+  for (p = 0; p < passes; p++) {
+    for (i = 0; i < n; i++) {
+      sum += a[i];
+    }
+  }
+  return sum;
+}
+
+/**
+ * \brief `loads` lectures à des positions aléatoires (xorshift)
+ *
+ * `n` doit être une puissance de 2. Les positions ne dépendent pas des
+ * valeurs lues : le processeur peut lancer plusieurs lectures, et
+ * plusieurs parcours des tables de pages, en parallèle.
+ */
+long read_rand (const long *a, long n, long loads) {
+  long sum = 0;
+  uint64_t x = 88172645463325252ULL;
+  long i;
+  for (i = 0; i < loads; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sum += a[x & (n - 1)];
+  }
+  return sum;
+}
+
+/**
+ * \brief Les fichiers d'une politique
+ */
+typedef struct records {
+  recorder *touch;
+  recorder *seq;
+  recorder *rand;
+  recorder *seq_tlb;
+  recorder *rand_tlb;
+} records;
+
+recorder *open_record (const char *policy, const char *suffix) {
+  char name[64];
+  snprintf(name, sizeof(name), "%s-%s.csv", policy, suffix);
+  return recorder_alloc(name);
+}
+
+/**
+ * \brief Mesure la politique `p` pour une taille
+ *
+ * \return 0, ou -1 si la zone n'a pas pu être allouée
+ */
+int measure (timer *t, counter *tlb, const policy *p, long size,
+    records *rec, recorder *collapse_rec) {
+  long mapped;
+  char *zone = zone_alloc(p, size, &mapped);
+  if (zone == NULL) {
+    fprintf(stderr, "%s : ", p->name);
+    perror("mmap(MAP_HUGETLB)");
+    return -1;
+  }
+  long mib = size >> 20;
+  memstat mem;
+
+  memstat_reset(&mem);
+  memstat_start(&mem);
+  start_timer(t);
+  memset(zone, 1, size);
+  BM_DO_NOT_OPTIMIZE(zone);
+  long time = stop_timer(t);
+  memstat_stop(&mem);
+  write_record_mem(rec->touch, mib, time, size / PAGE_SIZE, &mem);
+
+  if (p->collapse) {
+    time = collapse(t, zone, size);
+    if (time != -1) {
+      write_record_n(collapse_rec, mib, time, mib);
+    }
+  }
+
+  long n = size / sizeof(long);
+  long passes = n >= LOADS ? 1 : LOADS / n;
+  memstat_reset(&mem);
+  memstat_start(&mem);
+  counter_start(tlb);
+  start_timer(t);
+  sink += read_seq((const long *) zone, n, passes);
+  time = stop_timer(t);
+  long misses = counter_stop(tlb);
+  memstat_stop(&mem);
+  write_record_mem(rec->seq, mib, time, n * passes / 1000, &mem);
+  if (misses >= 0) {
+    write_value(rec->seq_tlb, mib, misses * 1000 / (n * passes));
+  }
+
+  memstat_reset(&mem);
+  memstat_start(&mem);
+  counter_start(tlb);
+  start_timer(t);
+  sink += read_rand((const long *) zone, n, LOADS);
+  time = stop_timer(t);
+  misses = counter_stop(tlb);
+  memstat_stop(&mem);
+  write_record_mem(rec->rand, mib, time, LOADS / 1000, &mem);
+  if (misses >= 0) {
+    write_value(rec->rand_tlb, mib, misses * 1000 / LOADS);
+  }
+
+  if (munmap(zone, mapped) == -1) {
+    perror("munmap");
+    exit(EXIT_FAILURE);
+  }
+  return 0;
+}
+
+/**
+ * \brief Suit le regroupement d'une zone en hugepages par `khugepaged`
+ *
+ * `khugepaged` parcourt `pages_to_scan` pages toutes les
+ * `scan_sleep_millisecs` ms (`/sys/kernel/mm/transparent_hugepage/khugepaged/`),
+ * 4096 pages toutes les 10 s par défaut : il lui faut des dizaines de
+ * secondes pour une zone de quelques dizaines de MiB.
+ */
+void khugepaged (recorder *rec, int timeout) {
+  const policy nohuge = {"khugepaged", 0, MADV_NOHUGEPAGE, 0, 0};
+  long mapped;
+  char *zone = zone_alloc(&nohuge, KHUGEPAGED_SIZE, &mapped);
+  memset(zone, 1, KHUGEPAGED_SIZE);
+  if (madvise(zone, KHUGEPAGED_SIZE, MADV_HUGEPAGE) == -1) {
+    perror("madvise(MADV_HUGEPAGE)");
+    exit(EXIT_FAILURE);
+  }
+  memstat mem;
+  memstat_reset(&mem);
+  int s;
+  for (s = 0; s <= timeout; s++) {
+    if (s > 0) {
+      sleep(1);
+    }
+    memstat_start(&mem);
+    memstat_stop(&mem);
+    long pct = mem.thp * 100 / (KHUGEPAGED_SIZE >> 10);
+    write_value(rec, s, pct);
+    if (pct >= 100) {
+      break;
+    }
+  }
+  printf("khugepaged : %ld%% de la zone en hugepages après %d s\n",
+      mem.thp * 100 / (KHUGEPAGED_SIZE >> 10), s > timeout ? timeout : s);
+  munmap(zone, mapped);
+}
+
+int main (int argc, char *argv[]) {
+  long max_size = MAX_SIZE;
+  int timeout = KHUGEPAGED_TIMEOUT;
+  int i;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      max_size = atol(argv[++i]) << 20;
+    } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+      timeout = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [-m <MiB>] [-k <secondes>]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  timer *t = timer_alloc();
+  counter *tlb = counter_alloc(PERF_TYPE_HW_CACHE,
+      COUNTER_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+        PERF_COUNT_HW_CACHE_RESULT_MISS));
+  recorder *collapse_rec = recorder_alloc("collapse-time.csv");
+  unsigned int p;
+  for (p = 0; p < NPOLICIES; p++) {
+    records rec;
+    rec.touch = open_record(policies[p].name, "touch");
+    rec.seq = open_record(policies[p].name, "seq");
+    rec.rand = open_record(policies[p].name, "rand");
+    rec.seq_tlb = open_record(policies[p].name, "seq-tlb");
+    rec.rand_tlb = open_record(policies[p].name, "rand-tlb");
+    long size;
+    for (size = MIN_SIZE; size <= max_size; size *= 2) {
+      if (measure(t, tlb, &policies[p], size, &rec, collapse_rec) == -1) {
+        break;
+      }
+    }
+    printf("%s\n", policies[p].name);
+    recorder_free(rec.touch);
+    recorder_free(rec.seq);
+    recorder_free(rec.rand);
+    recorder_free(rec.seq_tlb);
+    recorder_free(rec.rand_tlb);
+  }
+  recorder_free(collapse_rec);
+
+  recorder *khugepaged_rec = recorder_alloc("khugepaged.csv");
+  if (timeout > 0) {
+    khugepaged(khugepaged_rec, timeout);
+  }
+  recorder_free(khugepaged_rec);
+
+  counter_free(tlb);
+  timer_free(t);
+  return EXIT_SUCCESS;
+}
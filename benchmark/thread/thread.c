@@ -1,49 +1,424 @@
+/**
+ * \file thread.c
+ * \brief Coût par tâche d'un thread par tâche comparé à un pool de threads
+ *
+ * Chaque tâche fait un calcul de durée fixée (sa granularité), de 100 ns
+ * à 1 ms. Pour chaque granularité, on exécute les mêmes tâches avec
+ * * `create` : un `pthread_create`/`pthread_join` par tâche, par vagues
+ *   d'autant de threads que de CPUs;
+ * * `c11` : la même chose avec `thrd_create`/`thrd_join` de C11;
+ * * `pool` : un pool fixe de threads qui se partagent une file protégée
+ *   par un mutex et une variable de condition;
+ * * `steal` : un pool fixe de threads qui ont chacun un `deque` de
+ *   Chase-Lev (`lib/deque.c`) et volent les tâches des autres.
+ *
+ * On enregistre le temps total multiplié par le nombre de threads et
+ * divisé par le nombre de tâches, c'est-à-dire le temps CPU consommé par
+ * tâche. Sans surcoût, il serait égal à la granularité.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sched.h>
 #include <pthread.h>
+#include <threads.h>
+#include <stdatomic.h>
 
 #include "benchmark.h"
+#include "deque.h"
+
+#define MIN_GRAIN 100       //!< Granularité minimale en ns
+#define MAX_GRAIN 1000000   //!< Granularité maximale en ns (1 ms)
+#define WORK 50000000       //!< Travail total visé par granularité (50 ms)
+#define MIN_TASKS 200
+#define MAX_TASKS 20000
+#define MAX_WORKERS 256
+#define CALIBRATION 10000000
 
-#define N 1000
+/**
+ * \brief Une tâche : `iters` itérations de calcul
+ */
+typedef struct task {
+  long iters;
+  long result; //!< Pour que le calcul ne soit pas supprimé
+} task;
 
-void *thread(void * param) {
-  sleep(1); // pas un `while (true)` comme ça le thread est pas "ready"
-  pthread_exit(NULL);
+/**
+ * \brief Calcul séquentiel de `iters` itérations dépendantes
+ */
+long spin (long iters) {
+  long i;
+  unsigned long x = 1;
+  for (i = 0; i < iters; i++) {
+    x = x * 6364136223846793005UL + 1442695040888963407UL;
+  }
+  return (long) x;
 }
 
-int main (int argc, char *argv[])  {
-  pthread_t threads[N];
-  int err = 0, i;
+void run (task *tk) {
+  tk->result = spin(tk->iters);
+}
+
+/**
+ * \brief Estime le nombre d'itérations de `spin` par µs
+ */
+long calibrate (timer *t) {
+  volatile long sink;
+  start_timer(t);
+  sink = spin(CALIBRATION);
+  long time = stop_timer(t);
+  (void) sink;
+  return (long) ((double) CALIBRATION * 1000 / (time > 0 ? time : 1));
+}
+
+/*
+ * Un thread par tâche
+ */
+
+void *pthread_task (void *param) {
+  run((task *) param);
+  return NULL;
+}
+
+/**
+ * \brief Exécute les tâches avec un `pthread_create` par tâche,
+ *        `workers` threads à la fois
+ */
+void run_create (task *tasks, long ntasks, int workers) {
+  pthread_t threads[MAX_WORKERS];
+  long i;
+  int j, n;
+  for (i = 0; i < ntasks; i += n) {
+    n = (ntasks - i < workers) ? ntasks - i : workers;
+    for (j = 0; j < n; j++) {
+      if (pthread_create(&threads[j], NULL, &pthread_task, &tasks[i + j])) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+      }
+    }
+    for (j = 0; j < n; j++) {
+      pthread_join(threads[j], NULL);
+    }
+  }
+}
+
+int c11_task (void *param) {
+  run((task *) param);
+  return 0;
+}
+
+/**
+ * \brief Comme `run_create` mais avec les threads de C11
+ */
+void run_c11 (task *tasks, long ntasks, int workers) {
+  thrd_t threads[MAX_WORKERS];
+  long i;
+  int j, n;
+  for (i = 0; i < ntasks; i += n) {
+    n = (ntasks - i < workers) ? ntasks - i : workers;
+    for (j = 0; j < n; j++) {
+      if (thrd_create(&threads[j], &c11_task, &tasks[i + j]) != thrd_success) {
+        fprintf(stderr, "thrd_create\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    for (j = 0; j < n; j++) {
+      thrd_join(threads[j], NULL);
+    }
+  }
+}
+
+/*
+ * Pool avec une file partagée
+ */
+
+/**
+ * \brief Pool de threads avec une file circulaire protégée par `lock`
+ */
+typedef struct pool {
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty; //!< Signalée quand une tâche est ajoutée
+  pthread_cond_t done;      //!< Signalée quand plus aucune tâche n'est en cours
+  task *queue[MAX_TASKS];
+  long head, tail;
+  long pending;             //!< Tâches ajoutées et pas encore terminées
+  int stop;
+  int nthreads;
+  pthread_t threads[MAX_WORKERS];
+} pool;
+
+void *pool_worker (void *param) {
+  pool *p = (pool *) param;
+  for (;;) {
+    pthread_mutex_lock(&p->lock);
+    while (p->head == p->tail && !p->stop) {
+      pthread_cond_wait(&p->not_empty, &p->lock);
+    }
+    if (p->head == p->tail) {
+      pthread_mutex_unlock(&p->lock);
+      return NULL;
+    }
+    task *tk = p->queue[p->head++ % MAX_TASKS];
+    pthread_mutex_unlock(&p->lock);
+
+    run(tk);
+
+    pthread_mutex_lock(&p->lock);
+    if (--p->pending == 0) {
+      pthread_cond_signal(&p->done);
+    }
+    pthread_mutex_unlock(&p->lock);
+  }
+}
+
+pool *pool_alloc (int nthreads) {
+  pool *p = (pool *) malloc(sizeof(pool));
+  if (p == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->not_empty, NULL);
+  pthread_cond_init(&p->done, NULL);
+  p->head = p->tail = p->pending = 0;
+  p->stop = 0;
+  p->nthreads = nthreads;
+  int i;
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&p->threads[i], NULL, &pool_worker, p)) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return p;
+}
+
+/**
+ * \brief Ajoute toutes les tâches dans la file et attend qu'elles finissent
+ *
+ * `ntasks` ne peut pas dépasser `MAX_TASKS`.
+ */
+void run_pool (pool *p, task *tasks, long ntasks) {
+  long i;
+  for (i = 0; i < ntasks; i++) {
+    pthread_mutex_lock(&p->lock);
+    p->queue[p->tail++ % MAX_TASKS] = &tasks[i];
+    p->pending++;
+    pthread_cond_signal(&p->not_empty);
+    pthread_mutex_unlock(&p->lock);
+  }
+  pthread_mutex_lock(&p->lock);
+  while (p->pending > 0) {
+    pthread_cond_wait(&p->done, &p->lock);
+  }
+  pthread_mutex_unlock(&p->lock);
+}
 
+void pool_free (pool *p) {
+  int i;
+  pthread_mutex_lock(&p->lock);
+  p->stop = 1;
+  pthread_cond_broadcast(&p->not_empty);
+  pthread_mutex_unlock(&p->lock);
+  for (i = 0; i < p->nthreads; i++) {
+    pthread_join(p->threads[i], NULL);
+  }
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->not_empty);
+  pthread_cond_destroy(&p->done);
+  free(p);
+}
+
+/*
+ * Pool avec vol de tâches
+ */
+
+/**
+ * \brief Pool de threads avec un `deque` par thread
+ *
+ * Le thread principal est le thread 0 : il met toutes les tâches dans son
+ * `deque` et les autres threads les lui volent. Les threads attendent
+ * chaque lot de tâches sur la barrière `start`.
+ */
+typedef struct wspool {
+  int nthreads;
+  deque *deques[MAX_WORKERS];
+  pthread_t threads[MAX_WORKERS];
+  pthread_barrier_t start, end;
+  atomic_long remaining;
+  atomic_int stop;
+} wspool;
+
+typedef struct wsargs {
+  wspool *p;
+  int id;
+} wsargs;
+
+/**
+ * \brief Exécute des tâches jusqu'à ce qu'il n'en reste plus
+ */
+void ws_loop (wspool *p, int id) {
+  unsigned int seed = id;
+  while (atomic_load(&p->remaining) > 0) {
+    task *tk = (task *) deque_pop(p->deques[id]);
+    if (tk == NULL && p->nthreads > 1) {
+      int victim = rand_r(&seed) % p->nthreads;
+      if (victim != id) {
+        tk = (task *) deque_steal(p->deques[victim]);
+      }
+    }
+    if (tk == NULL) {
+      sched_yield();
+      continue;
+    }
+    run(tk);
+    atomic_fetch_sub(&p->remaining, 1);
+  }
+}
+
+void *ws_worker (void *param) {
+  wsargs *args = (wsargs *) param;
+  for (;;) {
+    pthread_barrier_wait(&args->p->start);
+    if (atomic_load(&args->p->stop)) {
+      break;
+    }
+    ws_loop(args->p, args->id);
+    pthread_barrier_wait(&args->p->end);
+  }
+  free(args);
+  return NULL;
+}
+
+wspool *wspool_alloc (int nthreads) {
+  wspool *p = (wspool *) malloc(sizeof(wspool));
+  if (p == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  p->nthreads = nthreads;
+  atomic_init(&p->remaining, 0);
+  atomic_init(&p->stop, 0);
+  pthread_barrier_init(&p->start, NULL, nthreads);
+  pthread_barrier_init(&p->end, NULL, nthreads);
+  int i;
+  for (i = 0; i < nthreads; i++) {
+    p->deques[i] = deque_alloc(MAX_TASKS);
+  }
+  for (i = 1; i < nthreads; i++) {
+    wsargs *args = (wsargs *) malloc(sizeof(wsargs));
+    if (args == NULL) {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+    args->p = p;
+    args->id = i;
+    if (pthread_create(&p->threads[i], NULL, &ws_worker, args)) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return p;
+}
+
+void run_steal (wspool *p, task *tasks, long ntasks) {
+  long i;
+  atomic_store(&p->remaining, ntasks);
+  for (i = 0; i < ntasks; i++) {
+    if (deque_push(p->deques[0], &tasks[i]) == -1) {
+      fprintf(stderr, "deque plein\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  pthread_barrier_wait(&p->start);
+  ws_loop(p, 0);
+  pthread_barrier_wait(&p->end);
+}
+
+void wspool_free (wspool *p) {
+  int i;
+  atomic_store(&p->stop, 1);
+  pthread_barrier_wait(&p->start);
+  for (i = 1; i < p->nthreads; i++) {
+    pthread_join(p->threads[i], NULL);
+  }
+  for (i = 0; i < p->nthreads; i++) {
+    deque_free(p->deques[i]);
+  }
+  pthread_barrier_destroy(&p->start);
+  pthread_barrier_destroy(&p->end);
+  free(p);
+}
+
+int main (int argc, char *argv[])  {
   timer *t = timer_alloc();
   recorder *create_rec = recorder_alloc("create.csv");
-  recorder *join_rec = recorder_alloc("join.csv");
+  recorder *c11_rec = recorder_alloc("c11.csv");
+  recorder *pool_rec = recorder_alloc("pool.csv");
+  recorder *steal_rec = recorder_alloc("steal.csv");
 
-  // BEGIN
-  start_timer(t);
-  for (i = 0; i < N; i++) {
-    err = pthread_create(&threads[i], NULL, &thread, NULL);
-    /*if (err != 0)
-      error(1, err, "pthread_create");*/
+  int workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (workers < 1) {
+    workers = 1;
+  } else if (workers > MAX_WORKERS) {
+    workers = MAX_WORKERS;
+  }
+  long per_us = calibrate(t);
+  printf("%d threads, %ld itérations par µs\n", workers, per_us);
+
+  task *tasks = (task *) malloc(sizeof(task) * MAX_TASKS);
+  if (tasks == NULL) {
+    perror("malloc");
+    return EXIT_FAILURE;
   }
-  write_record_n(create_rec, i, stop_timer(t), N);
-  // END
+  pool *p = pool_alloc(workers);
+  wspool *wp = wspool_alloc(workers);
 
-  sleep(2); // Pour s'assurer que les pthread_join ne patientent pas
+  long grain, i;
+  for (grain = MIN_GRAIN; grain <= MAX_GRAIN; grain *= 10) {
+    int k;
+    // 1, 2 et 5 par décade
+    for (k = 1; k <= 5 && grain * k <= MAX_GRAIN; k += (k == 1) ? 1 : 3) {
+      long g = grain * k;
+      long ntasks = WORK / g;
+      if (ntasks < MIN_TASKS) {
+        ntasks = MIN_TASKS;
+      } else if (ntasks > MAX_TASKS) {
+        ntasks = MAX_TASKS;
+      }
+      for (i = 0; i < ntasks; i++) {
+        tasks[i].iters = g * per_us / 1000;
+      }
 
-  // BEGIN
-  start_timer(t);
-  for (i = 0; i < N; i++) {
-    err = pthread_join(threads[i], NULL);
-    /*if (err != 0)
-      error(1, err, "pthread_join");*/
+      // BEGIN
+      start_timer(t);
+      run_create(tasks, ntasks, workers);
+      write_record_n(create_rec, g, stop_timer(t) * workers, ntasks);
+      // END
+
+      start_timer(t);
+      run_c11(tasks, ntasks, workers);
+      write_record_n(c11_rec, g, stop_timer(t) * workers, ntasks);
+
+      start_timer(t);
+      run_pool(p, tasks, ntasks);
+      write_record_n(pool_rec, g, stop_timer(t) * workers, ntasks);
+
+      start_timer(t);
+      run_steal(wp, tasks, ntasks);
+      write_record_n(steal_rec, g, stop_timer(t) * workers, ntasks);
+    }
   }
-  write_record_n(join_rec, i, stop_timer(t), N);
-  // END
 
-  recorder_free(join_rec);
+  pool_free(p);
+  wspool_free(wp);
+  free(tasks);
+
   recorder_free(create_rec);
+  recorder_free(c11_rec);
+  recorder_free(pool_rec);
+  recorder_free(steal_rec);
   timer_free(t);
 
   return EXIT_SUCCESS;
@@ -1,197 +1,321 @@
-/***********************************************************
- * types.c
- *
- * Comparaison de vitesse de calcul avec differents types.
- ***********************************************************/
+/**
+	\file types.c
+	\brief Ce programme mesure la latence et le débit des opérations arithmétiques pour chaque type numérique et chaque largeur de vecteur
+
+	Les types sont les entiers signés de 8, 16, 32 et 64 bits, `float`, `double` et `long double`, et les largeurs
+		* `scalar` : un élément à la fois (`long double` n'existe qu'ainsi, sur la pile x87);
+		* `sse` : vecteurs de 16 bytes;
+		* `avx2` : vecteurs de 32 bytes;
+		* `avx512` : vecteurs de 64 bytes.
+
+	Les vecteurs sont ceux de GCC (`vector_size`). Chaque fonction est compilée pour son jeu d'instructions (attribut `target`) et n'est appelée que si le processeur le connaît (`__builtin_cpu_supports`) : les colonnes d'une largeur absente valent `NaN`. Ailleurs que sur x86, seules les lignes `scalar` sont mesurées, sans attribut `target`, et les vecteurs valent `NaN`.
+
+	Les opérations sont `add`, `mul`, `div`, `sqrt` et `fma` (`x * a + b`, fusionnée en une instruction pour `float` et `double`, une multiplication et une addition pour les entiers et `long double`). Les entiers n'ont pas de `sqrt`, et aucun jeu d'instructions x86 n'a de division entière vectorielle : GCC divise alors élément par élément.
+
+	Chaque opération est mesurée
+		* en latence : une seule chaîne, chaque opération attend le résultat de la précédente (`types-latency.csv`, ns par opération);
+		* en débit : `CHAINS` chaînes indépendantes (6 pour `long double`), assez pour occuper toutes les unités (`types-throughput.csv`, éléments traités par ns).
+
+	Les constantes viennent de variables `volatile` et une instruction `asm` vide cache la valeur de chaque chaîne après chaque opération : le compilateur ne peut ni précalculer la chaîne, ni la simplifier (`x * 1`), ni la vectoriser. Les valeurs restent des nombres normaux avec une mantisse complète (`div` calcule `b / x` avec `b = x0 * x0`, `sqrt` calcule `sqrt(x + 1)`, qui tend vers le nombre d'or), car certaines unités sont plus rapides pour les cas simples.
+
+	Chaque mesure double le nombre d'itérations jusqu'à durer au moins `MIN_TIME` ns, et les fichiers ne sont écrits qu'à la fin.
+*/
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "benchmark.h"
 
-#define N 999
+#define UNROLL 8	// opérations par itération d'une chaîne de latence
+#define CHAINS 8	// chaînes indépendantes pour le débit
+#define MIN_TIME 20000000L	// ns
+#define MAX_ITER (1L << 30)
+
+/**
+	\brief Le résultat des mesures, pour que le compilateur les garde
+*/
+volatile long sink;
 
 /*
- *  _____       _
- * |_   _|     | |
- *   | |  _ __ | |_ ___  __ _  ___ _ __
- *   | | | '_ \| __/ _ \/ _` |/ _ \ '__|
- *  _| |_| | | | ||  __/ (_| |  __/ |
- * |_____|_| |_|\__\___|\__, |\___|_|
- *                       __/ |
- *	   				    |___/
- */
+	Les constantes de chaque type : `z = 0`, `o = 1`, `x0` la valeur de départ et `b = x0 * x0`.
+*/
+#define CONSTANTS(tname, T, x0) \
+	static volatile T tname##_z = 0, tname##_o = 1, tname##_x0 = x0, tname##_b = (x0) * (x0);
 
-/**
- * \brief `primeInt` cherche les `nMax` premiers nombres premiers
- *
- * \param nMax Défini combien de nombres premiers on cherche
- *
- * \param t Le temps dans lequel on stoque le temps de début
- *
- * \param r Sauvegarde le temps dans un fichier .csv
- *
- * Cherche les `nMax` premiers nombres premiers par la methode de brute force.
- * Utilise exclusivement des int pour le calcul. A la fin du calcul sauvegarde
- * le temps écoulé dans un fichier .csv en utilisant un `recorder` .
- */
-
-
-int primeInt (int nMax, timer* t, recorder* r) {
-	int count, i = 3, c;
-	
-	start_timer(t);
-	// on lance le timer
-	
-	for (count = 2; count <= nMax; ) {
-		for (c = 2; c <= i ; c++) {
-			if (i%c == 0) {
-				break;
-				// si le modulo == 0 => pas nombre premier => break
-			}
-		}
-		if (c == i) {
-			count ++;
-			if (count % 50 == 0){
-				write_record_n(r,count,stop_timer(t),nMax);
-				// on sauvegarde le temps pris pour trouver le `n ième` n.p.
-			}
-		}
-		i++;
-	}
-	return 0;
-}
+CONSTANTS(int8, int8_t, 11)
+CONSTANTS(int16, int16_t, 181)
+CONSTANTS(int32, int32_t, 46340)
+CONSTANTS(int64, int64_t, 3037000499L)
+CONSTANTS(float, float, 1.2345678f)
+CONSTANTS(double, double, 1.2345678901234567)
+CONSTANTS(ldouble, long double, 1.2345678901234567890L)
 
 /*
- *  _                         _                     _       _
- * | |                       | |                   (_)     | |
- * | |     ___  _ __   __ _  | | ___  _ __   __ _   _ _ __ | |_
- * | |    / _ \| '_ \ / _` | | |/ _ \| '_ \ / _` | | | '_ \| __|
- * | |___| (_) | | | | (_| | | | (_) | | | | (_| | | | | | | |_
- * |______\___/|_| |_|\__, | |_|\___/|_| |_|\__, | |_|_| |_|\__|
- *                     __/ |                 __/ |
- *                    |___/                 |___/
- */
+	Une largeur : son jeu d'instructions, si la largeur existe sur cette machine (`IF_<largeur>(oui, non)`), et la taille de ses vecteurs.
+*/
+#if defined(__x86_64__) || defined(__i386__)
+#define ISA_scalar "sse2"
+#define ISA_sse "sse4.2"
+#define ISA_avx2 "avx2"
+#define ISA_avx512 "avx512f,avx512bw,avx512dq,avx512vl"
+#define TARGET(width, op) __attribute__((target(ISA_##width ISA_OP_##op)))
 
-/**
- * \brief `primeLong` cherche les `nMax` premiers nombres premiers
- *
- * \param nMax Défini combien de nombres premiers on cherche
- *
- * \param t Le temps dans lequel on stoque le temps de début
- *
- * \param r Sauvegarde le temps dans un fichier .csv
- *
- * Cherche les `nMax` premiers nombres premiers par la methode de brute force.
- * Utilise exclusivement des long long int pour le calcul. A la fin du calcul
- * sauvegarde le temps écoulé dans un fichier .csv en utilisant un `recorder` .
- */
-
-int primeLong (long long int nMax, timer* t, recorder* r) {
-	long long int count, i = 3, c;
-	
-	start_timer(t);
-	
-	for (count = 2; count <= nMax; ) {
-		for (c = 2; c <= i ; c++) {
-			if (i%c == 0) {
-				break;
-			}
-		}
-		if (c == i) {
-			count ++;
-			if (count % 50 == 0){
-				write_record_n(r,count,stop_timer(t),nMax);
-			}
-		}
-		i++;
+#define IF_scalar(yes, no) yes
+#define IF_sse(yes, no) yes
+#define IF_avx2(yes, no) yes
+#define IF_avx512(yes, no) yes
+#else
+#define TARGET(width, op)
+
+#define IF_scalar(yes, no) yes
+#define IF_sse(yes, no) no
+#define IF_avx2(yes, no) no
+#define IF_avx512(yes, no) no
+#endif
+
+#define VECTOR(tname, T, width, bytes) typedef T tname##_##width __attribute__((vector_size(bytes)));
+#define VECTORS(tname, T) VECTOR(tname, T, sse, 16) VECTOR(tname, T, avx2, 32) VECTOR(tname, T, avx512, 64)
+
+typedef int8_t int8_scalar;
+typedef int16_t int16_scalar;
+typedef int32_t int32_scalar;
+typedef int64_t int64_scalar;
+typedef float float_scalar;
+typedef double double_scalar;
+typedef long double ldouble_scalar;
+VECTORS(int8, int8_t)
+VECTORS(int16, int16_t)
+VECTORS(int32, int32_t)
+VECTORS(int64, int64_t)
+VECTORS(float, float)
+VECTORS(double, double)
+
+/*
+	La racine carrée de chaque type flottant : GCC n'en a pas pour ses vecteurs.
+*/
+#define sqrt_float_scalar __builtin_sqrtf
+#define sqrt_double_scalar __builtin_sqrt
+#define sqrt_ldouble_scalar __builtin_sqrtl
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline __attribute__((target(ISA_sse))) float_sse sqrt_float_sse(float_sse x) { return (float_sse) _mm_sqrt_ps((__m128) x); }
+static inline __attribute__((target(ISA_sse))) double_sse sqrt_double_sse(double_sse x) { return (double_sse) _mm_sqrt_pd((__m128d) x); }
+static inline __attribute__((target(ISA_avx2))) float_avx2 sqrt_float_avx2(float_avx2 x) { return (float_avx2) _mm256_sqrt_ps((__m256) x); }
+static inline __attribute__((target(ISA_avx2))) double_avx2 sqrt_double_avx2(double_avx2 x) { return (double_avx2) _mm256_sqrt_pd((__m256d) x); }
+static inline __attribute__((target(ISA_avx512))) float_avx512 sqrt_float_avx512(float_avx512 x) { return (float_avx512) _mm512_sqrt_ps((__m512) x); }
+static inline __attribute__((target(ISA_avx512))) double_avx512 sqrt_double_avx512(double_avx512 x) { return (double_avx512) _mm512_sqrt_pd((__m512d) x); }
+#endif
+
+/*
+	Les opérations sur une chaîne `x`, avec les constantes locales `z`, `o` et `b` et la racine carrée `sq`. `fma` demande en plus le jeu d'instructions FMA.
+*/
+#define OP_add(x, sq) ((x) + z)
+#define OP_mul(x, sq) ((x) * o)
+#define OP_div(x, sq) (b / (x))
+#define OP_sqrt(x, sq) sq((x) + o)
+#define OP_fma(x, sq) ((x) * o + z)
+
+#define ISA_OP_add ""
+#define ISA_OP_mul ""
+#define ISA_OP_div ""
+#define ISA_OP_sqrt ""
+#define ISA_OP_fma ",fma"
+
+/*
+	Le registre d'une chaîne : général (`gpr`) pour les entiers scalaires, x87 pour `long double`, vectoriel (`vec`) sinon. La pile x87 n'a que 8 registres : avec les constantes, 6 chaînes au plus y tiennent sans passer par la mémoire. Sur ARM 64 bits, les flottants et `long double` sont dans les registres vectoriels, ailleurs la chaîne passe par la mémoire.
+*/
+#define REG_gpr "r"
+#if defined(__x86_64__) || defined(__i386__)
+#define REG_vec "v"
+#define REG_x87 "t"
+#elif defined(__aarch64__)
+#define REG_vec "w"
+#define REG_x87 "w"
+#else
+#define REG_vec "m"
+#define REG_x87 "m"
+#endif
+
+#define CHAINS_gpr CHAINS
+#define CHAINS_vec CHAINS
+#define CHAINS_x87 6
+
+#define STEP(x, op, sq, reg) x = OP_##op(x, sq); __asm__("" : "+" REG_##reg(x));
+#define STEP_CHAIN(k, x, op, sq, reg) if (k < CHAINS_##reg) { STEP(x, op, sq, reg) }
+#define KEEP_CHAIN(k, x, reg) if (k < CHAINS_##reg) { BM_DO_NOT_OPTIMIZE(x); }
+
+/*
+	Pour un type `tname` à la largeur `width` et l'opération `op`, la chaîne de latence `lat_<type>_<largeur>_<op>` et les chaînes de débit `thr_<type>_<largeur>_<op>`, qui font `n` itérations.
+*/
+#define KERNEL(tname, width, reg, sq, op) \
+	__attribute__((noinline)) TARGET(width, op) long lat_##tname##_##width##_##op(long n) { \
+		typedef tname##_##width V; \
+		V z = (V){0} + tname##_z, o = (V){0} + tname##_o, b = (V){0} + tname##_b; \
+		(void) z; (void) o; (void) b; \
+		V x = (V){0} + tname##_x0; \
+		long i; \
+		for (i = 0; i < n; i++) { \
+			STEP(x, op, sq, reg) STEP(x, op, sq, reg) STEP(x, op, sq, reg) STEP(x, op, sq, reg) \
+			STEP(x, op, sq, reg) STEP(x, op, sq, reg) STEP(x, op, sq, reg) STEP(x, op, sq, reg) \
+		} \
+		BM_DO_NOT_OPTIMIZE(x); \
+		return 0; \
+	} \
+	__attribute__((noinline)) TARGET(width, op) long thr_##tname##_##width##_##op(long n) { \
+		typedef tname##_##width V; \
+		V z = (V){0} + tname##_z, o = (V){0} + tname##_o, b = (V){0} + tname##_b; \
+		(void) z; (void) o; (void) b; \
+		V x0, x1, x2, x3, x4, x5, x6, x7; \
+		x0 = x1 = x2 = x3 = x4 = x5 = x6 = x7 = (V){0} + tname##_x0; \
+		long i; \
+		for (i = 0; i < n; i++) { \
+			STEP_CHAIN(0, x0, op, sq, reg) STEP_CHAIN(1, x1, op, sq, reg) STEP_CHAIN(2, x2, op, sq, reg) STEP_CHAIN(3, x3, op, sq, reg) \
+			STEP_CHAIN(4, x4, op, sq, reg) STEP_CHAIN(5, x5, op, sq, reg) STEP_CHAIN(6, x6, op, sq, reg) STEP_CHAIN(7, x7, op, sq, reg) \
+		} \
+		KEEP_CHAIN(0, x0, reg) KEEP_CHAIN(1, x1, reg) KEEP_CHAIN(2, x2, reg) KEEP_CHAIN(3, x3, reg) \
+		KEEP_CHAIN(4, x4, reg) KEEP_CHAIN(5, x5, reg) KEEP_CHAIN(6, x6, reg) KEEP_CHAIN(7, x7, reg) \
+		return 0; \
 	}
-	return 0;
-}
+
+#define INT_KERNELS(tname, width, reg) \
+	KERNEL(tname, width, reg, none, add) KERNEL(tname, width, reg, none, mul) \
+	KERNEL(tname, width, reg, none, div) KERNEL(tname, width, reg, none, fma)
+#define FLOAT_KERNELS(tname, width, reg) \
+	KERNEL(tname, width, reg, sqrt_##tname##_##width, add) KERNEL(tname, width, reg, sqrt_##tname##_##width, mul) \
+	KERNEL(tname, width, reg, sqrt_##tname##_##width, div) KERNEL(tname, width, reg, sqrt_##tname##_##width, sqrt) \
+	KERNEL(tname, width, reg, sqrt_##tname##_##width, fma)
 
 /*
- *  ______ _             _
- * |  ____| |           | |
- * | |__  | | ___   __ _| |_
- * |  __| | |/ _ \ / _` | __|
- * | |    | | (_) | (_| | |_
- * |_|    |_|\___/ \__,_|\__|
- */
+	Toutes les combinaisons : `X(type, largeur, registre, opérations)`.
+*/
+#define COMBINATIONS(X) \
+	X(int8, scalar, gpr, INT) X(int8, sse, vec, INT) X(int8, avx2, vec, INT) X(int8, avx512, vec, INT) \
+	X(int16, scalar, gpr, INT) X(int16, sse, vec, INT) X(int16, avx2, vec, INT) X(int16, avx512, vec, INT) \
+	X(int32, scalar, gpr, INT) X(int32, sse, vec, INT) X(int32, avx2, vec, INT) X(int32, avx512, vec, INT) \
+	X(int64, scalar, gpr, INT) X(int64, sse, vec, INT) X(int64, avx2, vec, INT) X(int64, avx512, vec, INT) \
+	X(float, scalar, vec, FLOAT) X(float, sse, vec, FLOAT) X(float, avx2, vec, FLOAT) X(float, avx512, vec, FLOAT) \
+	X(double, scalar, vec, FLOAT) X(double, sse, vec, FLOAT) X(double, avx2, vec, FLOAT) X(double, avx512, vec, FLOAT) \
+	X(ldouble, scalar, x87, FLOAT)
+
+#define GENERATE(tname, width, reg, kind) IF_##width(kind##_KERNELS(tname, width, reg), )
+
+COMBINATIONS(GENERATE)
+
+/*
+	La table des mesures : une ligne par type et largeur, une colonne par opération.
+*/
+enum { ADD, MUL, DIV, SQRT, FMA, NOPS };
+static const char *op_names[NOPS] = {"add", "mul", "div", "sqrt", "fma"};
+
+enum { SCALAR, SSE, AVX2, AVX512, NWIDTHS };
+
+typedef long (*kernel)(long n);
+
+typedef struct row {
+	const char *type;
+	const char *width;
+	int w;	// SCALAR, SSE, AVX2 ou AVX512
+	int elems;	// éléments par opération
+	int chains;	// chaînes de la mesure de débit
+	kernel lat[NOPS];	// NULL si l'opération n'existe pas pour ce type
+	kernel thr[NOPS];
+} row;
+
+#define WIDTH_scalar SCALAR
+#define WIDTH_sse SSE
+#define WIDTH_avx2 AVX2
+#define WIDTH_avx512 AVX512
+
+#define OPS_INT(p, tname, width) {p##_##tname##_##width##_add, p##_##tname##_##width##_mul, p##_##tname##_##width##_div, NULL, p##_##tname##_##width##_fma}
+#define OPS_FLOAT(p, tname, width) {p##_##tname##_##width##_add, p##_##tname##_##width##_mul, p##_##tname##_##width##_div, p##_##tname##_##width##_sqrt, p##_##tname##_##width##_fma}
+
+#define ROW(tname, width, reg, kind) \
+	{#tname, #width, WIDTH_##width, sizeof(tname##_##width) / sizeof(tname##_scalar), CHAINS_##reg, \
+		IF_##width(OPS_##kind(lat, tname, width), {NULL}), IF_##width(OPS_##kind(thr, tname, width), {NULL})},
+
+static const row rows[] = {
+	COMBINATIONS(ROW)
+};
+
+#define NROWS (sizeof(rows) / sizeof(rows[0]))
 
 /**
- * \brief `primeFloat` cherche les `nMax` premiers nombres premiers
- *
- * \param nMax Défini combien de nombres premiers on cherche
- *
- * \param t Le temps dans lequel on stoque le temps de début
- *
- * \param r Sauvegarde le temps dans un fichier .csv
- *
- * Cherche les `nMax` premiers nombres premiers par la methode de brute force.
- * Utilise exclusivement des float pour le calcul. A la fin du calcul
- * sauvegarde le temps écoulé dans un fichier .csv en utilisant un `recorder` .
- */
-
-
-int primeFloat (int nMax, timer* t, recorder* r) {
-	float count, i = 3, c;
-	
-	start_timer(t);
-	
-	for (count = 2; count <= nMax; ) {
-		for (c = 2; c <= i ; c++) {
-			if (fmod(i,c) == 0.0) {
-				break;
-			}
-		}
-		if (c == i) {
-			count ++;
-			if (fmod(count,50.0) == 0.0){
-				write_record_n(r,count,stop_timer(t),nMax);
-			}
-		}
-		i++;
+	\brief Temps d'une itération de `f` en ns
+
+	Double le nombre d'itérations jusqu'à ce que la mesure dure au moins `MIN_TIME` ns.
+*/
+double measure(timer *t, kernel f) {
+	long n = 1024, time;
+	sink += f(n);
+	for (;;) {
+		start_timer(t);
+		sink += f(n);
+		time = stop_timer(t);
+		if (time >= MIN_TIME || n >= MAX_ITER)
+			break;
+		n *= 2;
 	}
-	return 0;
+	return (double) (time - get_overhead()) / n;
 }
 
-/*
- *  __  __       _
- * |  \/  |     (_)
- * | \  / | __ _ _ _ __
- * | |\/| |/ _` | | '_ \
- * | |  | | (_| | | | | |
- * |_|  |_|\__,_|_|_| |_|
- */
-
 /**
- * \brief Enregistre les temps de calcul nécessaire à trouver des nombres premiers
- *
- * On calcul les `N` premiers nombres premiers par la méthode de brute force en
- * utilisant 3 types différents: `int` ,`long long int` et `float` . A chaque fois
- * les temps de calcul sont enregistrés dans des fichier .csv et afficher sous
- * forme de graphe afin de permettre une lecture et comparaison facile de ceus là.
- */
+	\brief Écrit `values` dans `name`, une ligne par type et largeur
+*/
+void write_matrix(const char *name, const char *unit, double values[][NOPS]) {
+	FILE *f = fopen(name, "w");
+	if (f == NULL) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(f, "# type-largeur, elements");
+	int k;
+	for (k = 0; k < NOPS; k++)
+		fprintf(f, ", %s", op_names[k]);
+	fprintf(f, " (%s)\n", unit);
+	unsigned int i;
+	for (i = 0; i < NROWS; i++) {
+		fprintf(f, "%s-%s, %d", rows[i].type, rows[i].width, rows[i].elems);
+		for (k = 0; k < NOPS; k++)
+			fprintf(f, ", %.3f", values[i][k]);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+}
 
 int main (int argc, char *argv[]) {
-	
+	int widths[NWIDTHS] = {1, 0, 0, 0};
+	int fma = 1;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	widths[SSE] = __builtin_cpu_supports("sse4.2");
+	widths[AVX2] = __builtin_cpu_supports("avx2");
+	widths[AVX512] = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+		&& __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl");
+	fma = __builtin_cpu_supports("fma");
+#endif
+
 	timer *t = timer_alloc();
-	recorder *int_rec = recorder_alloc("int.csv");
-	recorder *long_rec = recorder_alloc("long.csv");
-	recorder *float_rec = recorder_alloc("float.csv");
-	// on init tous les `recorders` et le timer
-	
-	primeInt(N,t,int_rec);
-	primeLong(N,t,long_rec);
-	primeFloat(N,t,float_rec);
-	// on lance les tests
-	
-	recorder_free(int_rec);
-	recorder_free(long_rec);
-	recorder_free(float_rec);
+	static double latency[NROWS][NOPS], throughput[NROWS][NOPS];
+	unsigned int i;
+	for (i = 0; i < NROWS; i++) {
+		int k;
+		for (k = 0; k < NOPS; k++) {
+			latency[i][k] = throughput[i][k] = NAN;
+			if (rows[i].lat[k] == NULL || !widths[rows[i].w] || (k == FMA && !fma))
+				continue;
+			latency[i][k] = measure(t, rows[i].lat[k]) / UNROLL;
+			throughput[i][k] = rows[i].chains * rows[i].elems / measure(t, rows[i].thr[k]);
+		}
+		printf("%s-%s\n", rows[i].type, rows[i].width);
+	}
 	timer_free(t);
-	// on free toutes nos structures
-	
-	return 0;
+
+	write_matrix("types-latency.csv", "ns par opération", latency);
+	write_matrix("types-throughput.csv", "éléments par ns", throughput);
+	return EXIT_SUCCESS;
 }
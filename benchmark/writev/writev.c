@@ -5,11 +5,18 @@
 
 #include "benchmark.h"
 #include "copy.h"
+#include "arena.h"
 
 #define SIZE  128 // taille du buffer en bytes
 #define MAX   1024 //multiplicateur maximum pour la taille du buffer
 #define FILE_SIZE  131072 //taille du fichier a ecrire en bytes
 
+/*
+ * Buffers des iovec, remis a zero a la fin de chaque benchmark au lieu
+ * d'un malloc/free par iovec.
+ */
+arena *scratch;
+
 
 /*
  *Benchmark de writev.
@@ -24,11 +31,7 @@ void benchmark_writev(int fd, int buffer_size, int file_size, timer *t, recorder
 	int i = 0;
 	
 	for(i = 0; i < iovcnt; i++){
-		iov[i].iov_base = malloc(iov_len);
-		if(iov[i].iov_base == NULL){
-			fprintf(stderr, "malloc at benchmark_writev");
-			exit(0);
-		}
+		iov[i].iov_base = arena_push(scratch, iov_len);
 		memset(iov[i].iov_base, 0, iov_len);
 		iov[i].iov_len = iov_len;
 	}// remplit les iovec par des '0'
@@ -43,9 +46,7 @@ void benchmark_writev(int fd, int buffer_size, int file_size, timer *t, recorder
 		//exit(0);
 	}
 
-	for(i = 0; i < iovcnt; i++){
-		free(iov[i].iov_base);
-	}
+	arena_reset(scratch);
 }
 
 /*
@@ -57,11 +58,7 @@ void benchmark_writev(int fd, int buffer_size, int file_size, timer *t, recorder
 void benchmark_lseek(int fd, int buffer_size, int file_size, timer *t, recorder *rec){
 	int len = sizeof(char) * buffer_size;
 	int num = file_size / buffer_size;	
-	char *s = malloc(len);
-	if(s == NULL){
-		fprintf(stderr, "malloc at benchmark_lseek");
-		exit(0);
-	}
+	char *s = arena_push(scratch, len);
 	memset(s, 0, len); //remplit la chaîne de caractere par des '0'
 	int i = 0;
 	int err = 0;
@@ -76,13 +73,14 @@ void benchmark_lseek(int fd, int buffer_size, int file_size, timer *t, recorder
 	}
 	write_record(rec, buffer_size, stop_timer(t));
 
-	free(s);
+	arena_reset(scratch);
 }
 
 int main(int argc, char *argv[]){
 	timer *t = timer_alloc();
 	recorder *writev_rec = recorder_alloc("writev.csv");
 	recorder *lseek_rec = recorder_alloc("lseek.csv");
+	scratch = arena_alloc(FILE_SIZE);
 	
 
 	/*BENCHMARK DE WRITEV*/
@@ -110,6 +108,7 @@ int main(int argc, char *argv[]){
 	free(t);
 	free(writev_rec);
 	free(lseek_rec);
+	arena_free(scratch);
 	
 	return EXIT_SUCCESS;
 }